@@ -1,7 +1,7 @@
 #include "../include/hal/can_bus.h"
 #include "../include/hal/i2c_bus.h"
 #include "../include/hal/spi_bus.h"
-#include "../../rt/include/rt/rt_queue.h"
+#include "../../rt/include/rt/rt_mpmc_queue.h"
 #include "../../rt/include/rt/rt_scheduler.h"
 
 #include <chrono>
@@ -21,7 +21,8 @@ int main() {
   rtos::hal::DummyCanBus can;
   rtos::hal::DummyI2cBus i2c;
   rtos::hal::DummySpiBus spi;
-  rtos::rt::RtQueue<Sample> queue(64);
+  // Device readers may run on threads of their own; none of them locks.
+  rtos::rt::RtMpmcQueue<Sample, 64, rtos::rt::FutexWait> queue;
 
   can.open("can0");
   i2c.open("/dev/i2c-0");
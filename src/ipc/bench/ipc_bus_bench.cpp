@@ -0,0 +1,64 @@
+#include "../include/ipc/binary_serializer.h"
+#include "../include/ipc/ipc_bus.h"
+#include "../include/ipc/local_transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kPublishes = 20000;
+
+int64_t percentile(std::vector<int64_t> values, double fraction) {
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+// In-process publish-to-handler latency over LocalTransport, with messages
+// handed over as shared objects or serialized to bytes and back.
+void run(bool fast_path, size_t payload_bytes) {
+  rtos::ipc::IpcBus::Options options;
+  options.in_process_fast_path = fast_path;
+  rtos::ipc::IpcBus bus(std::make_unique<rtos::ipc::LocalTransport>(),
+                        std::make_unique<rtos::ipc::BinarySerializer>(),
+                        options);
+  Clock::time_point received;
+  bus.subscribe("bench", [&](const rtos::ipc::IpcMessage&) {
+    received = Clock::now();
+  });
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(kPublishes);
+  std::vector<uint8_t> payload(payload_bytes, 0x42);
+  for (size_t i = 0; i < kPublishes; ++i) {
+    rtos::ipc::IpcMessage message;
+    message.topic = "bench";
+    message.payload = payload;
+    Clock::time_point start = Clock::now();
+    bus.publish(std::move(message));
+    latencies.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(received - start)
+            .count());
+  }
+  std::printf("%-6s payload=%-6zu p50=%7lldns p99=%8lldns\n",
+              fast_path ? "shared" : "bytes", payload_bytes,
+              static_cast<long long>(percentile(latencies, 0.50)),
+              static_cast<long long>(percentile(latencies, 0.99)));
+}
+
+}  // namespace
+
+int main() {
+  for (size_t payload_bytes : {64, 4096, 65536}) {
+    run(false, payload_bytes);
+    run(true, payload_bytes);
+  }
+  return 0;
+}
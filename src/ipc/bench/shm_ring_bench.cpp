@@ -0,0 +1,538 @@
+#include "../include/ipc/ipc_reactor.h"
+#include "../include/ipc/shm_transport.h"
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kReaders = 2;
+constexpr size_t kLatencySamples = 20000;
+constexpr size_t kThroughputMessages = 200000;
+constexpr size_t kPayloadBytes = 64;
+constexpr size_t kScalingMessages = 240000;
+constexpr size_t kWakeupSamples = 2000;
+constexpr auto kWakeupInterval = std::chrono::microseconds(200);
+constexpr size_t kHistogramBuckets = 12;
+constexpr size_t kRegistryWrites = 20000;
+constexpr size_t kReactorSegments = 20;
+constexpr size_t kReactorBursts = 500;
+constexpr size_t kReactorBurstFrames = 64;
+constexpr size_t kFaultSegmentBytes = 1 << 22;
+constexpr size_t kFaultPayloadBytes = 4096;
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+struct Reader {
+  std::atomic<uint64_t> received{0};
+  std::vector<int64_t> latencies_ns;
+};
+
+const char* mode_name(rtos::ipc::ShmReceiveMode mode) {
+  switch (mode) {
+    case rtos::ipc::ShmReceiveMode::kSpinThenBlock:
+      return "spin-then-block";
+    case rtos::ipc::ShmReceiveMode::kBusyPoll:
+      return "busy-poll";
+    case rtos::ipc::ShmReceiveMode::kBlock:
+      break;
+  }
+  return "block";
+}
+
+const char* ring_name(rtos::ipc::ShmRingKind kind) {
+  return kind == rtos::ipc::ShmRingKind::kLockFree ? "lock-free" : "mutex";
+}
+
+int64_t percentile(std::vector<int64_t> values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+void run(rtos::ipc::ShmRingKind kind) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_bench_shm";
+  config.size_bytes = 1 << 20;
+  config.max_consumers = kReaders + 1;
+  config.ring = kind;
+
+  config.is_owner = true;
+  config.consumer_id = 0;
+  rtos::ipc::ShmTransport producer(config);
+  producer.start([](const std::vector<uint8_t>&) {});
+
+  std::vector<std::unique_ptr<Reader>> readers;
+  std::vector<std::unique_ptr<rtos::ipc::ShmTransport>> transports;
+  for (size_t i = 0; i < kReaders; ++i) {
+    readers.push_back(std::make_unique<Reader>());
+    readers.back()->latencies_ns.reserve(kLatencySamples);
+    config.is_owner = false;
+    config.consumer_id = i + 1;
+    transports.push_back(std::make_unique<rtos::ipc::ShmTransport>(config));
+    Reader* reader = readers.back().get();
+    transports.back()->start([reader](const std::vector<uint8_t>& bytes) {
+      int64_t sent_ns = 0;
+      std::memcpy(&sent_ns, bytes.data(), sizeof(sent_ns));
+      if (sent_ns != 0 &&
+          reader->latencies_ns.size() < reader->latencies_ns.capacity()) {
+        reader->latencies_ns.push_back(now_ns() - sent_ns);
+      }
+      reader->received.fetch_add(1, std::memory_order_release);
+    });
+  }
+
+  auto wait_for = [&](uint64_t target) {
+    for (auto& reader : readers) {
+      while (reader->received.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  std::vector<uint8_t> payload(kPayloadBytes, 0);
+  uint64_t sent = 0;
+  for (size_t i = 0; i < kLatencySamples; ++i) {
+    int64_t stamp = now_ns();
+    std::memcpy(payload.data(), &stamp, sizeof(stamp));
+    while (!producer.publish(payload)) {
+      std::this_thread::yield();
+    }
+    wait_for(++sent);
+  }
+
+  std::memset(payload.data(), 0, sizeof(int64_t));
+  auto begin = Clock::now();
+  for (size_t i = 0; i < kThroughputMessages; ++i) {
+    while (!producer.publish(payload)) {
+      std::this_thread::yield();
+    }
+  }
+  sent += kThroughputMessages;
+  wait_for(sent);
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::vector<int64_t> latencies;
+  for (auto& reader : readers) {
+    latencies.insert(latencies.end(), reader->latencies_ns.begin(),
+                     reader->latencies_ns.end());
+  }
+  std::printf("%-10s readers=%zu p50=%6.2fus p99=%7.2fus max=%8.2fus "
+              "throughput=%.0f msg/s\n",
+              ring_name(kind), kReaders, percentile(latencies, 0.50) / 1e3,
+              percentile(latencies, 0.99) / 1e3,
+              percentile(latencies, 1.0) / 1e3,
+              kThroughputMessages / seconds);
+
+  for (auto& transport : transports) {
+    transport->stop();
+  }
+  producer.stop();
+}
+
+// Aggregate throughput of |producers| publishing threads into one reader,
+// either sharing a single sub-ring or each owning one, and its ratio to
+// |baseline| (one producer). Returns the throughput.
+double run_producers(size_t producers, size_t sub_rings, double baseline) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_bench_shm";
+  config.size_bytes = 1 << 18;
+  config.max_consumers = 1;
+  config.max_producers = sub_rings;
+  config.is_owner = true;
+  config.consumer_id = 0;
+
+  std::atomic<uint64_t> received{0};
+  rtos::ipc::ShmTransport reader(config);
+  reader.start([&received](const std::vector<uint8_t>&) {
+    received.fetch_add(1, std::memory_order_release);
+  });
+
+  config.is_owner = false;
+  config.receive = false;
+  std::vector<std::unique_ptr<rtos::ipc::ShmTransport>> transports;
+  for (size_t i = 0; i < producers; ++i) {
+    transports.push_back(std::make_unique<rtos::ipc::ShmTransport>(config));
+    transports.back()->start(nullptr);
+  }
+
+  size_t per_producer = kScalingMessages / producers;
+  auto begin = Clock::now();
+  std::vector<std::thread> threads;
+  for (auto& transport : transports) {
+    rtos::ipc::ShmTransport* publisher = transport.get();
+    threads.emplace_back([publisher, per_producer]() {
+      std::vector<uint8_t> payload(kPayloadBytes, 0);
+      for (size_t i = 0; i < per_producer; ++i) {
+        while (!publisher->publish(payload)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  while (received.load(std::memory_order_acquire) < per_producer * producers) {
+    std::this_thread::yield();
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  double throughput = per_producer * producers / seconds;
+  std::printf("producers=%zu sub_rings=%zu throughput=%.0f msg/s "
+              "scaling=%.2fx\n",
+              producers, sub_rings, throughput,
+              baseline > 0 ? throughput / baseline : 1.0);
+
+  for (auto& transport : transports) {
+    transport->stop();
+  }
+  reader.stop();
+  return throughput;
+}
+
+// Publishes a frame every kWakeupInterval so the reader is idle when it
+// arrives, and buckets publish-to-handler latency by powers of two (us).
+void run_wakeup(rtos::ipc::ShmReceiveMode mode) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_bench_shm";
+  config.size_bytes = 1 << 16;
+  config.max_consumers = 1;
+  config.is_owner = true;
+  config.receive_mode = mode;
+  config.spin_budget = std::chrono::microseconds(100);
+
+  std::array<std::atomic<uint64_t>, kHistogramBuckets> buckets{};
+  std::atomic<uint64_t> received{0};
+  rtos::ipc::ShmTransport transport(config);
+  transport.start([&](const std::vector<uint8_t>& bytes) {
+    int64_t sent_ns = 0;
+    std::memcpy(&sent_ns, bytes.data(), sizeof(sent_ns));
+    int64_t micros = (now_ns() - sent_ns) / 1000;
+    size_t bucket = 0;
+    while (bucket + 1 < kHistogramBuckets && micros >= (int64_t{1} << bucket)) {
+      ++bucket;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    received.fetch_add(1, std::memory_order_release);
+  });
+
+  std::vector<uint8_t> payload(kPayloadBytes, 0);
+  for (size_t i = 0; i < kWakeupSamples; ++i) {
+    std::this_thread::sleep_for(kWakeupInterval);
+    int64_t stamp = now_ns();
+    std::memcpy(payload.data(), &stamp, sizeof(stamp));
+    transport.publish(payload);
+  }
+  while (received.load(std::memory_order_acquire) < kWakeupSamples) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  transport.stop();
+
+  std::printf("wakeup %s\n", mode_name(mode));
+  for (size_t i = 0; i < kHistogramBuckets; ++i) {
+    uint64_t count = buckets[i].load();
+    if (count == 0) {
+      continue;
+    }
+    if (i + 1 < kHistogramBuckets) {
+      std::printf("  <%5lldus %6llu\n", static_cast<long long>(1) << i,
+                  static_cast<unsigned long long>(count));
+    } else {
+      std::printf("  >=%4lldus %6llu\n", static_cast<long long>(1) << (i - 1),
+                  static_cast<unsigned long long>(count));
+    }
+  }
+}
+
+// Producer-side write cost with |consumers| registered readers, all keeping
+// up. Only write() is timed, so this isolates the admission check.
+void run_registry(size_t consumers) {
+  size_t bytes = rtos::ipc::ShmRing::segment_size(1 << 16, consumers);
+  bytes = (bytes + rtos::ipc::kShmCacheLine - 1) &
+          ~(rtos::ipc::kShmCacheLine - 1);
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, bytes);
+  rtos::ipc::ShmRing ring;
+  ring.create(memory, bytes, consumers);
+  size_t id = 0;
+  for (size_t i = 0; i < consumers; ++i) {
+    ring.claim_consumer(&id);
+  }
+
+  std::vector<uint8_t> payload(kPayloadBytes, 0);
+  rtos::ipc::ShmFrameView view;
+  int64_t write_ns = 0;
+  for (size_t i = 0; i < kRegistryWrites; ++i) {
+    int64_t start = now_ns();
+    ring.write(payload.data(), payload.size());
+    write_ns += now_ns() - start;
+    for (size_t c = 0; c < consumers; ++c) {
+      if (ring.peek(c, &view)) {
+        ring.consume(c);
+      }
+    }
+  }
+  std::free(memory);
+  std::printf("registry consumers=%-4zu write avg=%lldns\n", consumers,
+              static_cast<long long>(write_ns / kRegistryWrites));
+}
+
+long context_switches() {
+  struct rusage usage {};
+  ::getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// Bursts of one frame on each of kReactorSegments segments, received either
+// by one thread per segment or by a single reactor thread.
+void run_reactor(bool shared) {
+  rtos::ipc::IpcReactor reactor;
+  if (shared) {
+    reactor.start();
+  }
+  std::atomic<uint64_t> received{0};
+  std::vector<std::unique_ptr<rtos::ipc::ShmTransport>> transports;
+  for (size_t i = 0; i < kReactorSegments; ++i) {
+    rtos::ipc::ShmTransportConfig config;
+    config.name = "/rtos_ipc_bench_reactor" + std::to_string(i);
+    config.size_bytes = 1 << 16;
+    config.max_consumers = 1;
+    config.is_owner = true;
+    config.reactor = shared ? &reactor : nullptr;
+    transports.push_back(std::make_unique<rtos::ipc::ShmTransport>(config));
+    transports.back()->start([&](const std::vector<uint8_t>&) {
+      received.fetch_add(1, std::memory_order_release);
+    });
+  }
+
+  std::vector<uint8_t> payload(kPayloadBytes, 0);
+  std::vector<int64_t> drain_ns;
+  drain_ns.reserve(kReactorBursts);
+  long switches_before = context_switches();
+  for (size_t burst = 0; burst < kReactorBursts; ++burst) {
+    uint64_t target = (burst + 1) * kReactorSegments;
+    int64_t start = now_ns();
+    for (auto& transport : transports) {
+      transport->publish(payload);
+    }
+    while (received.load(std::memory_order_acquire) < target) {
+      std::this_thread::yield();
+    }
+    drain_ns.push_back(now_ns() - start);
+  }
+  long switches = context_switches() - switches_before;
+  transports.clear();
+  reactor.stop();
+
+  std::printf(
+      "segments=%zu %-8s burst p50=%7.2fus p99=%8.2fus switches/burst=%.1f\n",
+      kReactorSegments, shared ? "reactor" : "threads",
+      percentile(drain_ns, 0.50) / 1000.0, percentile(drain_ns, 0.99) / 1000.0,
+      static_cast<double>(switches) / kReactorBursts);
+}
+
+// Time from an event to its handler on a reactor serving one ring and one
+// eventfd. Idle: after a pause, either a frame or an eventfd write wakes the
+// sleeping reactor. Busy: the eventfd is written right behind a burst of
+// frames, while the reactor is awake draining them.
+void run_reactor_wakeup(bool busy) {
+  rtos::ipc::IpcReactor reactor;
+  reactor.start();
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_bench_reactor_wake";
+  config.size_bytes = 1 << 16;
+  config.max_consumers = 1;
+  config.is_owner = true;
+  config.reactor = &reactor;
+  std::vector<int64_t> ring_ns;
+  std::vector<int64_t> fd_ns;
+  ring_ns.reserve(kWakeupSamples);
+  fd_ns.reserve(kWakeupSamples);
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> events{0};
+  std::atomic<int64_t> fd_sent_ns{0};
+  rtos::ipc::ShmTransport transport(config);
+  transport.start([&](const std::vector<uint8_t>& bytes) {
+    int64_t sent_ns = 0;
+    std::memcpy(&sent_ns, bytes.data(), sizeof(sent_ns));
+    if (sent_ns != 0) {
+      ring_ns.push_back(now_ns() - sent_ns);
+    }
+    frames.fetch_add(1, std::memory_order_release);
+  });
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  reactor.add_fd(fd, [&]() {
+    uint64_t value = 0;
+    while (::read(fd, &value, sizeof(value)) == sizeof(value)) {
+    }
+    fd_ns.push_back(now_ns() - fd_sent_ns.load());
+    events.fetch_add(1, std::memory_order_release);
+  });
+
+  std::vector<uint8_t> payload(kPayloadBytes, 0);
+  uint64_t sent_frames = 0;
+  uint64_t sent_events = 0;
+  for (size_t i = 0; i < kWakeupSamples; ++i) {
+    std::this_thread::sleep_for(kWakeupInterval);
+    if (!busy && i % 2 == 0) {
+      int64_t stamp = now_ns();
+      std::memcpy(payload.data(), &stamp, sizeof(stamp));
+      transport.publish(payload);
+      ++sent_frames;
+      while (frames.load(std::memory_order_acquire) < sent_frames) {
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    if (busy) {
+      std::memset(payload.data(), 0, sizeof(int64_t));
+      for (size_t n = 0; n < kReactorBurstFrames; ++n) {
+        transport.publish(payload);
+      }
+    }
+    uint64_t one = 1;
+    fd_sent_ns.store(now_ns());
+    if (::write(fd, &one, sizeof(one)) != sizeof(one)) {
+      break;
+    }
+    ++sent_events;
+    while (events.load(std::memory_order_acquire) < sent_events) {
+      std::this_thread::yield();
+    }
+  }
+  reactor.remove_fd(fd);
+  transport.stop();
+  reactor.stop();
+  ::close(fd);
+
+  if (busy) {
+    std::printf("reactor busy fd p50=%7.2fus p99=%8.2fus\n",
+                percentile(fd_ns, 0.50) / 1000.0,
+                percentile(fd_ns, 0.99) / 1000.0);
+  } else {
+    std::printf(
+        "reactor idle ring p50=%7.2fus p99=%8.2fus fd p50=%7.2fus "
+        "p99=%8.2fus\n",
+        percentile(ring_ns, 0.50) / 1000.0, percentile(ring_ns, 0.99) / 1000.0,
+        percentile(fd_ns, 0.50) / 1000.0, percentile(fd_ns, 0.99) / 1000.0);
+  }
+}
+
+long minor_faults() {
+  struct rusage usage {};
+  ::getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_minflt;
+}
+
+// Minor faults taken by the publisher and the receiver thread on the first
+// pass over the ring (cold) and on the second (steady state).
+void run_page_faults(bool hardened) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_bench_shm";
+  config.size_bytes = kFaultSegmentBytes;
+  config.max_consumers = 1;
+  config.is_owner = true;
+  config.prefault = hardened;
+  config.lock_memory = hardened;
+  config.huge_pages = hardened;
+
+  size_t per_pass = kFaultSegmentBytes / kFaultPayloadBytes;
+  std::atomic<uint64_t> received{0};
+  std::atomic<long> receiver_cold{0};
+  std::atomic<long> receiver_steady{0};
+  long receiver_base = 0;
+  rtos::ipc::ShmTransport transport(config);
+  transport.start([&](const std::vector<uint8_t>&) {
+    uint64_t count = received.load(std::memory_order_relaxed);
+    if (count == 0) {
+      receiver_base = minor_faults();
+    } else if (count == per_pass) {
+      receiver_cold.store(minor_faults() - receiver_base);
+      receiver_base = minor_faults();
+    } else if (count + 1 == 2 * per_pass) {
+      receiver_steady.store(minor_faults() - receiver_base);
+    }
+    received.fetch_add(1, std::memory_order_release);
+  });
+
+  std::vector<uint8_t> payload(kFaultPayloadBytes, 0);
+  long publisher_cold = 0;
+  long publisher_steady = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    long before = minor_faults();
+    for (size_t i = 0; i < per_pass; ++i) {
+      while (!transport.publish(payload)) {
+        std::this_thread::yield();
+      }
+    }
+    (pass == 0 ? publisher_cold : publisher_steady) = minor_faults() - before;
+    while (received.load(std::memory_order_acquire) < (pass + 1) * per_pass) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  bool locked = transport.memory_locked();
+  transport.stop();
+
+  std::printf(
+      "faults %-8s locked=%d publisher cold=%ld steady=%ld receiver cold=%ld "
+      "steady=%ld\n",
+      hardened ? "hardened" : "default", locked ? 1 : 0,
+      publisher_cold, publisher_steady, receiver_cold.load(),
+      receiver_steady.load());
+}
+
+}  // namespace
+
+int main() {
+  run(rtos::ipc::ShmRingKind::kMutex);
+  run(rtos::ipc::ShmRingKind::kLockFree);
+
+  // Scaling needs a core per producer; on fewer cores the sub-rings only
+  // remove the writer lock contention.
+  double baseline = run_producers(1, 1, 0);
+  for (size_t producers : {2, 4, 6}) {
+    run_producers(producers, 1, baseline);
+    run_producers(producers, producers, baseline);
+  }
+
+  run_wakeup(rtos::ipc::ShmReceiveMode::kBlock);
+  run_wakeup(rtos::ipc::ShmReceiveMode::kSpinThenBlock);
+  run_wakeup(rtos::ipc::ShmReceiveMode::kBusyPoll);
+
+  for (size_t consumers : {1, 8, 64, 256}) {
+    run_registry(consumers);
+  }
+
+  run_reactor(false);
+  run_reactor(true);
+  run_reactor_wakeup(false);
+  run_reactor_wakeup(true);
+
+  run_page_faults(false);
+  run_page_faults(true);
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include "../include/ipc/tcp_transport.h"
+#include "../include/ipc/unix_transport.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMessages = 200000;
+constexpr size_t kPayloadBytes = 64;
+constexpr uint16_t kBenchPort = 55741;
+constexpr const char* kBenchPath = "/tmp/rtos_ipc_socket_bench.sock";
+
+int64_t cpu_ns() {
+  struct rusage usage {};
+  ::getrusage(RUSAGE_SELF, &usage);
+  auto to_ns = [](const timeval& value) {
+    return static_cast<int64_t>(value.tv_sec) * 1000000000 +
+           static_cast<int64_t>(value.tv_usec) * 1000;
+  };
+  return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+const char* backend_name(rtos::ipc::SocketBackend backend) {
+  return backend == rtos::ipc::SocketBackend::kIoUring ? "io_uring" : "epoll";
+}
+
+// A client publishes |messages| frames to a server in the same process.
+// kBlock keeps every frame, so the rate is what the receiving side sustains.
+// CPU time covers both ends.
+template <typename Transport, typename Config>
+void run(const char* name, Config server_config, Config client_config,
+         rtos::ipc::SocketBackend backend, size_t payload_bytes = kPayloadBytes,
+         size_t messages = kMessages) {
+  server_config.backend = backend;
+  server_config.overflow_policy = rtos::ipc::SendOverflowPolicy::kBlock;
+  client_config.backend = backend;
+  client_config.overflow_policy = rtos::ipc::SendOverflowPolicy::kBlock;
+
+  std::atomic<uint64_t> received{0};
+  Transport server(server_config);
+  server.start([&received](const std::vector<uint8_t>&) {
+    received.fetch_add(1, std::memory_order_release);
+  });
+  Transport client(client_config);
+  client.start([](const std::vector<uint8_t>&) {});
+  while (server.connection_count() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::vector<uint8_t> payload(payload_bytes, 0);
+  int64_t cpu_before = cpu_ns();
+  auto begin = Clock::now();
+  for (size_t i = 0; i < messages; ++i) {
+    while (!client.publish(payload)) {
+      std::this_thread::yield();
+    }
+  }
+  while (received.load(std::memory_order_acquire) < messages) {
+    std::this_thread::yield();
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  int64_t cpu = cpu_ns() - cpu_before;
+  uint64_t receive_calls = server.connection_stats().front().receive_calls;
+
+  std::printf("%-9s %-8s active=%-8s bytes=%-8zu throughput=%9.0f msg/s "
+              "cpu=%8.0fns/msg recv=%.3f calls/msg\n",
+              name, backend_name(backend), backend_name(server.backend()),
+              payload_bytes, messages / seconds,
+              static_cast<double>(cpu) / messages,
+              static_cast<double>(receive_calls) / messages);
+
+  client.stop();
+  server.stop();
+}
+
+}  // namespace
+
+int main() {
+  using rtos::ipc::SocketBackend;
+  for (SocketBackend backend : {SocketBackend::kEpoll, SocketBackend::kIoUring}) {
+    run<rtos::ipc::TcpTransport>(
+        "tcp",
+        rtos::ipc::TcpTransportConfig{true, "127.0.0.1", kBenchPort, 1},
+        rtos::ipc::TcpTransportConfig{false, "127.0.0.1", kBenchPort, 1},
+        backend);
+    run<rtos::ipc::UnixTransport>(
+        "unix", rtos::ipc::UnixTransportConfig{true, kBenchPath, 1},
+        rtos::ipc::UnixTransportConfig{false, kBenchPath, 1}, backend);
+  }
+
+  // Packet boundaries instead of length prefixes, received in batches.
+  rtos::ipc::UnixTransportConfig server{true, kBenchPath, 1};
+  rtos::ipc::UnixTransportConfig client{false, kBenchPath, 1};
+  server.seqpacket = true;
+  client.seqpacket = true;
+  run<rtos::ipc::UnixTransport>("seqpacket", server, client,
+                                SocketBackend::kEpoll);
+
+  // Large payloads streamed through the socket against passed as a memfd,
+  // to pick fd_passing_threshold.
+  for (size_t bytes : {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024,
+                       4 * 1024 * 1024}) {
+    size_t messages = (256u * 1024 * 1024) / bytes;
+    rtos::ipc::UnixTransportConfig streamed_server{true, kBenchPath, 1};
+    rtos::ipc::UnixTransportConfig streamed_client{false, kBenchPath, 1};
+    streamed_server.max_queued_bytes = 16 * 1024 * 1024;
+    streamed_client.max_queued_bytes = 16 * 1024 * 1024;
+    run<rtos::ipc::UnixTransport>("streamed", streamed_server,
+                                  streamed_client, SocketBackend::kEpoll,
+                                  bytes, messages);
+    rtos::ipc::UnixTransportConfig passed_server = streamed_server;
+    rtos::ipc::UnixTransportConfig passed_client = streamed_client;
+    passed_server.fd_passing_threshold = 1;
+    passed_client.fd_passing_threshold = 1;
+    run<rtos::ipc::UnixTransport>("memfd", passed_server, passed_client,
+                                  SocketBackend::kEpoll, bytes, messages);
+  }
+  return 0;
+}
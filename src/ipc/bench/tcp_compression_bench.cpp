@@ -0,0 +1,131 @@
+#include "../include/ipc/lz_codec.h"
+#include "../include/ipc/tcp_transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kCodecBytes = 256 * 1024 * 1024;
+constexpr size_t kMessages = 20000;
+constexpr size_t kMessageBytes = 8192;
+constexpr uint16_t kBenchPort = 55761;
+
+std::vector<uint8_t> telemetry(size_t index, size_t size) {
+  std::string text;
+  while (text.size() < size) {
+    text += "{\"joint\":" + std::to_string(text.size() % 7) +
+            ",\"position\":" + std::to_string(index * 13 + text.size()) +
+            ",\"velocity\":0.0,\"status\":\"ok\"}\n";
+  }
+  text.resize(size);
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+std::vector<uint8_t> noise(size_t size) {
+  std::mt19937 random(1);
+  std::vector<uint8_t> bytes(size);
+  for (auto& byte : bytes) {
+    byte = static_cast<uint8_t>(random());
+  }
+  return bytes;
+}
+
+// Compresses and decompresses kCodecBytes worth of one payload.
+void codec(const char* name, const std::vector<uint8_t>& input) {
+  size_t rounds = kCodecBytes / input.size();
+  std::vector<uint8_t> compressed;
+  auto begin = Clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    compressed.clear();
+    rtos::ipc::lz_compress(input.data(), input.size(), &compressed);
+  }
+  double compress_s =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::vector<uint8_t> output;
+  begin = Clock::now();
+  for (size_t i = 0; i < rounds; ++i) {
+    rtos::ipc::lz_decompress(compressed.data(), compressed.size(),
+                             input.size(), &output);
+  }
+  double decompress_s =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  double mb = static_cast<double>(rounds * input.size()) / 1e6;
+  std::printf("%-10s %6zu B  ratio=%5.3f compress=%7.0f MB/s "
+              "decompress=%7.0f MB/s\n",
+              name, input.size(),
+              static_cast<double>(compressed.size()) / input.size(),
+              mb / compress_s, mb / decompress_s);
+}
+
+// A client streams kMessages telemetry payloads to a server over loopback.
+// Loopback is not bandwidth-bound, so the wire bytes show what a slow link
+// would save while the rate shows the CPU cost.
+void transport(bool compress) {
+  rtos::ipc::TcpTransportConfig server_config{true, "127.0.0.1", kBenchPort,
+                                              1};
+  server_config.compress = compress;
+  server_config.overflow_policy = rtos::ipc::SendOverflowPolicy::kBlock;
+  auto client_config = server_config;
+  client_config.is_server = false;
+
+  std::atomic<uint64_t> received{0};
+  rtos::ipc::TcpTransport server(server_config);
+  server.start([&received](const std::vector<uint8_t>&) {
+    received.fetch_add(1, std::memory_order_release);
+  });
+  rtos::ipc::TcpTransport client(client_config);
+  client.start([](const std::vector<uint8_t>&) {});
+  while (server.connection_count() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  std::vector<std::vector<uint8_t>> payloads;
+  for (size_t i = 0; i < 16; ++i) {
+    payloads.push_back(telemetry(i, kMessageBytes));
+  }
+  auto begin = Clock::now();
+  for (size_t i = 0; i < kMessages; ++i) {
+    while (!client.publish(payloads[i % payloads.size()])) {
+      std::this_thread::yield();
+    }
+  }
+  while (received.load(std::memory_order_acquire) < kMessages) {
+    std::this_thread::yield();
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  auto stats = client.compression_stats();
+  uint64_t wire = compress ? stats.output_bytes
+                           : static_cast<uint64_t>(kMessages) * kMessageBytes;
+  std::printf("tcp %-12s throughput=%7.0f msg/s payload=%7.1f MB "
+              "wire=%7.1f MB\n",
+              compress ? "compressed" : "raw", kMessages / seconds,
+              kMessages * kMessageBytes / 1e6, wire / 1e6);
+
+  client.stop();
+  server.stop();
+}
+
+}  // namespace
+
+int main() {
+  codec("telemetry", telemetry(0, 4096));
+  codec("telemetry", telemetry(0, 65536));
+  codec("random", noise(4096));
+  codec("random", noise(65536));
+  transport(false);
+  transport(true);
+  return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+// Changes between two versions of a payload. Runs of bytes that match the
+// base are skipped and the runs between them are copied, so a mostly
+// unchanged payload encodes to little more than its changed bytes. The
+// encoding is a varint target size followed by (varint skip, varint copy
+// length, copied bytes) groups; bytes after the last group come from the
+// base.
+void encode_delta(const std::vector<uint8_t>& base,
+                  const std::vector<uint8_t>& target,
+                  std::vector<uint8_t>* delta);
+
+// Rebuilds the target from |base|; false if the delta does not fit it.
+bool apply_delta(const std::vector<uint8_t>& base, const uint8_t* delta,
+                 size_t length, std::vector<uint8_t>* target);
+
+}  // namespace ipc
+}  // namespace rtos
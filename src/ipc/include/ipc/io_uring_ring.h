@@ -0,0 +1,81 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace rtos {
+namespace ipc {
+
+// Minimal io_uring driven through the raw syscalls (no liburing). Any thread
+// may prepare and submit entries while holding lock(); completions are reaped
+// by one thread only. A group of provided buffers can be registered for
+// multishot receives, which pick a buffer per completion.
+class IoUring {
+ public:
+  IoUring() = default;
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // False when the kernel has no io_uring or lacks one of |opcodes|.
+  bool init(unsigned entries, const uint8_t* opcodes, size_t opcode_count);
+  void destroy();
+  bool valid() const { return ring_fd_ >= 0; }
+
+  // Completions of the buffer bookkeeping entries carry this user_data.
+  static constexpr uint64_t kBufferUserData = 0;
+
+  bool register_buffers(uint16_t group, uint16_t count, uint32_t size);
+  uint16_t buffer_group() const { return buffer_group_; }
+  uint32_t buffer_size() const { return buffer_size_; }
+  const uint8_t* buffer(uint16_t id) const;
+  // Queues a consumed buffer's return to the kernel with the next submit.
+  void recycle_buffer(uint16_t id);
+
+  std::mutex& lock() { return mutex_; }
+  // Returns a zeroed entry, submitting queued ones first if the ring is full.
+  // Requires lock().
+  io_uring_sqe* get_sqe();
+  // Submits prepared entries and optionally waits for one completion.
+  int submit(bool wait);
+
+  io_uring_cqe* peek_cqe();
+  void cqe_seen();
+
+ private:
+  unsigned publish_locked();
+
+  std::mutex mutex_;
+  int ring_fd_ = -1;
+  unsigned local_tail_ = 0;
+
+  void* sq_map_ = nullptr;
+  size_t sq_map_bytes_ = 0;
+  void* cq_map_ = nullptr;
+  size_t cq_map_bytes_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_bytes_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  uint8_t* buffers_ = nullptr;
+  size_t buffers_bytes_ = 0;
+  uint16_t buffer_group_ = 0;
+  uint16_t buffer_count_ = 0;
+  uint32_t buffer_size_ = 0;
+};
+
+}  // namespace ipc
+}  // namespace rtos
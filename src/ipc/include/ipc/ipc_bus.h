@@ -18,13 +18,46 @@
 namespace rtos {
 namespace ipc {
 
+class IpcRuntime;
+
 using IpcHandler = std::function<void(const IpcMessage&)>;
+// Receives the published object itself; it may be kept past the call.
+using IpcSharedHandler =
+    std::function<void(const std::shared_ptr<const IpcMessage>&)>;
 
 class IpcBus {
  public:
   struct Options {
     size_t retry_count;
     std::chrono::milliseconds retry_interval;
+    // Hand messages to in-process transports without serializing them.
+    bool in_process_fast_path = true;
+    // Retry timers and, if it has dispatch threads, subscriber handlers run
+    // on this shared runtime, which must be running and outlive the bus.
+    // Without one the bus starts its own timer thread the first time it
+    // needs one.
+    IpcRuntime* runtime = nullptr;
+    // Tell publishers on the transport how often this bus's subscribers
+    // want each topic, and, when publishing, decimate topics whose every
+    // announced subscriber is rate limited. Announcements are repeated every
+    // rate_refresh and forgotten after three missed refreshes. Every bus on
+    // the transport must enable this, since a bus that announces nothing
+    // looks like no subscriber at all.
+    bool announce_rates = false;
+    std::chrono::milliseconds rate_refresh{1000};
+    // Topics whose payloads are sent as the bytes that changed since this
+    // bus's previous message on the topic, with a full keyframe every
+    // delta_keyframe_interval messages. Receivers rebuild the payload before
+    // dispatch and skip deltas until a keyframe after a lost message. Every
+    // bus on the transport must list the same topics. In-process fast-path
+    // messages are never encoded.
+    std::vector<std::string> delta_topics;
+    size_t delta_keyframe_interval = 100;
+    // Receivers forget a sending bus's delta state once it has been silent
+    // for delta_idle_timeout, and the least recently heard sender's when a
+    // new one would exceed max_delta_senders. Zero disables either limit.
+    std::chrono::milliseconds delta_idle_timeout{60000};
+    size_t max_delta_senders = 1024;
 
     Options(size_t retries = 3,
             std::chrono::milliseconds interval =
@@ -32,49 +65,159 @@ class IpcBus {
         : retry_count(retries), retry_interval(interval) {}
   };
 
+  // Best-effort messages reach the subscriber at most once per
+  // min_interval; 0 delivers every message. Messages inside the interval are
+  // dropped, or with keep_latest the newest of them is delivered when the
+  // interval ends. At-least-once messages are never held back.
+  struct SubscribeOptions {
+    std::chrono::milliseconds min_interval;
+    bool keep_latest;
+
+    SubscribeOptions(std::chrono::milliseconds interval =
+                         std::chrono::milliseconds(0),
+                     bool latest = false)
+        : min_interval(interval), keep_latest(latest) {}
+  };
+
   IpcBus();
   IpcBus(std::unique_ptr<IpcTransport> transport,
          std::unique_ptr<IpcSerializer> serializer,
          Options options = Options{});
   ~IpcBus();
 
-  uint64_t subscribe(const std::string& topic, IpcHandler handler);
+  // A rate limit also holds back this bus's own publishes on the topic when
+  // the publisher can see every subscriber: always over an in-process
+  // transport, and with announce_rates otherwise.
+  uint64_t subscribe(const std::string& topic, IpcHandler handler,
+                     SubscribeOptions options = SubscribeOptions{});
+  uint64_t subscribe_shared(const std::string& topic,
+                            IpcSharedHandler handler,
+                            SubscribeOptions options = SubscribeOptions{});
   void unsubscribe(uint64_t subscription_id);
   void publish(IpcMessage message);
 
   size_t subscriber_count(const std::string& topic) const;
 
  private:
-  void dispatch(IpcMessage message);
-  void send_ack(uint64_t sequence);
-  void handle_ack(uint64_t sequence);
-  void retry_loop();
+  using Clock = std::chrono::steady_clock;
+
+  // Decimation state of one subscriber, or of one topic at the publisher.
+  // Intervals are measured between message timestamps.
+  struct RateGate {
+    Clock::time_point last;
+    std::shared_ptr<const IpcMessage> held;
+    Clock::time_point flush_due;
+  };
 
   struct Subscription {
     std::string topic;
     IpcHandler handler;
+    IpcSharedHandler shared_handler;
+    SubscribeOptions rate;
+    RateGate gate;
+  };
+
+  // A handler picked for one delivery.
+  struct Target {
+    IpcHandler handler;
+    IpcSharedHandler shared_handler;
   };
 
   struct PendingMessage {
-    IpcMessage message;
+    std::shared_ptr<const IpcMessage> message;
     size_t retries_left = 0;
-    std::chrono::steady_clock::time_point next_due;
+    Clock::time_point next_due;
+  };
+
+  // What another bus announced for a topic.
+  struct RemoteRate {
+    SubscribeOptions rate;
+    Clock::time_point expires;
+  };
+
+  // Delta state of one topic at the sender, and of one sending bus on a
+  // topic at the receiver.
+  struct DeltaSender {
+    std::vector<uint8_t> last;
+    uint32_t frame = 0;
+    size_t since_keyframe = 0;
+  };
+
+  struct DeltaReceiver {
+    std::vector<uint8_t> last;
+    uint32_t frame = 0;
+    bool synced = false;
+    Clock::time_point last_seen;
   };
 
+  uint64_t add_subscription(const std::string& topic, IpcHandler handler,
+                            IpcSharedHandler shared_handler,
+                            SubscribeOptions options);
+  size_t count_locked(const std::string& topic) const;
+  static bool admit(RateGate* gate, const SubscribeOptions& rate,
+                    const std::shared_ptr<const IpcMessage>& message,
+                    Clock::duration slack);
+  bool publish_rate_locked(const std::string& topic, Clock::time_point now,
+                           SubscribeOptions* rate) const;
+  bool local_rate_locked(const std::string& topic,
+                         SubscribeOptions* rate) const;
+  void send(const std::shared_ptr<const IpcMessage>& message);
+  bool is_delta_topic(const std::string& topic) const;
+  void encode_delta_locked(const IpcMessage& message, IpcMessage* encoded);
+  bool decode_delta(IpcMessage* message);
+  void expire_delta_receivers_locked(Clock::time_point now);
+  void evict_oldest_delta_receiver_locked();
+  void dispatch(const std::shared_ptr<const IpcMessage>& message);
+  void deliver(std::vector<Target> targets,
+               const std::shared_ptr<const IpcMessage>& message);
+  void send_ack(uint64_t sequence);
+  void handle_ack(uint64_t sequence);
+  void announce_rate(const std::string& topic);
+  void handle_rate(const IpcMessage& message);
+
+  void arm_timer(Clock::time_point due);
+  void on_timer();
+  void timer_loop();
+  Clock::time_point service_timers();
+  Clock::time_point service_retries();
+  Clock::time_point service_rates(Clock::time_point now);
+
   mutable std::mutex mutex_;
+  // Orders subscribe_topic/unsubscribe_topic calls, which run outside mutex_.
+  std::mutex topic_mutex_;
   std::atomic<uint64_t> next_sequence_{1};
   uint64_t next_id_;
   std::unordered_map<uint64_t, Subscription> subscriptions_;
+  std::unordered_map<std::string, RateGate> gates_;
+  std::unordered_map<std::string, std::unordered_map<uint64_t, RemoteRate>>
+      remote_rates_;
+  // Rate-limited local subscriptions plus remote announcements of a limit;
+  // while zero, publish and dispatch skip decimation entirely.
+  std::atomic<size_t> rate_limits_{0};
+  Clock::time_point next_announce_;
+  uint64_t bus_id_ = 0;
 
   std::unique_ptr<IpcTransport> transport_;
   std::unique_ptr<IpcSerializer> serializer_;
   Options options_;
+  bool fast_path_ = false;
+  bool in_process_ = false;
   std::mutex send_mutex_;
+  std::unordered_map<std::string, DeltaSender> delta_senders_;
+  std::mutex delta_mutex_;
+  std::unordered_map<std::string, std::unordered_map<uint64_t, DeltaReceiver>>
+      delta_receivers_;
+  size_t delta_receiver_count_ = 0;
+  Clock::time_point next_delta_sweep_;
 
   std::mutex pending_mutex_;
-  std::condition_variable pending_cv_;
   std::unordered_map<uint64_t, PendingMessage> pending_;
-  std::thread retry_thread_;
+
+  // Earliest armed wake-up, for the runtime's timer or the bus's own thread.
+  std::mutex timer_mutex_;
+  std::condition_variable timer_cv_;
+  Clock::time_point timer_due_ = Clock::time_point::max();
+  std::thread timer_thread_;
   std::atomic<bool> running_{false};
 };
 
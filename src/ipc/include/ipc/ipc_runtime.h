@@ -0,0 +1,100 @@
+#pragma once
+
+#include "ipc_reactor.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+struct IpcRuntimeConfig {
+  // Reactors that socket and shm transports register with.
+  size_t io_threads = 1;
+  // Threads that run bus subscriber handlers. With 0, handlers run inline on
+  // the thread that received the message.
+  size_t dispatch_threads = 0;
+};
+
+// Threads shared by every bus and transport in a process: one timer thread,
+// a small pool of I/O reactors, and dispatch executors. Buses and
+// transports that are given a runtime start no threads of their own.
+//
+// Timers and dispatch tasks belong to an owner, usually the object that
+// scheduled them. An owner's tasks run on one executor in the order they
+// were posted, and cancel() drops whatever the owner still has queued.
+class IpcRuntime {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Task = std::function<void()>;
+
+  explicit IpcRuntime(IpcRuntimeConfig config = IpcRuntimeConfig{});
+  ~IpcRuntime();
+
+  IpcRuntime(const IpcRuntime&) = delete;
+  IpcRuntime& operator=(const IpcRuntime&) = delete;
+
+  void start();
+  void stop();
+  bool running() const;
+
+  // Tasks run on the timer thread and should be short. Scheduled or posted
+  // tasks wait for start() if the runtime is not running.
+  void schedule(const void* owner, Clock::time_point due, Task task);
+  // Runs on the owner's executor, or inline without dispatch threads.
+  void post(const void* owner, Task task);
+  // Drops the owner's timers and queued tasks, then waits for one of its
+  // tasks that is already running, unless called from that task.
+  void cancel(const void* owner);
+
+  // Reactors are handed out round-robin and outlive every transport that
+  // uses them as long as the runtime does.
+  IpcReactor* io_reactor();
+
+  size_t io_thread_count() const { return reactors_.size(); }
+  size_t dispatch_thread_count() const { return executors_.size(); }
+
+ private:
+  struct Timer {
+    const void* owner = nullptr;
+    Task task;
+  };
+
+  struct Executor {
+    std::deque<std::pair<const void*, Task>> tasks;
+    std::condition_variable cv;
+    std::thread thread;
+    const void* running_owner = nullptr;
+  };
+
+  void run_timers();
+  void run_executor(Executor* executor);
+  Executor* executor_for(const void* owner);
+  bool running_locked(const void* owner) const;
+
+  IpcRuntimeConfig config_;
+  std::vector<std::unique_ptr<IpcReactor>> reactors_;
+  size_t next_reactor_ = 0;
+
+  mutable std::mutex mutex_;
+  std::condition_variable timer_cv_;
+  std::condition_variable idle_cv_;
+  bool running_ = false;
+  std::multimap<Clock::time_point, Timer> timers_;
+  std::thread timer_thread_;
+  const void* timer_owner_ = nullptr;
+  std::vector<std::unique_ptr<Executor>> executors_;
+};
+
+}  // namespace ipc
+}  // namespace rtos
@@ -1,13 +1,19 @@
 #pragma once
 
+#include "ipc_message.h"
+
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace rtos {
 namespace ipc {
 
 using TransportReceiveHandler = std::function<void(const std::vector<uint8_t>&)>;
+using TransportMessageHandler =
+    std::function<void(const std::shared_ptr<const IpcMessage>&)>;
 
 class IpcTransport {
  public:
@@ -16,6 +22,28 @@ class IpcTransport {
   virtual void start(TransportReceiveHandler handler) = 0;
   virtual void stop() = 0;
   virtual bool publish(const std::vector<uint8_t>& bytes) = 0;
+
+  // Topic hints for transports that route by topic. IpcBus reports the first
+  // subscription to a topic and the removal of the last one.
+  virtual bool publish_topic(const std::string& topic,
+                             const std::vector<uint8_t>& bytes) {
+    (void)topic;
+    return publish(bytes);
+  }
+  virtual void subscribe_topic(const std::string& topic) { (void)topic; }
+  virtual void unsubscribe_topic(const std::string& topic) { (void)topic; }
+
+  // In-process transports can carry messages as shared immutable objects,
+  // skipping serialization. Receivers get the publisher's object itself.
+  virtual bool supports_messages() const { return false; }
+  virtual void set_message_handler(TransportMessageHandler handler) {
+    (void)handler;
+  }
+  virtual bool publish_message(
+      const std::shared_ptr<const IpcMessage>& message) {
+    (void)message;
+    return false;
+  }
 };
 
 }  // namespace ipc
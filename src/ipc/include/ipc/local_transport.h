@@ -13,9 +13,15 @@ class LocalTransport final : public IpcTransport {
   void stop() override;
   bool publish(const std::vector<uint8_t>& bytes) override;
 
+  bool supports_messages() const override { return true; }
+  void set_message_handler(TransportMessageHandler handler) override;
+  bool publish_message(
+      const std::shared_ptr<const IpcMessage>& message) override;
+
  private:
   std::mutex mutex_;
   TransportReceiveHandler handler_;
+  TransportMessageHandler message_handler_;
 };
 
 }  // namespace ipc
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+// A small LZ77 block codec in the LZ4 style: byte-aligned sequences of
+// literals followed by a back-reference of at least four bytes within the
+// previous 64 KB. It trades ratio for speed, which suits telemetry that is
+// compressed on every publish. The match table is a thread-local scratch
+// buffer, so neither call allocates beyond growing |output|.
+
+// Appends the compressed form of |input| to |output|.
+void lz_compress(const uint8_t* input, size_t length,
+                 std::vector<uint8_t>* output);
+
+// Replaces |output| with the |original_length| bytes that |input| encodes;
+// false if |input| is malformed or does not decode to exactly that length.
+bool lz_decompress(const uint8_t* input, size_t length,
+                   size_t original_length, std::vector<uint8_t>* output);
+
+}  // namespace ipc
+}  // namespace rtos
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "shm_ring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace rtos {
+namespace ipc {
+
+// Small shared memory segment mapping channel keys (a topic or a topic group)
+// to the index of the segment carrying them. Entries are only ever added, and
+// the process adding one creates the channel segment before the entry becomes
+// visible, so a found entry always names a ready segment. The directory lock
+// only covers claiming an entry; the segment is created after it is released
+// while other processes wanting the same key wait for the entry to be ready.
+// Both the lock and a pending entry are taken over from a process that died
+// holding them.
+class ShmDirectory {
+ public:
+  static constexpr size_t kMaxKeyLength = 111;
+
+  static size_t segment_size(size_t max_channels);
+
+  bool create(void* memory, size_t segment_bytes, size_t max_channels);
+  bool attach(void* memory, size_t segment_bytes);
+  void detach();
+  bool valid() const { return header_ != nullptr; }
+
+  size_t max_channels() const;
+  int find(const std::string& key) const;
+  // Returns the entry for |key|, adding it if needed. |create_channel| runs
+  // for a new entry outside the directory lock; the entry is freed again if
+  // it fails.
+  int find_or_add(const std::string& key,
+                  const std::function<bool(size_t index)>& create_channel);
+  bool ready(size_t index) const;
+
+ private:
+  struct Header;
+  struct Entry;
+
+  int match(const std::string& key, bool pending) const;
+  int claim(const std::string& key, int32_t pid);
+  void lock();
+  void unlock();
+
+  Header* header_ = nullptr;
+  Entry* entries_ = nullptr;
+};
+
+}  // namespace ipc
+}  // namespace rtos
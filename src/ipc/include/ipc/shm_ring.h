@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+constexpr size_t kShmCacheLine = 64;
+
+inline void shm_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// |align| must be a power of two.
+inline size_t shm_align_up(size_t value, size_t align) {
+  return (value + (align - 1)) & ~(align - 1);
+}
+
+// Whether the process that stored |pid| in a shared slot may still be
+// running. Non-positive pids (no owner recorded) count as alive.
+bool shm_process_alive(int32_t pid);
+
+struct ShmFrameView {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  int64_t timestamp_ns = 0;
+};
+
+// Futex word consumers sleep on. A ring rings its own doorbell by default;
+// rings that share a reader (sub-rings of one segment) can share one.
+// A reader arm()s the doorbell, rechecks its rings and then sleeps on the
+// returned sequence. notify() only enters the kernel when the sleepers flag
+// is up and clears it while it wakes, so each sleep costs at most one wake
+// however many frames are published meanwhile. ring() always wakes.
+struct alignas(kShmCacheLine) ShmDoorbell {
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint32_t> sleepers{0};
+
+  uint32_t arm();
+  void notify();
+  void ring();
+  void sleep(uint32_t observed, std::chrono::microseconds timeout);
+};
+
+// Sleeps until any of |count| doorbells moves off the sequence in |observed|
+// or |timeout| passes, in one futex_waitv(). Returns false without sleeping
+// when the kernel has no futex_waitv (before 5.16) or |count| is above its
+// limit of 128, so the caller can fall back to polling.
+bool shm_sleep_any(ShmDoorbell* const* doorbells, const uint32_t* observed,
+                   size_t count, std::chrono::microseconds timeout);
+
+// What the producer does with a consumer that falls further behind than the
+// lag limit: keep waiting for it, drop it from the ring, or overwrite the
+// frames it has not read yet and let it resync with a lost-message count.
+// An evicted ShmRing reader stays out until it calls rejoin_consumer().
+// ShmSegment (and so ShmTransport) readers rejoin at the head on their next
+// peek, so there kEvict silently skips to the newest frame; the caller only
+// sees it in ShmConsumerStats (evictions, and lost_messages once it reads).
+enum class ShmLagPolicy : uint8_t { kBlock = 0, kEvict = 1, kOverwrite = 2 };
+
+struct ShmRingPolicy {
+  ShmLagPolicy lag_policy = ShmLagPolicy::kBlock;
+  uint64_t lag_limit_bytes = 0;  // 0 means the ring capacity.
+  std::chrono::milliseconds heartbeat_timeout{0};  // 0 disables heartbeats.
+  bool reap_dead_consumers = true;
+};
+
+struct ShmConsumerStats {
+  uint64_t lost_messages = 0;
+  uint64_t evictions = 0;
+};
+
+// Lock-free single-producer/multi-consumer byte ring living in a shared
+// memory segment. Cursors are monotonically increasing 64-bit positions, each
+// on its own cache line. Frames never straddle the end of the data area, so
+// consumers can view them in place until they call consume(). Consumer slots
+// are tracked in a bitmap sized at creation; readers either register a fixed
+// id or claim a free one.
+class ShmRing {
+ public:
+  static size_t segment_size(size_t capacity, size_t max_consumers);
+
+  bool create(void* memory, size_t segment_bytes, size_t max_consumers,
+              const ShmRingPolicy& policy = ShmRingPolicy{});
+  bool attach(void* memory, size_t segment_bytes);
+  void detach();
+  bool valid() const { return header_ != nullptr; }
+  void set_doorbell(ShmDoorbell* doorbell);
+
+  size_t capacity() const;
+  size_t max_consumers() const;
+
+  bool write(const uint8_t* data, size_t length);
+
+  bool add_consumer(size_t consumer_id);
+  bool claim_consumer(size_t* consumer_id);
+  bool rejoin_consumer(size_t consumer_id);
+  void remove_consumer(size_t consumer_id);
+  bool evicted(size_t consumer_id) const;
+  ShmConsumerStats consumer_stats(size_t consumer_id) const;
+
+  // A view stays valid until consume(). Under kOverwrite the producer may
+  // reclaim a slow reader's frame, in which case consume() returns false and
+  // anything copied out of the view must be discarded.
+  bool peek(size_t consumer_id, ShmFrameView* view);
+  bool consume(size_t consumer_id);
+  bool read(size_t consumer_id, std::vector<uint8_t>* bytes);
+
+  bool readable(size_t consumer_id) const;
+  void touch_consumer(size_t consumer_id);
+  bool wait(size_t consumer_id, std::chrono::microseconds timeout);
+  void notify_all();
+
+ private:
+  struct Header;
+  struct Cursor;
+
+  static size_t bitmap_offset();
+  static size_t cursors_offset(size_t max_consumers);
+  static size_t header_bytes(size_t max_consumers);
+
+  Cursor* cursor(size_t consumer_id) const;
+  void activate(Cursor* slot);
+  uint64_t admit(uint64_t head, uint64_t next_head);
+  bool consumer_alive(const Cursor& slot, int64_t now) const;
+  void reclaim(uint64_t target);
+  void lock_writer();
+  void unlock_writer();
+
+  Header* header_ = nullptr;
+  std::atomic<uint64_t>* bitmap_ = nullptr;
+  Cursor* cursors_ = nullptr;
+  uint8_t* data_ = nullptr;
+  uint64_t mask_ = 0;
+  ShmDoorbell* doorbell_ = nullptr;
+  uint32_t writer_pid_ = 0;
+};
+
+}  // namespace ipc
+}  // namespace rtos
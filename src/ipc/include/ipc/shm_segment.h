@@ -0,0 +1,77 @@
+#pragma once
+
+#include "shm_ring.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+enum class ShmMergeOrder : uint8_t { kRoundRobin = 0, kTimestamp = 1 };
+
+// A shared memory segment holding one ShmRing per producer. Producers claim a
+// sub-ring the first time they write, so concurrent publishers never share a
+// head cache line. Once every sub-ring has a live owner, further producers
+// share one (see shares_producer_ring()); the ring's writer lock keeps that
+// correct, but those producers contend on it. Consumers register in every
+// sub-ring up front and merge the streams, round-robin or by publish
+// timestamp. Timestamp order is best effort: a frame stamped earlier can
+// still be published later. The first sub-ring's consumer bitmap is the
+// registry claimed ids come from.
+class ShmSegment {
+ public:
+  static size_t segment_size(size_t ring_capacity, size_t max_producers,
+                             size_t max_consumers);
+
+  bool create(void* memory, size_t segment_bytes, size_t ring_capacity,
+              size_t max_producers, size_t max_consumers,
+              const ShmRingPolicy& policy = ShmRingPolicy{});
+  bool attach(void* memory, size_t segment_bytes);
+  void detach();
+  bool valid() const { return header_ != nullptr; }
+
+  size_t max_producers() const { return rings_.size(); }
+  ShmDoorbell* doorbell() const { return doorbell_; }
+
+  // Thread-safe; every thread writing through this object uses one claim.
+  bool claim_producer();
+  void release_producer();
+  bool shares_producer_ring() const;
+  bool write(const uint8_t* data, size_t length);
+
+  bool add_consumer(size_t consumer_id);
+  bool claim_consumer(size_t* consumer_id);
+  void remove_consumer(size_t consumer_id);
+  ShmConsumerStats consumer_stats(size_t consumer_id) const;
+
+  bool peek(size_t consumer_id, ShmMergeOrder order, ShmFrameView* view);
+  bool consume(size_t consumer_id);
+  bool readable(size_t consumer_id);
+  bool spin(size_t consumer_id, std::chrono::microseconds budget);
+  bool wait(size_t consumer_id, std::chrono::microseconds timeout);
+  void notify_all();
+
+ private:
+  struct Header;
+  struct ProducerSlot;
+
+  static size_t header_bytes(size_t max_producers);
+  static size_t ring_stride(size_t ring_capacity, size_t max_consumers);
+
+  Header* header_ = nullptr;
+  ProducerSlot* producers_ = nullptr;
+  ShmDoorbell* doorbell_ = nullptr;
+  std::vector<ShmRing> rings_;
+  mutable std::mutex producer_mutex_;
+  std::atomic<int> producer_ring_{-1};
+  bool owns_producer_slot_ = false;
+  size_t next_ring_ = 0;
+  size_t current_ring_ = 0;
+};
+
+}  // namespace ipc
+}  // namespace rtos
@@ -1,23 +1,79 @@
 #pragma once
 
 #include "ipc_transport.h"
+#include "shm_directory.h"
+#include "shm_segment.h"
 
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace rtos {
 namespace ipc {
 
+class IpcReactor;
+
+enum class ShmRingKind : uint8_t { kMutex = 0, kLockFree = 1 };
+
+// How an idle lock-free receiver waits for the next frame: sleep on the
+// futex right away, poll the heads for spin_budget first, or never sleep
+// (for receivers pinned to an isolated core).
+enum class ShmReceiveMode : uint8_t {
+  kBlock = 0,
+  kSpinThenBlock = 1,
+  kBusyPoll = 2
+};
+
+// Topics sharing one channel. Topics outside every group get a channel each;
+// all processes on a directory must agree on the grouping.
+struct ShmChannelGroup {
+  std::string name;
+  std::vector<std::string> topics;
+  size_t size_bytes = 0;  // 0 uses ShmTransportConfig::size_bytes.
+};
+
+// Registers the receiver in the first free consumer slot of the segment.
+constexpr size_t kShmAutoConsumerId = SIZE_MAX;
+
 struct ShmTransportConfig {
   std::string name = "/rtos_ipc_shm";
   size_t size_bytes = 1 << 20;
   bool is_owner = false;
-  size_t consumer_id = 0;
-  size_t max_consumers = 4;
+  size_t consumer_id = kShmAutoConsumerId;
+  size_t max_consumers = 64;  // Fixed by the owner; the mutex ring caps at 8.
+  ShmRingKind ring = ShmRingKind::kLockFree;
+  ShmLagPolicy lag_policy = ShmLagPolicy::kBlock;
+  size_t lag_limit_bytes = 0;
+  std::chrono::milliseconds heartbeat_timeout{0};
+  bool reap_dead_consumers = true;
+  size_t max_producers = 1;
+  ShmMergeOrder merge_order = ShmMergeOrder::kRoundRobin;
+  bool receive = true;
+  ShmReceiveMode receive_mode = ShmReceiveMode::kBlock;
+  std::chrono::microseconds spin_budget{50};
+  std::string hugetlbfs_path;  // e.g. "/dev/hugepages"; empty uses shm_open.
+  bool huge_pages = false;     // Transparent huge page advice for /dev/shm.
+  bool lock_memory = false;
+  bool prefault = false;
+  // Binds the segments' pages to this node with mbind(). A page is placed
+  // when it is first touched, so only the binding of the process that
+  // faults it in counts: set it on the owner together with prefault.
+  int numa_node = -1;
+  // Carries each topic (or group) on its own lock-free segment, found through
+  // a directory segment at |name|. Readers only attach to subscribed topics.
+  bool per_topic_channels = false;
+  std::vector<ShmChannelGroup> channel_groups;
+  size_t max_channels = 64;
+  // Serve this transport from a shared reactor thread instead of a receiver
+  // thread of its own. The reactor must outlive the transport.
+  IpcReactor* reactor = nullptr;
 };
 
 class ShmTransport final : public IpcTransport {
@@ -28,8 +84,37 @@ class ShmTransport final : public IpcTransport {
   void start(TransportReceiveHandler handler) override;
   void stop() override;
   bool publish(const std::vector<uint8_t>& bytes) override;
+  bool publish_topic(const std::string& topic,
+                     const std::vector<uint8_t>& bytes) override;
+  void subscribe_topic(const std::string& topic) override;
+  void unsubscribe_topic(const std::string& topic) override;
+
+  // Reactor interface: deliver up to |budget| frames, report whether frames
+  // are waiting, and append the doorbells to sleep on before readable().
+  size_t poll(size_t budget);
+  bool readable();
+  void doorbells(std::vector<ShmDoorbell*>* out);
+
+  size_t channel_count() const;
+  size_t consumer_id() const { return consumer_id_; }
+  ShmConsumerStats consumer_stats() const;
+  bool memory_locked() const { return memory_locked_; }
+  // Whether every segment mapped so far was bound to numa_node.
+  bool numa_bound() const { return numa_bound_.load(); }
 
  private:
+  struct Channel;
+
+  void start_channels();
+  void stop_channels();
+  Channel* channel(const std::string& topic);
+  void refresh_channels();
+  bool channels_ready();
+  bool spin_channels(std::chrono::microseconds budget);
+  void wait_channels();
+
+  void start_receiver();
+  void wait_for_frames();
   void receive_loop();
   bool write_frame(const std::vector<uint8_t>& bytes);
   bool read_frame(std::vector<uint8_t>* bytes);
@@ -38,10 +123,28 @@ class ShmTransport final : public IpcTransport {
   std::atomic<bool> running_{false};
   TransportReceiveHandler handler_;
   std::thread receiver_thread_;
+  bool in_reactor_ = false;
+  std::vector<uint8_t> frame_;
 
   int shm_fd_ = -1;
   void* shm_ptr_ = nullptr;
+  size_t shm_size_ = 0;
+  bool memory_locked_ = false;
+  std::atomic<bool> numa_bound_{false};
   size_t consumer_id_ = 0;
+  ShmSegment segment_;
+
+  ShmDirectory directory_;
+  mutable std::mutex channels_mutex_;
+  std::unordered_map<std::string, std::unique_ptr<Channel>> channels_;
+  std::unordered_map<std::string, Channel*> topic_channels_;
+  std::atomic<uint64_t> channels_version_{0};
+  std::vector<Channel*> active_channels_;
+  uint64_t active_version_ = UINT64_MAX;
+  // Rung locally when the set of channels to read changes or on stop().
+  ShmDoorbell wake_;
+  std::vector<ShmDoorbell*> wait_doorbells_;
+  std::vector<uint32_t> wait_seqs_;
 };
 
 }  // namespace ipc
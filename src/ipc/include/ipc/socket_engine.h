@@ -0,0 +1,190 @@
+#pragma once
+
+#include "ipc_transport.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+// What publish() does when a connection's send queue is full: drop the new
+// frame for that peer, disconnect the peer, or wait up to block_timeout for
+// the queue to drain and drop the frame if it does not.
+enum class SendOverflowPolicy : uint8_t {
+  kDrop = 0,
+  kDisconnect = 1,
+  kBlock = 2,
+};
+
+enum class SocketBackend : uint8_t { kEpoll = 0, kIoUring = 1 };
+
+class IpcReactor;
+
+struct SocketEngineConfig {
+  SocketBackend backend = SocketBackend::kEpoll;
+  size_t io_threads = 1;
+  size_t max_connections = 8;
+  size_t max_frame_bytes = 64 * 1024 * 1024;
+  size_t max_queued_bytes = 4 * 1024 * 1024;
+  SendOverflowPolicy overflow_policy = SendOverflowPolicy::kDrop;
+  std::chrono::milliseconds block_timeout{10};
+
+  // Socket tuning applied to every connection; 0 keeps the kernel default.
+  int send_buffer_bytes = 0;
+  int receive_buffer_bytes = 0;
+  bool tcp_nodelay = false;
+  // TCP clears quick-ack after every ACK, so it is re-armed after each read.
+  bool tcp_quickack = false;
+  // Frames at least this large are sent with MSG_ZEROCOPY; 0 disables it.
+  // Applies to the epoll backend.
+  size_t zerocopy_threshold = 0;
+  // Unix sockets only: payloads at least this large are written to a sealed
+  // memfd whose descriptor is passed with SCM_RIGHTS; 0 disables it. Both
+  // ends need the epoll backend. Streaming is cheaper for small payloads;
+  // socket_engine_bench shows where passing starts to pay off.
+  size_t fd_passing_threshold = 0;
+  // SOCK_SEQPACKET connections: every packet is one message, with no length
+  // prefix, and packets move in batches through sendmmsg() and recvmmsg().
+  // Larger messages are refused unless they are passed as a memfd. Always
+  // runs on the epoll backend.
+  bool seqpacket = false;
+  size_t max_packet_bytes = 64 * 1024;
+  // Serve every connection from this shared reactor instead of I/O threads
+  // of the engine's own. Runs on the epoll backend, and the reactor must
+  // outlive the engine.
+  IpcReactor* reactor = nullptr;
+};
+
+struct ConnectionStats {
+  uint64_t id = 0;
+  size_t queued_frames = 0;
+  size_t queued_bytes = 0;
+  size_t peak_queued_bytes = 0;
+  uint64_t sent_frames = 0;
+  uint64_t dropped_frames = 0;
+  uint64_t send_calls = 0;
+  uint64_t zerocopy_sends = 0;
+  // Zerocopy sends the kernel completed by copying (always so on loopback).
+  uint64_t zerocopy_copied = 0;
+  // Frames whose payload was passed as a memfd instead of streamed.
+  uint64_t passed_frames = 0;
+  // Receive system calls made for this connection, and frames they delivered
+  // (the epoll backend counts calls; io_uring receives make none).
+  uint64_t receive_calls = 0;
+  uint64_t received_frames = 0;
+  // Age of the oldest frame still queued, and the longest any frame waited.
+  std::chrono::nanoseconds lag{0};
+  std::chrono::nanoseconds max_lag{0};
+};
+
+// Event loop for the stream transports. Frames carry a 4-byte big-endian
+// length prefix. A few I/O threads each run an epoll loop over their share of
+// the connections; the first one also accepts. Reads are non-blocking into a
+// per-connection buffer that is parsed incrementally and reused. publish()
+// writes what each socket takes right away and leaves the rest to the
+// connection's I/O thread, which finishes the write once the socket drains.
+// A frame is encoded once and shared by every connection's queue, and queued
+// frames go out together in one sendmsg(). Each connection queues at most
+// max_queued_bytes, so a slow peer only ever affects itself. The receive
+// handler runs on the I/O threads. Over Unix sockets, large payloads can
+// skip the stream: the receiver reads the passed, sealed memfd into its frame
+// buffer in one copy.
+//
+// With SocketBackend::kIoUring each I/O thread drives an io_uring instead:
+// multishot accept, multishot receive into a group of provided buffers, and
+// sends prepared by publish() and submitted in one batch per publish. When the
+// kernel lacks the needed io_uring features the engine falls back to epoll.
+//
+// Given a reactor, the engine starts no threads: a single worker's epoll set
+// is registered with the reactor, which drains it whenever it is ready.
+class SocketEngine {
+ public:
+  explicit SocketEngine(SocketEngineConfig config);
+  ~SocketEngine();
+
+  SocketEngine(const SocketEngine&) = delete;
+  SocketEngine& operator=(const SocketEngine&) = delete;
+
+  // Takes ownership of |listen_fd|, which may be -1 when the engine only
+  // carries connections added by the caller.
+  bool start(TransportReceiveHandler handler, int listen_fd);
+  // Not to be called from the receive handler when running on a reactor.
+  void stop();
+  bool running() const { return running_.load(); }
+  // The backend in use, which is kEpoll after an io_uring fallback.
+  SocketBackend backend() const { return backend_; }
+
+  // Takes ownership of a connected socket.
+  bool add_connection(int fd);
+  bool publish(const std::vector<uint8_t>& bytes);
+
+  size_t connection_count() const;
+  std::vector<ConnectionStats> connection_stats() const;
+  // Peers disconnected by SendOverflowPolicy::kDisconnect.
+  uint64_t overflow_disconnects() const { return overflow_disconnects_.load(); }
+  size_t io_thread_count() const { return workers_.size(); }
+
+ private:
+  struct Connection;
+  struct PassedFd;
+  struct Worker;
+
+  bool start_workers(size_t count, bool uring);
+  bool attach(int fd);
+  void configure_socket(int fd, bool listening);
+  void run(Worker* worker);
+  bool poll_events(Worker* worker, int timeout_ms);
+  void run_uring(Worker* worker);
+  void accept_connections();
+  void read_connection(Connection* connection);
+  void read_packets(Worker* worker, Connection* connection);
+  bool append_inbound(Connection* connection, const uint8_t* data,
+                      size_t length);
+  bool parse_frames(Connection* connection);
+  void write_connection(Connection* connection);
+  void reap_zerocopy(Connection* connection);
+  bool enqueue(Connection* connection,
+               const std::shared_ptr<const std::vector<uint8_t>>& frame,
+               const std::shared_ptr<const PassedFd>& passed);
+  bool flush_locked(Connection* connection);
+  ssize_t send_packets_locked(Connection* connection);
+  void complete_send_locked(Connection* connection, size_t sent);
+  void close_connection(Connection* connection);
+
+  void arm_accept();
+  void arm_recv(Connection* connection);
+  void submit_sends_locked(Connection* connection);
+  void on_accept(int32_t result, uint32_t flags);
+  void on_recv(Worker* worker, Connection* connection, int32_t result,
+               uint32_t flags);
+  void on_send(Connection* connection, int32_t result);
+  void begin_close(Connection* connection);
+  void finish_close(Connection* connection);
+
+  SocketEngineConfig config_;
+  TransportReceiveHandler handler_;
+  std::atomic<bool> running_{false};
+  SocketBackend backend_ = SocketBackend::kEpoll;
+  int listen_fd_ = -1;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  size_t next_worker_ = 0;
+  uint64_t next_connection_id_ = 1;
+  std::atomic<uint64_t> overflow_disconnects_{0};
+
+  mutable std::mutex mutex_;
+  std::unordered_map<int, std::shared_ptr<Connection>> connections_;
+};
+
+}  // namespace ipc
+}  // namespace rtos
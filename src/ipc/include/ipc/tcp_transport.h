@@ -1,12 +1,12 @@
 #pragma once
 
 #include "ipc_transport.h"
+#include "socket_engine.h"
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
 
 namespace rtos {
@@ -17,6 +17,39 @@ struct TcpTransportConfig {
   std::string host = "127.0.0.1";
   uint16_t port = 5500;
   size_t max_clients = 8;
+  // I/O threads shared by all connections; accept runs on the first.
+  size_t io_threads = 1;
+  // Run on a shared reactor, such as IpcRuntime::io_reactor(), instead of
+  // io_threads of its own. Implies the epoll backend.
+  IpcReactor* reactor = nullptr;
+  // kIoUring falls back to epoll on kernels without the needed support.
+  SocketBackend backend = SocketBackend::kEpoll;
+  // Per-connection send queue bound and what happens when a peer overruns it.
+  size_t max_queued_bytes = 4 * 1024 * 1024;
+  SendOverflowPolicy overflow_policy = SendOverflowPolicy::kDrop;
+  std::chrono::milliseconds block_timeout{10};
+  // Socket tuning; buffer sizes of 0 keep the kernel defaults.
+  bool tcp_nodelay = true;
+  bool tcp_quickack = false;
+  int send_buffer_bytes = 0;
+  int receive_buffer_bytes = 0;
+  // Frames at least this large are sent with MSG_ZEROCOPY; 0 disables it.
+  size_t zerocopy_threshold = 0;
+  // Payloads at least compression_threshold bytes are LZ-compressed, and
+  // every frame carries a flag saying whether it was. Both ends must set
+  // compress. After a payload fails to shrink below compression_max_ratio
+  // of its size, the next compression_bypass_frames go out uncompressed.
+  bool compress = false;
+  size_t compression_threshold = 512;
+  double compression_max_ratio = 0.9;
+  size_t compression_bypass_frames = 64;
+};
+
+struct TcpCompressionStats {
+  uint64_t compressed_frames = 0;
+  uint64_t bypassed_frames = 0;  // Large enough, but skipped after poor ratios.
+  uint64_t input_bytes = 0;      // Payload bytes of compressed frames...
+  uint64_t output_bytes = 0;     // ...and what they compressed to.
 };
 
 class TcpTransport final : public IpcTransport {
@@ -28,24 +61,27 @@ class TcpTransport final : public IpcTransport {
   void stop() override;
   bool publish(const std::vector<uint8_t>& bytes) override;
 
+  SocketBackend backend() const { return engine_.backend(); }
+  size_t connection_count() const { return engine_.connection_count(); }
+  std::vector<ConnectionStats> connection_stats() const {
+    return engine_.connection_stats();
+  }
+  TcpCompressionStats compression_stats() const;
+
  private:
-  void run_accept_loop();
-  void run_receive_loop(int socket_fd);
-  void remove_client_fd(int socket_fd);
+  static SocketEngineConfig engine_config(const TcpTransportConfig& config);
   void close_socket(int& socket_fd);
-  bool send_frame(int socket_fd, const std::vector<uint8_t>& bytes);
-  bool recv_frame(int socket_fd, std::vector<uint8_t>* bytes);
+  bool publish_compressed(const std::vector<uint8_t>& bytes);
 
   TcpTransportConfig config_;
-  std::atomic<bool> running_{false};
-  TransportReceiveHandler handler_;
-
-  std::mutex socket_mutex_;
-  int listen_fd_ = -1;
-  int server_fd_ = -1;
-  std::vector<int> client_fds_;
-  std::vector<std::thread> client_threads_;
-  std::thread accept_thread_;
+  SocketEngine engine_;
+
+  std::atomic<uint64_t> compression_candidates_{0};
+  std::atomic<uint64_t> bypass_until_{0};
+  std::atomic<uint64_t> compressed_frames_{0};
+  std::atomic<uint64_t> bypassed_frames_{0};
+  std::atomic<uint64_t> compressed_input_bytes_{0};
+  std::atomic<uint64_t> compressed_output_bytes_{0};
 };
 
 }  // namespace ipc
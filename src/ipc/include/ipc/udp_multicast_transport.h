@@ -0,0 +1,169 @@
+#pragma once
+
+#include "ipc_transport.h"
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+struct UdpMulticastConfig {
+  std::string group = "239.255.0.1";
+  uint16_t port = 5600;
+  // Interface to send on and join from; "127.0.0.1" keeps traffic on the
+  // loopback device, "0.0.0.0" lets the routing table pick.
+  std::string interface_address = "0.0.0.0";
+  int ttl = 1;
+  bool loopback = true;  // Also deliver to receivers on this host.
+  // Datagrams are sized to fit this link MTU without IP fragmentation.
+  size_t mtu = 1500;
+  size_t max_message_bytes = 16 * 1024 * 1024;
+  int receive_buffer_bytes = 0;  // 0 keeps the kernel default.
+
+  // At-least-once topics (every message with reliable = true) carry a
+  // sequence number. Receivers NACK gaps and the publisher repairs them from
+  // its last history_messages reliable messages. A gap still open after
+  // nack_retries NACKs, or one older than the history, is skipped and counted
+  // as lost.
+  bool reliable = false;
+  std::vector<std::string> reliable_topics;
+  size_t history_messages = 1024;
+  std::chrono::milliseconds heartbeat_interval{100};
+  std::chrono::milliseconds nack_delay{2};
+  std::chrono::milliseconds nack_interval{20};
+  size_t nack_retries = 5;
+  // Partly received best-effort messages are dropped after this long.
+  std::chrono::milliseconds reassembly_timeout{1000};
+};
+
+struct UdpMulticastStats {
+  uint64_t sent_messages = 0;
+  uint64_t sent_datagrams = 0;
+  uint64_t send_calls = 0;
+  uint64_t received_messages = 0;
+  uint64_t received_datagrams = 0;
+  uint64_t receive_calls = 0;
+  uint64_t nacks_sent = 0;
+  uint64_t nacks_received = 0;
+  uint64_t retransmitted_messages = 0;
+  uint64_t lost_messages = 0;
+  uint64_t expired_messages = 0;  // Best-effort messages missing fragments.
+};
+
+// One-to-many fan-out over UDP multicast: every publish leaves as one set of
+// datagrams however many receivers have joined the group. Messages larger
+// than a datagram are fragmented, and all fragments go out in one
+// sendmmsg(). Receives are batched with recvmmsg(), and the handler runs on
+// the receive thread. Every transport both publishes and receives, and
+// skips its own datagrams.
+class UdpMulticastTransport final : public IpcTransport {
+ public:
+  explicit UdpMulticastTransport(UdpMulticastConfig config);
+  ~UdpMulticastTransport() override;
+
+  void start(TransportReceiveHandler handler) override;
+  void stop() override;
+  bool publish(const std::vector<uint8_t>& bytes) override;
+  bool publish_topic(const std::string& topic,
+                     const std::vector<uint8_t>& bytes) override;
+
+  UdpMulticastStats stats() const;
+  uint32_t sender_id() const { return sender_id_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  struct Header;
+
+  struct SentMessage {
+    uint64_t sequence = 0;
+    uint64_t message_id = 0;
+    std::shared_ptr<const std::vector<uint8_t>> bytes;
+  };
+
+  // Reliable stream state for one publisher, owned by the receive thread.
+  struct Peer {
+    bool synced = false;
+    uint64_t expected = 0;   // Next sequence to deliver.
+    uint64_t known_end = 0;  // One past the highest sequence announced.
+    std::map<uint64_t, std::vector<uint8_t>> pending;
+    sockaddr_in address{};
+    Clock::time_point gap_since;
+    Clock::time_point last_nack;
+    size_t nacks = 0;
+  };
+
+  struct Partial {
+    std::vector<uint8_t> bytes;
+    std::vector<bool> received;
+    size_t remaining = 0;
+    bool reliable = false;
+    uint64_t sequence = 0;
+    Clock::time_point started;
+  };
+
+  bool publish_message(bool reliable, const std::vector<uint8_t>& bytes);
+  bool open_sockets();
+  void close_sockets();
+  void run();
+  void receive_batch(int fd);
+  void on_datagram(const uint8_t* data, size_t length, const sockaddr_in& from);
+  void on_fragment(const Header& header, const uint8_t* body, size_t length,
+                   const sockaddr_in& from);
+  void on_nack(const Header& header, const sockaddr_in& from);
+  void on_sequence_hint(Peer& peer, uint64_t end);
+  void accept_reliable(Peer& peer, uint64_t sequence,
+                       std::vector<uint8_t> bytes);
+  void skip_to(Peer& peer, uint64_t sequence);
+  void deliver(const std::vector<uint8_t>& bytes);
+  Clock::time_point service_timers(Clock::time_point now);
+
+  bool send_locked(const std::vector<uint8_t>& bytes, uint64_t message_id,
+                   uint64_t sequence, bool reliable, const sockaddr_in& to);
+  void send_control_locked(uint8_t type, uint32_t sender, uint64_t sequence,
+                           uint32_t count, const sockaddr_in& to);
+  bool is_reliable(const std::string& topic) const;
+
+  UdpMulticastConfig config_;
+  TransportReceiveHandler handler_;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+  uint32_t sender_id_ = 0;
+  size_t fragment_bytes_ = 0;
+
+  int data_fd_ = -1;     // Bound to the group; receives multicast.
+  int control_fd_ = -1;  // Sends everything; receives NACKs and repairs.
+  int wake_fd_ = -1;
+  sockaddr_in group_address_{};
+
+  // Publisher side, shared by publish() and NACK repair.
+  std::mutex send_mutex_;
+  uint64_t next_message_id_ = 0;
+  uint64_t next_sequence_ = 0;
+  std::deque<SentMessage> history_;
+
+  // Receive thread only.
+  std::unordered_map<uint32_t, Peer> peers_;
+  std::map<std::pair<uint32_t, uint64_t>, Partial> partials_;
+  std::vector<uint8_t> receive_buffers_;
+  Clock::time_point next_heartbeat_;
+
+  mutable std::mutex stats_mutex_;
+  UdpMulticastStats stats_;
+};
+
+}  // namespace ipc
+}  // namespace rtos
@@ -1,12 +1,11 @@
 #pragma once
 
 #include "ipc_transport.h"
+#include "socket_engine.h"
 
-#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
 
 namespace rtos {
@@ -16,6 +15,30 @@ struct UnixTransportConfig {
   bool is_server = false;
   std::string path = "/tmp/rtos_ipc.sock";
   size_t max_clients = 8;
+  // I/O threads shared by all connections; accept runs on the first.
+  size_t io_threads = 1;
+  // Run on a shared reactor, such as IpcRuntime::io_reactor(), instead of
+  // io_threads of its own. Implies the epoll backend.
+  IpcReactor* reactor = nullptr;
+  // kIoUring falls back to epoll on kernels without the needed support.
+  SocketBackend backend = SocketBackend::kEpoll;
+  // Per-connection send queue bound and what happens when a peer overruns it.
+  size_t max_queued_bytes = 4 * 1024 * 1024;
+  SendOverflowPolicy overflow_policy = SendOverflowPolicy::kDrop;
+  std::chrono::milliseconds block_timeout{10};
+  // Socket buffer sizes; 0 keeps the kernel defaults.
+  int send_buffer_bytes = 0;
+  int receive_buffer_bytes = 0;
+  // Messages at least this large travel as a sealed memfd passed with
+  // SCM_RIGHTS instead of through the socket; 0 disables it. Both ends must
+  // use the epoll backend.
+  size_t fd_passing_threshold = 0;
+  // SOCK_SEQPACKET instead of a byte stream: packet boundaries replace the
+  // length prefix and packets are sent and received in batches. Messages
+  // above max_packet_bytes need fd passing. Runs on the epoll backend; both
+  // ends must agree.
+  bool seqpacket = false;
+  size_t max_packet_bytes = 64 * 1024;
 };
 
 class UnixTransport final : public IpcTransport {
@@ -27,24 +50,19 @@ class UnixTransport final : public IpcTransport {
   void stop() override;
   bool publish(const std::vector<uint8_t>& bytes) override;
 
+  SocketBackend backend() const { return engine_.backend(); }
+  size_t connection_count() const { return engine_.connection_count(); }
+  std::vector<ConnectionStats> connection_stats() const {
+    return engine_.connection_stats();
+  }
+
  private:
-  void run_accept_loop();
-  void run_receive_loop(int socket_fd);
-  void remove_client_fd(int socket_fd);
+  static SocketEngineConfig engine_config(const UnixTransportConfig& config);
+  int socket_type() const;
   void close_socket(int& socket_fd);
-  bool send_frame(int socket_fd, const std::vector<uint8_t>& bytes);
-  bool recv_frame(int socket_fd, std::vector<uint8_t>* bytes);
 
   UnixTransportConfig config_;
-  std::atomic<bool> running_{false};
-  TransportReceiveHandler handler_;
-
-  std::mutex socket_mutex_;
-  int listen_fd_ = -1;
-  int server_fd_ = -1;
-  std::vector<int> client_fds_;
-  std::vector<std::thread> client_threads_;
-  std::thread accept_thread_;
+  SocketEngine engine_;
 };
 
 }  // namespace ipc
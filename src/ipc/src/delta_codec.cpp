@@ -0,0 +1,116 @@
+#include "../include/ipc/delta_codec.h"
+
+#include <algorithm>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+// Matching runs shorter than this cost more to skip than to copy.
+constexpr size_t kMinSkip = 4;
+
+void append_varint(std::vector<uint8_t>* bytes, uint64_t value) {
+  while (value >= 0x80) {
+    bytes->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back(static_cast<uint8_t>(value));
+}
+
+bool read_varint(const uint8_t* data, size_t length, size_t* offset,
+                 uint64_t* value) {
+  *value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (*offset >= length) {
+      return false;
+    }
+    uint8_t byte = data[(*offset)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+void encode_delta(const std::vector<uint8_t>& base,
+                  const std::vector<uint8_t>& target,
+                  std::vector<uint8_t>* delta) {
+  delta->clear();
+  append_varint(delta, target.size());
+  size_t common = base.size() < target.size() ? base.size() : target.size();
+  auto matches = [&](size_t i) { return i < common && base[i] == target[i]; };
+
+  size_t position = 0;
+  while (position < target.size()) {
+    size_t skip_end = position;
+    while (matches(skip_end)) {
+      ++skip_end;
+    }
+    if (skip_end == target.size()) {
+      break;
+    }
+    // Copy up to the next run of matching bytes long enough to skip.
+    size_t copy_end = skip_end;
+    while (copy_end < target.size()) {
+      size_t run = 0;
+      while (run < kMinSkip && matches(copy_end + run)) {
+        ++run;
+      }
+      if (run == kMinSkip) {
+        break;
+      }
+      copy_end += run + 1;
+    }
+    if (copy_end > target.size()) {
+      copy_end = target.size();
+    }
+    append_varint(delta, skip_end - position);
+    append_varint(delta, copy_end - skip_end);
+    delta->insert(delta->end(), target.begin() + skip_end,
+                  target.begin() + copy_end);
+    position = copy_end;
+  }
+}
+
+bool apply_delta(const std::vector<uint8_t>& base, const uint8_t* delta,
+                 size_t length, std::vector<uint8_t>* target) {
+  size_t offset = 0;
+  uint64_t size = 0;
+  if (!read_varint(delta, length, &offset, &size) || size > (1ull << 32)) {
+    return false;
+  }
+  target->resize(size);
+  size_t position = 0;
+  while (offset < length) {
+    uint64_t skip = 0;
+    uint64_t copy = 0;
+    if (!read_varint(delta, length, &offset, &skip) ||
+        !read_varint(delta, length, &offset, &copy) ||
+        skip > size - position || position + skip > base.size() ||
+        copy > size - position - skip || copy > length - offset) {
+      return false;
+    }
+    std::copy(base.begin() + position, base.begin() + position + skip,
+              target->begin() + position);
+    position += skip;
+    std::copy(delta + offset, delta + offset + copy,
+              target->begin() + position);
+    position += copy;
+    offset += copy;
+  }
+  if (position < size) {
+    if (base.size() < size) {
+      return false;
+    }
+    std::copy(base.begin() + position, base.begin() + size,
+              target->begin() + position);
+  }
+  return true;
+}
+
+}  // namespace ipc
+}  // namespace rtos
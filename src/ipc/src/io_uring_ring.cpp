@@ -0,0 +1,245 @@
+#include "../include/ipc/io_uring_ring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr unsigned kProbeOps = 256;
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(SYS_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags) {
+  return static_cast<int>(::syscall(SYS_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+  return static_cast<int>(
+      ::syscall(SYS_io_uring_register, fd, opcode, arg, count));
+}
+
+void* map_shared(int fd, size_t bytes, off_t offset) {
+  void* ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+void* map_anonymous(size_t bytes) {
+  void* ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+}  // namespace
+
+IoUring::~IoUring() {
+  destroy();
+}
+
+bool IoUring::init(unsigned entries, const uint8_t* opcodes,
+                   size_t opcode_count) {
+  io_uring_params params{};
+  int fd = io_uring_setup(entries, &params);
+  if (fd < 0) {
+    return false;
+  }
+  ring_fd_ = fd;
+
+  sq_map_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_bytes_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    sq_map_bytes_ = std::max(sq_map_bytes_, cq_map_bytes_);
+    cq_map_bytes_ = 0;
+  }
+  sq_map_ = map_shared(fd, sq_map_bytes_, IORING_OFF_SQ_RING);
+  cq_map_ = cq_map_bytes_ == 0
+                ? sq_map_
+                : map_shared(fd, cq_map_bytes_, IORING_OFF_CQ_RING);
+  sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(
+      map_shared(fd, sqes_bytes_, IORING_OFF_SQES));
+  if (!sq_map_ || !cq_map_ || !sqes_) {
+    destroy();
+    return false;
+  }
+
+  auto* sq = static_cast<uint8_t*>(sq_map_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_entries_ = params.sq_entries;
+  auto* cq = static_cast<uint8_t*>(cq_map_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  local_tail_ = *sq_tail_;
+
+  std::vector<uint8_t> probe_memory(sizeof(io_uring_probe) +
+                                    kProbeOps * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(probe_memory.data());
+  if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, kProbeOps) < 0) {
+    destroy();
+    return false;
+  }
+  for (size_t i = 0; i < opcode_count; ++i) {
+    uint8_t op = opcodes[i];
+    if (op > probe->last_op ||
+        (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+      destroy();
+      return false;
+    }
+  }
+  return true;
+}
+
+void IoUring::destroy() {
+  if (sqes_) {
+    ::munmap(sqes_, sqes_bytes_);
+  }
+  if (cq_map_ && cq_map_ != sq_map_) {
+    ::munmap(cq_map_, cq_map_bytes_);
+  }
+  if (sq_map_) {
+    ::munmap(sq_map_, sq_map_bytes_);
+  }
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+  }
+  if (buffers_) {
+    ::munmap(buffers_, buffers_bytes_);
+  }
+  sqes_ = nullptr;
+  sq_map_ = nullptr;
+  cq_map_ = nullptr;
+  ring_fd_ = -1;
+  buffers_ = nullptr;
+  buffer_count_ = 0;
+  local_tail_ = 0;
+}
+
+// The buffers are handed over with IORING_OP_PROVIDE_BUFFERS rather than a
+// registered buffer ring: it works on every kernel with multishot receive,
+// and returning one buffer is just another entry in the next submit.
+bool IoUring::register_buffers(uint16_t group, uint16_t count, uint32_t size) {
+  buffers_bytes_ = static_cast<size_t>(count) * size;
+  buffers_ = static_cast<uint8_t*>(map_anonymous(buffers_bytes_));
+  if (!buffers_) {
+    return false;
+  }
+  buffer_group_ = group;
+  buffer_count_ = count;
+  buffer_size_ = size;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+      return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = reinterpret_cast<uint64_t>(buffers_);
+    sqe->len = size;
+    sqe->off = 0;
+    sqe->buf_group = group;
+    sqe->user_data = kBufferUserData;
+  }
+  if (submit(true) < 0) {
+    return false;
+  }
+  io_uring_cqe* cqe = peek_cqe();
+  bool ok = cqe && cqe->user_data == kBufferUserData && cqe->res >= 0;
+  if (cqe) {
+    cqe_seen();
+  }
+  return ok;
+}
+
+const uint8_t* IoUring::buffer(uint16_t id) const {
+  return buffers_ + static_cast<size_t>(id) * buffer_size_;
+}
+
+void IoUring::recycle_buffer(uint16_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  io_uring_sqe* sqe = get_sqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = 1;
+  sqe->addr = reinterpret_cast<uint64_t>(buffer(id));
+  sqe->len = buffer_size_;
+  sqe->off = id;
+  sqe->buf_group = buffer_group_;
+  sqe->user_data = kBufferUserData;
+}
+
+// Entries become visible to the kernel only when submitted, so a half-filled
+// entry is never consumed by a concurrent submit().
+io_uring_sqe* IoUring::get_sqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (local_tail_ - head >= sq_entries_) {
+    unsigned to_submit = publish_locked();
+    io_uring_enter(ring_fd_, to_submit, 0, 0);
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (local_tail_ - head >= sq_entries_) {
+      return nullptr;
+    }
+  }
+  unsigned index = local_tail_ & sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++local_tail_;
+  return sqe;
+}
+
+int IoUring::submit(bool wait) {
+  unsigned to_submit = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    to_submit = publish_locked();
+  }
+  if (to_submit == 0 && !wait) {
+    return 0;
+  }
+  return io_uring_enter(ring_fd_, to_submit, wait ? 1 : 0,
+                        wait ? IORING_ENTER_GETEVENTS : 0);
+}
+
+io_uring_cqe* IoUring::peek_cqe() {
+  unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return nullptr;
+  }
+  return &cqes_[head & cq_mask_];
+}
+
+void IoUring::cqe_seen() {
+  __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
+
+// Returns every entry the kernel has not consumed yet, including ones an
+// earlier, interrupted submit left behind.
+unsigned IoUring::publish_locked() {
+  __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+  return local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+}  // namespace ipc
+}  // namespace rtos
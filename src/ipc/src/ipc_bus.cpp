@@ -1,15 +1,54 @@
 #include "../include/ipc/ipc_bus.h"
 
 #include "../include/ipc/binary_serializer.h"
+#include "../include/ipc/delta_codec.h"
+#include "../include/ipc/ipc_runtime.h"
 #include "../include/ipc/local_transport.h"
 
 #include <algorithm>
 #include <chrono>
+#include <climits>
+#include <cstdint>
+#include <iterator>
+#include <random>
 #include <utility>
 
 namespace rtos {
 namespace ipc {
 
+namespace {
+
+constexpr char kAckTopic[] = "__ipc_ack";
+// Payload: sending bus id (8 bytes), interval in milliseconds (4 bytes) and
+// flags (1 byte), all big-endian, then the topic.
+constexpr char kRateTopic[] = "__ipc_rate";
+constexpr size_t kRateHeaderBytes = 13;
+constexpr uint8_t kRateKeepLatest = 0x01;
+constexpr uint8_t kRateRemoved = 0x02;
+// Announcements live for this many refresh periods.
+constexpr int kRateLeasePeriods = 3;
+// Delta topic payloads start with a kind byte, the sending bus id (8 bytes)
+// and the sender's frame number on the topic (4 bytes), big-endian.
+constexpr size_t kDeltaHeaderBytes = 13;
+constexpr uint8_t kDeltaKeyframe = 0;
+constexpr uint8_t kDeltaChanges = 1;
+
+void append_be(std::vector<uint8_t>* bytes, uint64_t value, size_t width) {
+  for (size_t i = width; i > 0; --i) {
+    bytes->push_back(static_cast<uint8_t>(value >> (8 * (i - 1))));
+  }
+}
+
+uint64_t read_be(const uint8_t* bytes, size_t width) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; ++i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+}  // namespace
+
 IpcBus::IpcBus()
     : IpcBus(std::make_unique<LocalTransport>(),
              std::make_unique<BinarySerializer>()) {}
@@ -22,46 +61,143 @@ IpcBus::IpcBus(std::unique_ptr<IpcTransport> transport,
       serializer_(std::move(serializer)),
       options_(options) {
   running_.store(true);
+  std::random_device random;
+  bus_id_ = (static_cast<uint64_t>(random()) << 32) | random();
+  next_announce_ = Clock::now() + options_.rate_refresh;
   if (transport_) {
+    in_process_ = transport_->supports_messages();
+    fast_path_ = options_.in_process_fast_path && in_process_;
+    if (fast_path_) {
+      transport_->set_message_handler(
+          [this](const std::shared_ptr<const IpcMessage>& message) {
+            dispatch(message);
+          });
+    }
     transport_->start([this](const std::vector<uint8_t>& bytes) {
       if (!serializer_) {
         return;
       }
-      IpcMessage message;
-      if (!serializer_->deserialize(bytes, &message)) {
+      auto message = std::make_shared<IpcMessage>();
+      if (!serializer_->deserialize(bytes, message.get()) ||
+          (is_delta_topic(message->topic) && !decode_delta(message.get()))) {
         return;
       }
-      dispatch(std::move(message));
+      dispatch(message);
     });
+    transport_->subscribe_topic(kAckTopic);
+    if (options_.announce_rates) {
+      transport_->subscribe_topic(kRateTopic);
+    }
   }
-  retry_thread_ = std::thread([this]() { retry_loop(); });
 }
 
+// A runtime timer may be inside service_timers() sending on the transport,
+// so cancel() waits it out before the transport stops; arm_timer() sees
+// running_ cleared and schedules no more. Once the transport has stopped
+// no new work can arrive, and a second cancel() drops dispatches it queued
+// meanwhile and waits out a handler that is still running.
 IpcBus::~IpcBus() {
-  running_.store(false);
-  pending_cv_.notify_all();
-  if (retry_thread_.joinable()) {
-    retry_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    running_.store(false);
+  }
+  timer_cv_.notify_all();
+  if (timer_thread_.joinable()) {
+    timer_thread_.join();
+  }
+  if (options_.runtime) {
+    options_.runtime->cancel(this);
   }
   if (transport_) {
     transport_->stop();
   }
+  if (options_.runtime) {
+    options_.runtime->cancel(this);
+  }
 }
 
-uint64_t IpcBus::subscribe(const std::string& topic, IpcHandler handler) {
-  if (topic.empty() || !handler) {
+uint64_t IpcBus::subscribe(const std::string& topic, IpcHandler handler,
+                           SubscribeOptions options) {
+  if (!handler) {
     return 0;
   }
+  return add_subscription(topic, std::move(handler), nullptr, options);
+}
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  uint64_t id = next_id_++;
-  subscriptions_.emplace(id, Subscription{topic, std::move(handler)});
+uint64_t IpcBus::subscribe_shared(const std::string& topic,
+                                  IpcSharedHandler handler,
+                                  SubscribeOptions options) {
+  if (!handler) {
+    return 0;
+  }
+  return add_subscription(topic, nullptr, std::move(handler), options);
+}
+
+uint64_t IpcBus::add_subscription(const std::string& topic, IpcHandler handler,
+                                  IpcSharedHandler shared_handler,
+                                  SubscribeOptions options) {
+  if (topic.empty()) {
+    return 0;
+  }
+
+  uint64_t id = 0;
+  Clock::time_point next_announce;
+  // Transports may map or create per-topic state when told about a topic,
+  // so that happens outside mutex_ and dispatch keeps running meanwhile.
+  {
+    std::lock_guard<std::mutex> topic_lock(topic_mutex_);
+    bool first = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      id = next_id_++;
+      first = transport_ && count_locked(topic) == 0;
+      Subscription subscription;
+      subscription.topic = topic;
+      subscription.handler = std::move(handler);
+      subscription.shared_handler = std::move(shared_handler);
+      subscription.rate = options;
+      subscriptions_.emplace(id, std::move(subscription));
+      if (options.min_interval.count() > 0) {
+        rate_limits_.fetch_add(1);
+      }
+      next_announce = next_announce_;
+    }
+    if (first) {
+      transport_->subscribe_topic(topic);
+    }
+  }
+  if (options_.announce_rates && transport_) {
+    announce_rate(topic);
+    arm_timer(next_announce);
+  }
   return id;
 }
 
 void IpcBus::unsubscribe(uint64_t subscription_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  subscriptions_.erase(subscription_id);
+  std::string topic;
+  {
+    std::lock_guard<std::mutex> topic_lock(topic_mutex_);
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = subscriptions_.find(subscription_id);
+      if (it == subscriptions_.end()) {
+        return;
+      }
+      topic = std::move(it->second.topic);
+      if (it->second.rate.min_interval.count() > 0) {
+        rate_limits_.fetch_sub(1);
+      }
+      subscriptions_.erase(it);
+      last = transport_ && count_locked(topic) == 0;
+    }
+    if (last) {
+      transport_->unsubscribe_topic(topic);
+    }
+  }
+  if (options_.announce_rates && transport_) {
+    announce_rate(topic);
+  }
 }
 
 void IpcBus::publish(IpcMessage message) {
@@ -76,73 +212,354 @@ void IpcBus::publish(IpcMessage message) {
     message.sequence = next_sequence_.fetch_add(1);
   }
 
-  if (!serializer_ || !transport_) {
+  if (!transport_ || (!fast_path_ && !serializer_)) {
     return;
   }
 
-  if (message.qos == DeliveryQos::kAtLeastOnce && !message.is_ack) {
+  // The payload moves into the shared message, which the retry queue and
+  // in-process subscribers then share without copying.
+  auto shared = std::make_shared<const IpcMessage>(std::move(message));
+
+  // Decimate before anything is serialized or sent when every subscriber
+  // the publisher knows of is rate limited.
+  if (shared->qos == DeliveryQos::kBestEffort &&
+      rate_limits_.load(std::memory_order_relaxed) > 0) {
+    Clock::time_point flush_due = Clock::time_point::max();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      SubscribeOptions rate;
+      if (publish_rate_locked(shared->topic, Clock::now(), &rate)) {
+        RateGate& gate = gates_[shared->topic];
+        if (!admit(&gate, rate, shared, Clock::duration::zero())) {
+          if (!gate.held) {
+            return;
+          }
+          flush_due = gate.flush_due;
+        }
+      }
+    }
+    if (flush_due != Clock::time_point::max()) {
+      arm_timer(flush_due);
+      return;
+    }
+  }
+
+  if (shared->qos == DeliveryQos::kAtLeastOnce && !shared->is_ack) {
     PendingMessage pending;
-    pending.message = message;
+    pending.message = shared;
     pending.retries_left = options_.retry_count;
-    pending.next_due = std::chrono::steady_clock::now() + options_.retry_interval;
+    pending.next_due = Clock::now() + options_.retry_interval;
+    Clock::time_point due = pending.next_due;
     {
       std::lock_guard<std::mutex> lock(pending_mutex_);
-      pending_[message.sequence] = std::move(pending);
+      pending_[shared->sequence] = std::move(pending);
     }
-    pending_cv_.notify_one();
+    arm_timer(due);
   }
+  send(shared);
+}
 
-  {
-    std::lock_guard<std::mutex> lock(send_mutex_);
-    auto bytes = serializer_->serialize(message);
-    if (bytes.empty()) {
-      return;
+void IpcBus::send(const std::shared_ptr<const IpcMessage>& message) {
+  if (fast_path_) {
+    transport_->publish_message(message);
+    return;
+  }
+  if (!serializer_) {
+    return;
+  }
+  // Deltas are taken against the previous message actually sent, so encoding
+  // and sending happen under one lock.
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  std::vector<uint8_t> bytes;
+  if (is_delta_topic(message->topic)) {
+    IpcMessage encoded;
+    encode_delta_locked(*message, &encoded);
+    bytes = serializer_->serialize(encoded);
+  } else {
+    bytes = serializer_->serialize(*message);
+  }
+  if (!bytes.empty()) {
+    transport_->publish_topic(message->topic, bytes);
+  }
+}
+
+bool IpcBus::is_delta_topic(const std::string& topic) const {
+  return !options_.delta_topics.empty() &&
+         std::find(options_.delta_topics.begin(), options_.delta_topics.end(),
+                   topic) != options_.delta_topics.end();
+}
+
+// A keyframe goes out first, every delta_keyframe_interval messages, and
+// whenever the changes would not be smaller than the payload.
+void IpcBus::encode_delta_locked(const IpcMessage& message,
+                                 IpcMessage* encoded) {
+  DeltaSender& sender = delta_senders_[message.topic];
+  bool keyframe = sender.frame == 0 ||
+                  sender.since_keyframe + 1 >= options_.delta_keyframe_interval;
+  std::vector<uint8_t> changes;
+  if (!keyframe) {
+    encode_delta(sender.last, message.payload, &changes);
+    keyframe = changes.size() >= message.payload.size();
+  }
+  ++sender.frame;
+  sender.since_keyframe = keyframe ? 0 : sender.since_keyframe + 1;
+  sender.last = message.payload;
+
+  encoded->topic = message.topic;
+  encoded->timestamp = message.timestamp;
+  encoded->sequence = message.sequence;
+  encoded->qos = message.qos;
+  const std::vector<uint8_t>& body = keyframe ? message.payload : changes;
+  encoded->payload.reserve(kDeltaHeaderBytes + body.size());
+  append_be(&encoded->payload, keyframe ? kDeltaKeyframe : kDeltaChanges, 1);
+  append_be(&encoded->payload, bus_id_, 8);
+  append_be(&encoded->payload, sender.frame, 4);
+  encoded->payload.insert(encoded->payload.end(), body.begin(), body.end());
+}
+
+// Changes apply only on top of the sender's previous frame; after a gap the
+// stream waits for the next keyframe.
+bool IpcBus::decode_delta(IpcMessage* message) {
+  const auto& payload = message->payload;
+  if (payload.size() < kDeltaHeaderBytes) {
+    return false;
+  }
+  uint8_t kind = payload[0];
+  uint64_t sender = read_be(payload.data() + 1, 8);
+  auto frame = static_cast<uint32_t>(read_be(payload.data() + 9, 4));
+  const uint8_t* body = payload.data() + kDeltaHeaderBytes;
+  size_t body_length = payload.size() - kDeltaHeaderBytes;
+
+  auto now = Clock::now();
+  std::lock_guard<std::mutex> lock(delta_mutex_);
+  if (options_.delta_idle_timeout.count() > 0 && now >= next_delta_sweep_) {
+    expire_delta_receivers_locked(now);
+  }
+  auto topic = delta_receivers_.find(message->topic);
+  bool known = topic != delta_receivers_.end() && topic->second.count(sender);
+  if (!known && options_.max_delta_senders > 0 &&
+      delta_receiver_count_ >= options_.max_delta_senders) {
+    evict_oldest_delta_receiver_locked();
+  }
+  auto entry = delta_receivers_[message->topic].try_emplace(sender);
+  delta_receiver_count_ += entry.second ? 1 : 0;
+  DeltaReceiver& receiver = entry.first->second;
+  receiver.last_seen = now;
+  if (kind == kDeltaKeyframe) {
+    receiver.last.assign(body, body + body_length);
+  } else {
+    std::vector<uint8_t> rebuilt;
+    if (kind != kDeltaChanges || !receiver.synced ||
+        frame != static_cast<uint32_t>(receiver.frame + 1) ||
+        !apply_delta(receiver.last, body, body_length, &rebuilt)) {
+      receiver.synced = false;
+      return false;
     }
-    transport_->publish(bytes);
+    receiver.last = std::move(rebuilt);
   }
+  receiver.synced = true;
+  receiver.frame = frame;
+  message->payload = receiver.last;
+  return true;
 }
 
-void IpcBus::dispatch(IpcMessage message) {
-  if (message.is_ack) {
-    handle_ack(message.ack_for);
+// Restarted publishers come back under a new bus id, so without this every
+// restart would leave its last payload behind for good.
+void IpcBus::expire_delta_receivers_locked(Clock::time_point now) {
+  for (auto topic = delta_receivers_.begin();
+       topic != delta_receivers_.end();) {
+    auto& senders = topic->second;
+    for (auto it = senders.begin(); it != senders.end();) {
+      if (now - it->second.last_seen >= options_.delta_idle_timeout) {
+        it = senders.erase(it);
+        --delta_receiver_count_;
+      } else {
+        ++it;
+      }
+    }
+    topic = senders.empty() ? delta_receivers_.erase(topic) : std::next(topic);
+  }
+  next_delta_sweep_ = now + options_.delta_idle_timeout / 2;
+}
+
+void IpcBus::evict_oldest_delta_receiver_locked() {
+  auto oldest_topic = delta_receivers_.end();
+  std::unordered_map<uint64_t, DeltaReceiver>::iterator oldest;
+  for (auto topic = delta_receivers_.begin(); topic != delta_receivers_.end();
+       ++topic) {
+    for (auto it = topic->second.begin(); it != topic->second.end(); ++it) {
+      if (oldest_topic == delta_receivers_.end() ||
+          it->second.last_seen < oldest->second.last_seen) {
+        oldest_topic = topic;
+        oldest = it;
+      }
+    }
+  }
+  if (oldest_topic == delta_receivers_.end()) {
+    return;
+  }
+  oldest_topic->second.erase(oldest);
+  --delta_receiver_count_;
+  if (oldest_topic->second.empty()) {
+    delta_receivers_.erase(oldest_topic);
+  }
+}
+
+void IpcBus::dispatch(const std::shared_ptr<const IpcMessage>& message) {
+  if (message->is_ack) {
+    handle_ack(message->ack_for);
+    return;
+  }
+  if (options_.announce_rates && message->topic == kRateTopic) {
+    handle_rate(*message);
     return;
   }
 
-  if (message.qos == DeliveryQos::kAtLeastOnce && message.sequence != 0) {
-    send_ack(message.sequence);
+  if (message->qos == DeliveryQos::kAtLeastOnce && message->sequence != 0) {
+    send_ack(message->sequence);
   }
 
-  std::vector<IpcHandler> handlers;
+  // Arrival jitter can bring messages a publisher spaced exactly one
+  // interval apart slightly closer, so subscribers allow a tenth of slack.
+  bool limited = message->qos == DeliveryQos::kBestEffort;
+  Clock::time_point flush_due = Clock::time_point::max();
+  std::vector<Target> handlers;
   {
     std::lock_guard<std::mutex> lock(mutex_);
     handlers.reserve(subscriptions_.size());
-    for (const auto& entry : subscriptions_) {
-      const auto& sub = entry.second;
-      if (sub.topic == message.topic) {
-        handlers.push_back(sub.handler);
+    for (auto& entry : subscriptions_) {
+      auto& sub = entry.second;
+      if (sub.topic != message->topic) {
+        continue;
+      }
+      if (limited && sub.rate.min_interval.count() > 0 &&
+          !admit(&sub.gate, sub.rate, message, sub.rate.min_interval / 10)) {
+        if (sub.gate.held) {
+          flush_due = std::min(flush_due, sub.gate.flush_due);
+        }
+        continue;
+      }
+      handlers.push_back(Target{sub.handler, sub.shared_handler});
+    }
+  }
+  if (flush_due != Clock::time_point::max()) {
+    arm_timer(flush_due);
+  }
+  deliver(std::move(handlers), message);
+}
+
+void IpcBus::deliver(std::vector<Target> targets,
+                     const std::shared_ptr<const IpcMessage>& message) {
+  if (targets.empty()) {
+    return;
+  }
+  auto run = [message](const std::vector<Target>& handlers) {
+    for (const auto& target : handlers) {
+      if (target.shared_handler) {
+        target.shared_handler(message);
+      } else {
+        target.handler(*message);
       }
     }
+  };
+  if (options_.runtime && options_.runtime->dispatch_thread_count() > 0) {
+    options_.runtime->post(this, [run, handlers = std::move(targets)]() {
+      run(handlers);
+    });
+    return;
   }
+  run(targets);
+}
 
-  for (const auto& handler : handlers) {
-    handler(message);
+// Lets |message| through when a full interval has passed since the last one
+// let through. Otherwise a keep-latest gate holds it until the interval ends.
+bool IpcBus::admit(RateGate* gate, const SubscribeOptions& rate,
+                   const std::shared_ptr<const IpcMessage>& message,
+                   Clock::duration slack) {
+  Clock::time_point stamp = message->timestamp;
+  if (gate->last == Clock::time_point{} || stamp < gate->last ||
+      stamp - gate->last + slack >= rate.min_interval) {
+    gate->last = stamp;
+    gate->held.reset();
+    return true;
   }
+  if (rate.keep_latest) {
+    // Timestamps from another host's clock still flush within an interval.
+    if (!gate->held) {
+      Clock::time_point now = Clock::now();
+      gate->flush_due = std::min(std::max(gate->last + rate.min_interval, now),
+                                 now + rate.min_interval);
+    }
+    gate->held = message;
+  }
+  return false;
+}
+
+// In-process the bus sees every subscriber itself; otherwise it relies on
+// live announcements. Either way a single unlimited subscriber, or none
+// known, leaves the topic undecimated.
+bool IpcBus::publish_rate_locked(const std::string& topic,
+                                 Clock::time_point now,
+                                 SubscribeOptions* rate) const {
+  if (in_process_) {
+    return local_rate_locked(topic, rate);
+  }
+  if (!options_.announce_rates) {
+    return false;
+  }
+  auto it = remote_rates_.find(topic);
+  if (it == remote_rates_.end()) {
+    return false;
+  }
+  bool found = false;
+  SubscribeOptions result(std::chrono::milliseconds::max());
+  for (const auto& entry : it->second) {
+    const RemoteRate& remote = entry.second;
+    if (remote.expires < now) {
+      continue;
+    }
+    if (remote.rate.min_interval.count() == 0) {
+      return false;
+    }
+    found = true;
+    result.min_interval = std::min(result.min_interval,
+                                   remote.rate.min_interval);
+    result.keep_latest = result.keep_latest || remote.rate.keep_latest;
+  }
+  *rate = result;
+  return found;
+}
+
+bool IpcBus::local_rate_locked(const std::string& topic,
+                               SubscribeOptions* rate) const {
+  bool found = false;
+  SubscribeOptions result(std::chrono::milliseconds::max());
+  for (const auto& entry : subscriptions_) {
+    const auto& sub = entry.second;
+    if (sub.topic != topic) {
+      continue;
+    }
+    if (sub.rate.min_interval.count() == 0) {
+      return false;
+    }
+    found = true;
+    result.min_interval = std::min(result.min_interval, sub.rate.min_interval);
+    result.keep_latest = result.keep_latest || sub.rate.keep_latest;
+  }
+  *rate = result;
+  return found;
 }
 
 void IpcBus::send_ack(uint64_t sequence) {
-  if (!serializer_ || !transport_ || sequence == 0) {
+  if (!transport_ || sequence == 0) {
     return;
   }
-  IpcMessage ack;
-  ack.topic = "__ipc_ack";
-  ack.is_ack = true;
-  ack.ack_for = sequence;
-  ack.qos = DeliveryQos::kBestEffort;
-  std::lock_guard<std::mutex> lock(send_mutex_);
-  auto bytes = serializer_->serialize(ack);
-  if (!bytes.empty()) {
-    transport_->publish(bytes);
-  }
+  auto ack = std::make_shared<IpcMessage>();
+  ack->topic = kAckTopic;
+  ack->is_ack = true;
+  ack->ack_for = sequence;
+  ack->qos = DeliveryQos::kBestEffort;
+  send(ack);
 }
 
 void IpcBus::handle_ack(uint64_t sequence) {
@@ -153,54 +570,257 @@ void IpcBus::handle_ack(uint64_t sequence) {
   pending_.erase(sequence);
 }
 
-void IpcBus::retry_loop() {
-  std::unique_lock<std::mutex> lock(pending_mutex_);
+// Announces the fastest rate this bus's subscribers take on |topic|, or that
+// none are left.
+void IpcBus::announce_rate(const std::string& topic) {
+  SubscribeOptions rate;
+  bool removed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removed = count_locked(topic) == 0;
+    if (!local_rate_locked(topic, &rate)) {
+      rate = SubscribeOptions{};
+    }
+  }
+  uint8_t flags = (rate.keep_latest ? kRateKeepLatest : 0) |
+                  (removed ? kRateRemoved : 0);
+  uint64_t interval_ms = std::min<uint64_t>(
+      static_cast<uint64_t>(rate.min_interval.count()), UINT32_MAX);
+
+  IpcMessage announcement;
+  announcement.topic = kRateTopic;
+  announcement.payload.reserve(kRateHeaderBytes + topic.size());
+  append_be(&announcement.payload, bus_id_, 8);
+  append_be(&announcement.payload, interval_ms, 4);
+  append_be(&announcement.payload, flags, 1);
+  announcement.payload.insert(announcement.payload.end(), topic.begin(),
+                              topic.end());
+  publish(std::move(announcement));
+}
+
+void IpcBus::handle_rate(const IpcMessage& message) {
+  const auto& payload = message.payload;
+  if (payload.size() <= kRateHeaderBytes) {
+    return;
+  }
+  uint64_t bus = read_be(payload.data(), 8);
+  if (bus == bus_id_) {
+    return;
+  }
+  RemoteRate remote;
+  remote.rate.min_interval =
+      std::chrono::milliseconds(read_be(payload.data() + 8, 4));
+  uint8_t flags = payload[12];
+  remote.rate.keep_latest = (flags & kRateKeepLatest) != 0;
+  remote.expires =
+      Clock::now() + options_.rate_refresh * kRateLeasePeriods;
+  std::string topic(payload.begin() + kRateHeaderBytes, payload.end());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entries = remote_rates_[topic];
+  auto it = entries.find(bus);
+  if (it != entries.end()) {
+    if (it->second.rate.min_interval.count() > 0) {
+      rate_limits_.fetch_sub(1);
+    }
+    entries.erase(it);
+  }
+  if ((flags & kRateRemoved) == 0) {
+    if (remote.rate.min_interval.count() > 0) {
+      rate_limits_.fetch_add(1);
+    }
+    entries.emplace(bus, remote);
+  }
+  if (entries.empty()) {
+    remote_rates_.erase(topic);
+  }
+}
+
+// One wake-up at a time is armed: a runtime timer, or the bus's own thread,
+// started the first time anything needs it.
+void IpcBus::arm_timer(Clock::time_point due) {
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  if (!running_.load() || due >= timer_due_) {
+    return;
+  }
+  timer_due_ = due;
+  if (options_.runtime) {
+    options_.runtime->schedule(this, due, [this]() { on_timer(); });
+    return;
+  }
+  if (!timer_thread_.joinable()) {
+    timer_thread_ = std::thread([this]() { timer_loop(); });
+  }
+  timer_cv_.notify_one();
+}
+
+void IpcBus::on_timer() {
+  {
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    if (!running_.load()) {
+      return;
+    }
+    timer_due_ = Clock::time_point::max();
+  }
+  Clock::time_point next = service_timers();
+  if (next != Clock::time_point::max()) {
+    arm_timer(next);
+  }
+}
+
+void IpcBus::timer_loop() {
+  std::unique_lock<std::mutex> lock(timer_mutex_);
   while (running_.load()) {
-    if (pending_.empty()) {
-      pending_cv_.wait(lock);
+    if (timer_due_ == Clock::time_point::max()) {
+      timer_cv_.wait(lock);
+      continue;
+    }
+    if (Clock::now() < timer_due_) {
+      timer_cv_.wait_until(lock, timer_due_);
       continue;
     }
+    timer_due_ = Clock::time_point::max();
+    lock.unlock();
+    Clock::time_point next = service_timers();
+    lock.lock();
+    timer_due_ = std::min(timer_due_, next);
+  }
+}
+
+IpcBus::Clock::time_point IpcBus::service_timers() {
+  Clock::time_point retries = service_retries();
+  return std::min(retries, service_rates(Clock::now()));
+}
 
-    auto now = std::chrono::steady_clock::now();
-    auto next_due = now + std::chrono::hours(24);
-    for (auto it = pending_.begin(); it != pending_.end();) {
-      if (it->second.next_due <= now) {
-        if (it->second.retries_left == 0) {
-          it = pending_.erase(it);
+// Resends what is due and returns when the next retry is due. The lock is
+// released around each send.
+IpcBus::Clock::time_point IpcBus::service_retries() {
+  std::unique_lock<std::mutex> lock(pending_mutex_);
+  auto now = Clock::now();
+  auto next_due = Clock::time_point::max();
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (it->second.next_due <= now) {
+      if (it->second.retries_left == 0) {
+        it = pending_.erase(it);
+        continue;
+      }
+      uint64_t sequence = it->first;
+      std::shared_ptr<const IpcMessage> message = it->second.message;
+      it->second.retries_left--;
+      it->second.next_due = now + options_.retry_interval;
+      lock.unlock();
+      if (transport_) {
+        send(message);
+      }
+      lock.lock();
+      it = pending_.find(sequence);
+      if (it == pending_.end()) {
+        now = Clock::now();
+        continue;
+      }
+      now = Clock::now();
+    }
+    if (it != pending_.end()) {
+      next_due = std::min(next_due, it->second.next_due);
+      ++it;
+    }
+  }
+  return next_due;
+}
+
+// Releases held keep-latest messages whose interval has ended, repeats rate
+// announcements, and forgets announcements that were not renewed.
+IpcBus::Clock::time_point IpcBus::service_rates(Clock::time_point now) {
+  auto next_due = Clock::time_point::max();
+  std::vector<std::shared_ptr<const IpcMessage>> to_send;
+  std::vector<std::pair<Target, std::shared_ptr<const IpcMessage>>>
+      to_deliver;
+  std::vector<std::string> to_announce;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : gates_) {
+      RateGate& gate = entry.second;
+      if (!gate.held) {
+        continue;
+      }
+      if (gate.flush_due > now) {
+        next_due = std::min(next_due, gate.flush_due);
+        continue;
+      }
+      SubscribeOptions rate;
+      if (publish_rate_locked(entry.first, now, &rate)) {
+        gate.last += rate.min_interval;
+      } else {
+        gate.last = gate.held->timestamp;
+      }
+      to_send.push_back(std::move(gate.held));
+      gate.held.reset();
+    }
+
+    for (auto& entry : subscriptions_) {
+      auto& sub = entry.second;
+      if (!sub.gate.held) {
+        continue;
+      }
+      if (sub.gate.flush_due > now) {
+        next_due = std::min(next_due, sub.gate.flush_due);
+        continue;
+      }
+      sub.gate.last += sub.rate.min_interval;
+      to_deliver.emplace_back(Target{sub.handler, sub.shared_handler},
+                              std::move(sub.gate.held));
+      sub.gate.held.reset();
+    }
+
+    for (auto topic = remote_rates_.begin(); topic != remote_rates_.end();) {
+      auto& entries = topic->second;
+      for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.expires >= now) {
+          ++it;
           continue;
         }
-        uint64_t sequence = it->first;
-        IpcMessage message = it->second.message;
-        it->second.retries_left--;
-        it->second.next_due = now + options_.retry_interval;
-        lock.unlock();
-        if (serializer_ && transport_) {
-          std::lock_guard<std::mutex> send_lock(send_mutex_);
-          auto bytes = serializer_->serialize(message);
-          if (!bytes.empty()) {
-            transport_->publish(bytes);
-          }
-        }
-        lock.lock();
-        it = pending_.find(sequence);
-        if (it == pending_.end()) {
-          now = std::chrono::steady_clock::now();
-          continue;
+        if (it->second.rate.min_interval.count() > 0) {
+          rate_limits_.fetch_sub(1);
         }
-        now = std::chrono::steady_clock::now();
+        it = entries.erase(it);
       }
-      if (it != pending_.end()) {
-        next_due = std::min(next_due, it->second.next_due);
-        ++it;
+      topic = entries.empty() ? remote_rates_.erase(topic) : std::next(topic);
+    }
+
+    if (options_.announce_rates && !subscriptions_.empty()) {
+      if (next_announce_ <= now) {
+        for (const auto& entry : subscriptions_) {
+          to_announce.push_back(entry.second.topic);
+        }
+        next_announce_ = now + options_.rate_refresh;
       }
+      next_due = std::min(next_due, next_announce_);
     }
+  }
 
-    pending_cv_.wait_until(lock, next_due);
+  for (const auto& message : to_send) {
+    send(message);
+  }
+  for (auto& delivery : to_deliver) {
+    std::vector<Target> targets;
+    targets.push_back(std::move(delivery.first));
+    deliver(std::move(targets), delivery.second);
   }
+  std::sort(to_announce.begin(), to_announce.end());
+  to_announce.erase(std::unique(to_announce.begin(), to_announce.end()),
+                    to_announce.end());
+  for (const auto& topic : to_announce) {
+    announce_rate(topic);
+  }
+  return next_due;
 }
 
 size_t IpcBus::subscriber_count(const std::string& topic) const {
   std::lock_guard<std::mutex> lock(mutex_);
+  return count_locked(topic);
+}
+
+size_t IpcBus::count_locked(const std::string& topic) const {
   size_t count = 0;
   for (const auto& entry : subscriptions_) {
     const auto& sub = entry.second;
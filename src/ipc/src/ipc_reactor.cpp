@@ -0,0 +1,312 @@
+#include "../include/ipc/ipc_reactor.h"
+
+#include "../include/ipc/shm_transport.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr size_t kReactorBatch = 64;
+constexpr int kMaxEpollEvents = 32;
+constexpr std::chrono::microseconds kSleepSlice{100000};
+constexpr std::chrono::microseconds kFallbackSlice{1000};
+
+}  // namespace
+
+IpcReactor::~IpcReactor() {
+  stop();
+}
+
+void IpcReactor::start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_.exchange(true)) {
+    return;
+  }
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = stop_fd_;
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event);
+  for (const auto& entry : fds_) {
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = entry.first;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, entry.first, &event);
+  }
+
+  thread_active_ = true;
+  thread_ = std::thread([this]() { run(); });
+  reactor_id_ = thread_.get_id();
+  if (!fds_.empty()) {
+    fd_thread_ = std::thread([this]() { watch_fds(); });
+  }
+}
+
+void IpcReactor::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  wake();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  watch_cv_.notify_all();
+  uint64_t one = 1;
+  if (::write(stop_fd_, &one, sizeof(one)) < 0) {
+    // The reactor thread still exits on its next sleep slice.
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (fd_thread_.joinable()) {
+    fd_thread_.join();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  thread_active_ = false;
+  for (auto& command : commands_) {
+    apply(&command);
+  }
+  applied_ += commands_.size();
+  commands_.clear();
+  ready_fds_.clear();
+  applied_cv_.notify_all();
+  watching_ = false;
+  ::close(epoll_fd_);
+  ::close(stop_fd_);
+  epoll_fd_ = -1;
+  stop_fd_ = -1;
+}
+
+void IpcReactor::add_shm(ShmTransport* transport) {
+  Command command;
+  command.kind = CommandKind::kAddShm;
+  command.transport = transport;
+  submit(std::move(command), false);
+}
+
+void IpcReactor::remove_shm(ShmTransport* transport) {
+  Command command;
+  command.kind = CommandKind::kRemoveShm;
+  command.transport = transport;
+  submit(std::move(command), true);
+}
+
+void IpcReactor::add_fd(int fd, FdHandler on_readable) {
+  Command command;
+  command.kind = CommandKind::kAddFd;
+  command.fd = fd;
+  command.handler = std::move(on_readable);
+  submit(std::move(command), false);
+}
+
+void IpcReactor::remove_fd(int fd) {
+  Command command;
+  command.kind = CommandKind::kRemoveFd;
+  command.fd = fd;
+  submit(std::move(command), true);
+}
+
+// Sources belong to the reactor thread, so changes are queued for it. When the
+// thread is not running they are applied right away.
+void IpcReactor::submit(Command command, bool wait) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!thread_active_) {
+    apply(&command);
+    return;
+  }
+  commands_.push_back(std::move(command));
+  uint64_t ticket = ++submitted_;
+  lock.unlock();
+  wake();
+  if (!wait || std::this_thread::get_id() == reactor_id_) {
+    return;
+  }
+  lock.lock();
+  applied_cv_.wait(lock, [&]() { return applied_ >= ticket; });
+}
+
+void IpcReactor::apply(Command* command) {
+  epoll_event event{};
+  switch (command->kind) {
+    case CommandKind::kAddShm:
+      if (std::find(transports_.begin(), transports_.end(),
+                    command->transport) == transports_.end()) {
+        transports_.push_back(command->transport);
+      }
+      break;
+    case CommandKind::kRemoveShm:
+      transports_.erase(std::remove(transports_.begin(), transports_.end(),
+                                    command->transport),
+                        transports_.end());
+      break;
+    case CommandKind::kAddFd:
+      fds_[command->fd] = std::move(command->handler);
+      if (epoll_fd_ >= 0) {
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.fd = command->fd;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, command->fd, &event);
+        if (thread_active_ && !fd_thread_.joinable()) {
+          fd_thread_ = std::thread([this]() { watch_fds(); });
+        }
+      }
+      break;
+    case CommandKind::kRemoveFd:
+      if (epoll_fd_ >= 0) {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, command->fd, nullptr);
+      }
+      fds_.erase(command->fd);
+      break;
+  }
+}
+
+void IpcReactor::run() {
+  std::vector<Command> commands;
+  std::vector<int> ready;
+  while (running_.load()) {
+    uint32_t observed = wake_.seq.load(std::memory_order_acquire);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      commands.swap(commands_);
+      ready.swap(ready_fds_);
+      for (auto& command : commands) {
+        apply(&command);
+      }
+      if (!commands.empty()) {
+        applied_ += commands.size();
+        applied_cv_.notify_all();
+      }
+    }
+    commands.clear();
+
+    bool busy = !ready.empty();
+    dispatch_fds(&ready);
+    if (poll_fds(&ready)) {
+      busy = true;
+      dispatch_fds(&ready);
+    }
+    for (ShmTransport* transport : transports_) {
+      busy = transport->poll(kReactorBatch) > 0 || busy;
+    }
+    if (!busy) {
+      sleep(observed);
+    }
+  }
+}
+
+// Descriptors are armed one-shot: a ready descriptor is reported once, to
+// either thread, and re-armed only after its handler has run on the reactor
+// thread. The helper only waits while the reactor has gone to sleep since
+// its last hand-over, so a busy reactor finds descriptors in poll_fds().
+void IpcReactor::watch_fds() {
+  epoll_event events[kMaxEpollEvents];
+  while (running_.load()) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      watch_cv_.wait(lock, [&]() { return watching_ || !running_.load(); });
+    }
+    int count = ::epoll_wait(epoll_fd_, events, kMaxEpollEvents, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    bool handed_over = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int i = 0; i < count; ++i) {
+        if (events[i].data.fd != stop_fd_) {
+          ready_fds_.push_back(events[i].data.fd);
+          handed_over = true;
+        }
+      }
+      watching_ = watching_ && !handed_over;
+    }
+    if (handed_over) {
+      wake();
+    }
+  }
+}
+
+bool IpcReactor::poll_fds(std::vector<int>* ready) {
+  if (fds_.empty()) {
+    return false;
+  }
+  epoll_event events[kMaxEpollEvents];
+  int count = ::epoll_wait(epoll_fd_, events, kMaxEpollEvents, 0);
+  for (int i = 0; i < count; ++i) {
+    if (events[i].data.fd != stop_fd_) {
+      ready->push_back(events[i].data.fd);
+    }
+  }
+  return !ready->empty();
+}
+
+void IpcReactor::dispatch_fds(std::vector<int>* ready) {
+  for (int fd : *ready) {
+    auto it = fds_.find(fd);
+    if (it == fds_.end()) {
+      continue;
+    }
+    it->second();
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+  }
+  ready->clear();
+}
+
+// Sleeps until a ring's doorbell or the reactor's own wake word changes.
+// Arming each doorbell before the readiness check pairs with the producer's
+// ShmDoorbell::notify(), so no wake-up is lost.
+void IpcReactor::sleep(uint32_t observed) {
+  if (!fds_.empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!watching_) {
+      watching_ = true;
+      watch_cv_.notify_one();
+    }
+  }
+
+  doorbells_.clear();
+  doorbells_.push_back(&wake_);
+  for (ShmTransport* transport : transports_) {
+    transport->doorbells(&doorbells_);
+  }
+  seqs_.clear();
+  seqs_.push_back(observed);
+  for (size_t i = 1; i < doorbells_.size(); ++i) {
+    seqs_.push_back(doorbells_[i]->arm());
+  }
+
+  bool ready = false;
+  for (ShmTransport* transport : transports_) {
+    ready = transport->readable() || ready;
+  }
+  if (!ready && running_.load()) {
+    if (!shm_sleep_any(doorbells_.data(), seqs_.data(), doorbells_.size(),
+                       kSleepSlice)) {
+      // No futex_waitv (kernels before 5.16) or too many doorbells: wake on
+      // commands promptly and poll the rings every millisecond.
+      wake_.sleep(observed, kFallbackSlice);
+    }
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void IpcReactor::wake() {
+  wake_.ring();
+}
+
+}  // namespace ipc
+}  // namespace rtos
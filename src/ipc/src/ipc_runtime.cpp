@@ -0,0 +1,198 @@
+#include "../include/ipc/ipc_runtime.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+
+namespace rtos {
+namespace ipc {
+
+IpcRuntime::IpcRuntime(IpcRuntimeConfig config) : config_(config) {
+  for (size_t i = 0; i < std::max<size_t>(1, config_.io_threads); ++i) {
+    reactors_.push_back(std::make_unique<IpcReactor>());
+  }
+  for (size_t i = 0; i < config_.dispatch_threads; ++i) {
+    executors_.push_back(std::make_unique<Executor>());
+  }
+}
+
+IpcRuntime::~IpcRuntime() {
+  stop();
+}
+
+void IpcRuntime::start() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    timer_thread_ = std::thread([this]() { run_timers(); });
+    for (auto& executor : executors_) {
+      Executor* raw = executor.get();
+      executor->thread = std::thread([this, raw]() { run_executor(raw); });
+    }
+  }
+  for (auto& reactor : reactors_) {
+    reactor->start();
+  }
+}
+
+void IpcRuntime::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  timer_cv_.notify_all();
+  for (auto& executor : executors_) {
+    executor->cv.notify_all();
+  }
+  if (timer_thread_.joinable()) {
+    timer_thread_.join();
+  }
+  for (auto& executor : executors_) {
+    if (executor->thread.joinable()) {
+      executor->thread.join();
+    }
+  }
+  for (auto& reactor : reactors_) {
+    reactor->stop();
+  }
+}
+
+bool IpcRuntime::running() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_;
+}
+
+void IpcRuntime::schedule(const void* owner, Clock::time_point due,
+                          Task task) {
+  if (!task) {
+    return;
+  }
+  bool earliest = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timers_.emplace(due, Timer{owner, std::move(task)});
+    earliest = it == timers_.begin();
+  }
+  if (earliest) {
+    timer_cv_.notify_one();
+  }
+}
+
+void IpcRuntime::post(const void* owner, Task task) {
+  if (!task) {
+    return;
+  }
+  Executor* executor = executor_for(owner);
+  if (!executor) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    executor->tasks.emplace_back(owner, std::move(task));
+  }
+  executor->cv.notify_one();
+}
+
+// A task that is still running may queue more work for its owner, so the
+// queues are swept again each time it finishes.
+void IpcRuntime::cancel(const void* owner) {
+  Executor* executor = executor_for(owner);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    for (auto it = timers_.begin(); it != timers_.end();) {
+      it = it->second.owner == owner ? timers_.erase(it) : std::next(it);
+    }
+    if (executor) {
+      auto& tasks = executor->tasks;
+      auto owned = [owner](const std::pair<const void*, Task>& task) {
+        return task.first == owner;
+      };
+      tasks.erase(std::remove_if(tasks.begin(), tasks.end(), owned),
+                  tasks.end());
+    }
+    if (!running_locked(owner)) {
+      return;
+    }
+    idle_cv_.wait(lock);
+  }
+}
+
+IpcReactor* IpcRuntime::io_reactor() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reactors_[next_reactor_++ % reactors_.size()].get();
+}
+
+void IpcRuntime::run_timers() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    if (timers_.empty()) {
+      timer_cv_.wait(lock);
+      continue;
+    }
+    auto first = timers_.begin();
+    if (first->first > Clock::now()) {
+      timer_cv_.wait_until(lock, first->first);
+      continue;
+    }
+    Timer timer = std::move(first->second);
+    timers_.erase(first);
+    timer_owner_ = timer.owner;
+    lock.unlock();
+    timer.task();
+    lock.lock();
+    timer_owner_ = nullptr;
+    idle_cv_.notify_all();
+  }
+}
+
+void IpcRuntime::run_executor(Executor* executor) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    if (executor->tasks.empty()) {
+      executor->cv.wait(lock);
+      continue;
+    }
+    auto task = std::move(executor->tasks.front());
+    executor->tasks.pop_front();
+    executor->running_owner = task.first;
+    lock.unlock();
+    task.second();
+    lock.lock();
+    executor->running_owner = nullptr;
+    idle_cv_.notify_all();
+  }
+}
+
+// The same owner always maps to the same executor, which keeps its tasks in
+// order. Owners are pointers, so the low bits are mixed in first.
+IpcRuntime::Executor* IpcRuntime::executor_for(const void* owner) {
+  if (executors_.empty()) {
+    return nullptr;
+  }
+  uint64_t key = reinterpret_cast<uintptr_t>(owner) * 0x9E3779B97F4A7C15ull;
+  return executors_[(key >> 32) % executors_.size()].get();
+}
+
+bool IpcRuntime::running_locked(const void* owner) const {
+  if (timer_owner_ == owner &&
+      std::this_thread::get_id() != timer_thread_.get_id()) {
+    return true;
+  }
+  for (const auto& executor : executors_) {
+    if (executor->running_owner == owner &&
+        std::this_thread::get_id() != executor->thread.get_id()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace ipc
+}  // namespace rtos
@@ -11,6 +11,12 @@ void LocalTransport::start(TransportReceiveHandler handler) {
 void LocalTransport::stop() {
   std::lock_guard<std::mutex> lock(mutex_);
   handler_ = nullptr;
+  message_handler_ = nullptr;
+}
+
+void LocalTransport::set_message_handler(TransportMessageHandler handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  message_handler_ = std::move(handler);
 }
 
 bool LocalTransport::publish(const std::vector<uint8_t>& bytes) {
@@ -27,5 +33,20 @@ bool LocalTransport::publish(const std::vector<uint8_t>& bytes) {
   return true;
 }
 
+bool LocalTransport::publish_message(
+    const std::shared_ptr<const IpcMessage>& message) {
+  TransportMessageHandler handler;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    handler = message_handler_;
+  }
+
+  if (!handler || !message) {
+    return false;
+  }
+  handler(message);
+  return true;
+}
+
 }  // namespace ipc
 }  // namespace rtos
@@ -0,0 +1,161 @@
+#include "../include/ipc/lz_codec.h"
+
+#include <cstring>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+constexpr unsigned kHashBits = 12;
+// Each miss advances further the longer the current literal run, so data
+// that does not compress is skipped quickly.
+constexpr unsigned kSkipShift = 5;
+
+uint32_t load32(const uint8_t* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t hash32(uint32_t value) {
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+// Lengths that do not fit in a token nibble continue in bytes of up to 255.
+void append_length(std::vector<uint8_t>* output, size_t length) {
+  while (length >= 255) {
+    output->push_back(255);
+    length -= 255;
+  }
+  output->push_back(static_cast<uint8_t>(length));
+}
+
+bool read_length(const uint8_t* input, size_t length, size_t* offset,
+                 size_t* value) {
+  uint8_t byte;
+  do {
+    if (*offset >= length) {
+      return false;
+    }
+    byte = input[(*offset)++];
+    *value += byte;
+  } while (byte == 255);
+  return true;
+}
+
+void append_sequence(std::vector<uint8_t>* output, const uint8_t* literals,
+                     size_t literal_length, size_t offset,
+                     size_t match_length) {
+  size_t match_code = match_length - kMinMatch;
+  uint8_t token = static_cast<uint8_t>(
+      (literal_length < 15 ? literal_length : 15) << 4);
+  if (match_length > 0) {
+    token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+  }
+  output->push_back(token);
+  if (literal_length >= 15) {
+    append_length(output, literal_length - 15);
+  }
+  output->insert(output->end(), literals, literals + literal_length);
+  if (match_length == 0) {
+    return;
+  }
+  output->push_back(static_cast<uint8_t>(offset));
+  output->push_back(static_cast<uint8_t>(offset >> 8));
+  if (match_code >= 15) {
+    append_length(output, match_code - 15);
+  }
+}
+
+}  // namespace
+
+// The table keeps positions from earlier inputs too; a stale candidate is
+// rejected by the position and byte checks like any other miss, so the
+// table never needs clearing.
+void lz_compress(const uint8_t* input, size_t length,
+                 std::vector<uint8_t>* output) {
+  thread_local uint32_t table[1u << kHashBits];
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (length >= kMinMatch && pos <= length - kMinMatch) {
+    uint32_t sequence = load32(input + pos);
+    uint32_t& slot = table[hash32(sequence)];
+    size_t candidate = slot;
+    slot = static_cast<uint32_t>(pos);
+    if (candidate >= pos || pos - candidate > kMaxOffset ||
+        load32(input + candidate) != sequence) {
+      pos += 1 + ((pos - anchor) >> kSkipShift);
+      continue;
+    }
+    size_t match = kMinMatch;
+    while (pos + match < length &&
+           input[candidate + match] == input[pos + match]) {
+      ++match;
+    }
+    append_sequence(output, input + anchor, pos - anchor, pos - candidate,
+                    match);
+    pos += match;
+    anchor = pos;
+  }
+  append_sequence(output, input + anchor, length - anchor, 0, 0);
+}
+
+bool lz_decompress(const uint8_t* input, size_t length,
+                   size_t original_length, std::vector<uint8_t>* output) {
+  output->resize(original_length);
+  uint8_t* out = output->data();
+  size_t written = 0;
+  size_t offset = 0;
+  while (offset < length) {
+    uint8_t token = input[offset++];
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 &&
+        !read_length(input, length, &offset, &literal_length)) {
+      return false;
+    }
+    if (literal_length > length - offset ||
+        literal_length > original_length - written) {
+      return false;
+    }
+    std::memcpy(out + written, input + offset, literal_length);
+    offset += literal_length;
+    written += literal_length;
+    if (offset == length) {
+      break;  // The last sequence has literals only.
+    }
+
+    if (length - offset < 2) {
+      return false;
+    }
+    size_t distance =
+        input[offset] | (static_cast<size_t>(input[offset + 1]) << 8);
+    offset += 2;
+    size_t match_length = token & 0x0F;
+    if (match_length == 15 &&
+        !read_length(input, length, &offset, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    if (distance == 0 || distance > written ||
+        match_length > original_length - written) {
+      return false;
+    }
+    // Overlapping references repeat the bytes just written.
+    const uint8_t* from = out + written - distance;
+    if (distance >= match_length) {
+      std::memcpy(out + written, from, match_length);
+    } else {
+      for (size_t i = 0; i < match_length; ++i) {
+        out[written + i] = from[i];
+      }
+    }
+    written += match_length;
+  }
+  return written == original_length;
+}
+
+}  // namespace ipc
+}  // namespace rtos
@@ -0,0 +1,229 @@
+#include "../include/ipc/shm_directory.h"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kDirectoryMagic = 0x44495231;  // "DIR1"
+constexpr uint32_t kDirectoryVersion = 3;
+
+constexpr uint32_t kEntryFree = 0;
+constexpr uint32_t kEntryCreating = 1;
+constexpr uint32_t kEntryReady = 2;
+
+constexpr int kLockSpinsBeforeYield = 128;
+
+}  // namespace
+
+struct ShmDirectory::Header {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint64_t max_channels;
+  std::atomic<uint32_t> lock;  // Holder's pid.
+};
+
+struct ShmDirectory::Entry {
+  std::atomic<uint32_t> state;
+  int32_t creator;  // Pid creating the segment, under the lock.
+  uint32_t key_length;
+  char key[kMaxKeyLength + 1];
+};
+
+size_t ShmDirectory::segment_size(size_t max_channels) {
+  return shm_align_up(sizeof(Header), kShmCacheLine) +
+         max_channels * sizeof(Entry);
+}
+
+bool ShmDirectory::create(void* memory, size_t segment_bytes,
+                          size_t max_channels) {
+  if (!memory || max_channels == 0 ||
+      segment_bytes < segment_size(max_channels)) {
+    return false;
+  }
+
+  auto* header = new (memory) Header();
+  header->magic.store(0, std::memory_order_relaxed);
+  header->version = kDirectoryVersion;
+  header->max_channels = max_channels;
+  header->lock.store(0, std::memory_order_relaxed);
+
+  auto* entries = reinterpret_cast<Entry*>(
+      static_cast<uint8_t*>(memory) +
+      shm_align_up(sizeof(Header), kShmCacheLine));
+  for (size_t i = 0; i < max_channels; ++i) {
+    auto* entry = new (&entries[i]) Entry();
+    entry->state.store(kEntryFree, std::memory_order_relaxed);
+    entry->creator = 0;
+    entry->key_length = 0;
+  }
+
+  header->magic.store(kDirectoryMagic, std::memory_order_release);
+  return attach(memory, segment_bytes);
+}
+
+bool ShmDirectory::attach(void* memory, size_t segment_bytes) {
+  if (!memory || segment_bytes < sizeof(Header)) {
+    return false;
+  }
+  auto* header = static_cast<Header*>(memory);
+  if (header->magic.load(std::memory_order_acquire) != kDirectoryMagic ||
+      header->version != kDirectoryVersion ||
+      segment_size(header->max_channels) > segment_bytes) {
+    return false;
+  }
+  header_ = header;
+  entries_ = reinterpret_cast<Entry*>(
+      static_cast<uint8_t*>(memory) +
+      shm_align_up(sizeof(Header), kShmCacheLine));
+  return true;
+}
+
+void ShmDirectory::detach() {
+  header_ = nullptr;
+  entries_ = nullptr;
+}
+
+size_t ShmDirectory::max_channels() const {
+  return header_ ? header_->max_channels : 0;
+}
+
+int ShmDirectory::find(const std::string& key) const {
+  if (!header_ || key.size() > kMaxKeyLength) {
+    return -1;
+  }
+  return match(key, false);
+}
+
+// A new entry is claimed under the lock as pending, and the channel segment
+// is created once the lock is released. Anyone else after the same key waits
+// for the entry to turn ready, or takes the creation over if its creator has
+// died.
+int ShmDirectory::find_or_add(
+    const std::string& key,
+    const std::function<bool(size_t index)>& create_channel) {
+  int index = find(key);
+  if (index >= 0 || !header_ || key.size() > kMaxKeyLength) {
+    return index;
+  }
+
+  auto pid = static_cast<int32_t>(::getpid());
+  int spins = 0;
+  while (true) {
+    bool claimed = false;
+    lock();
+    index = match(key, true);
+    if (index < 0) {
+      index = claim(key, pid);
+      claimed = index >= 0;
+    } else if (spins >= kLockSpinsBeforeYield &&
+               spins % kLockSpinsBeforeYield == 0 &&
+               entries_[index].state.load(std::memory_order_relaxed) ==
+                   kEntryCreating &&
+               !shm_process_alive(entries_[index].creator)) {
+      entries_[index].creator = pid;
+      claimed = true;
+    }
+    unlock();
+    if (index < 0) {
+      return -1;
+    }
+
+    Entry& entry = entries_[index];
+    if (claimed) {
+      bool created = create_channel && create_channel(index);
+      entry.state.store(created ? kEntryReady : kEntryFree,
+                        std::memory_order_release);
+      return created ? index : -1;
+    }
+    if (entry.state.load(std::memory_order_acquire) == kEntryReady) {
+      return index;
+    }
+    if (++spins < kLockSpinsBeforeYield) {
+      shm_cpu_relax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool ShmDirectory::ready(size_t index) const {
+  return header_ && index < header_->max_channels &&
+         entries_[index].state.load(std::memory_order_acquire) == kEntryReady;
+}
+
+// Matches ready entries, or with |pending| also those still being created.
+// A freed entry may sit between used ones, so the whole table is scanned.
+int ShmDirectory::match(const std::string& key, bool pending) const {
+  for (size_t i = 0; i < header_->max_channels; ++i) {
+    const Entry& entry = entries_[i];
+    uint32_t state = entry.state.load(std::memory_order_acquire);
+    if ((state == kEntryReady || (pending && state == kEntryCreating)) &&
+        entry.key_length == key.size() &&
+        std::memcmp(entry.key, key.data(), key.size()) == 0) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Called with the lock held.
+int ShmDirectory::claim(const std::string& key, int32_t pid) {
+  for (size_t i = 0; i < header_->max_channels; ++i) {
+    Entry& entry = entries_[i];
+    if (entry.state.load(std::memory_order_relaxed) != kEntryFree) {
+      continue;
+    }
+    entry.creator = pid;
+    entry.key_length = static_cast<uint32_t>(key.size());
+    std::memcpy(entry.key, key.data(), key.size());
+    entry.key[key.size()] = '\0';
+    entry.state.store(kEntryCreating, std::memory_order_release);
+    return static_cast<int>(i);
+  }
+  return -1;
+}
+
+// The lock word holds the holder's pid. It is only held for a few stores, so
+// a holder that stays past the spinning phase is checked for being alive and
+// the lock taken over from a dead one, as ShmRing does for its writer lock.
+void ShmDirectory::lock() {
+  auto self = static_cast<uint32_t>(::getpid());
+  int spins = 0;
+  while (true) {
+    uint32_t owner = 0;
+    if (header_->lock.compare_exchange_weak(owner, self,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+      return;
+    }
+    while (owner != 0) {
+      if (++spins < kLockSpinsBeforeYield) {
+        shm_cpu_relax();
+      } else {
+        if (spins % kLockSpinsBeforeYield == 0 &&
+            !shm_process_alive(static_cast<int32_t>(owner)) &&
+            header_->lock.compare_exchange_strong(
+                owner, self, std::memory_order_acquire,
+                std::memory_order_relaxed)) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+      owner = header_->lock.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void ShmDirectory::unlock() {
+  header_->lock.store(0, std::memory_order_release);
+}
+
+}  // namespace ipc
+}  // namespace rtos
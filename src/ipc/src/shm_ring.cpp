@@ -0,0 +1,733 @@
+#include "../include/ipc/shm_ring.h"
+
+#include <signal.h>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <thread>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kRingMagic = 0x52474E31;  // "RGN1"
+constexpr uint32_t kRingVersion = 5;
+constexpr uint32_t kFramePad = 1u << 0;
+constexpr size_t kFrameAlign = 16;
+constexpr int kWriterSpinsBeforeYield = 128;
+constexpr uint64_t kHeartbeatFrames = 64;
+
+constexpr uint32_t kConsumerFree = 0;
+constexpr uint32_t kConsumerActive = 1;
+constexpr uint32_t kConsumerEvicted = 2;
+
+constexpr size_t kBitsPerWord = 64;
+
+// Only the first kFrameAlign bytes are written for a wrap pad, so a pad always
+// fits in the space left at the end of the data area.
+struct FrameHeader {
+  uint32_t length;
+  uint32_t flags;
+  uint64_t sequence;
+  int64_t timestamp_ns;
+  uint64_t reserved;
+};
+
+static_assert(sizeof(FrameHeader) % kFrameAlign == 0,
+              "frame header must keep frames aligned");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shm cursors require lock-free 64-bit atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex words must be plain 32-bit integers");
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t floor_pow2(size_t value) {
+  size_t result = 1;
+  while (result <= value / 2) {
+    result <<= 1;
+  }
+  return value == 0 ? 0 : result;
+}
+
+void futex_wait(const std::atomic<uint32_t>* word, uint32_t expected,
+                std::chrono::microseconds timeout) {
+#if defined(__linux__)
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000);
+  ts.tv_nsec = static_cast<long>((timeout.count() % 1000000) * 1000);
+  ::syscall(SYS_futex, reinterpret_cast<const uint32_t*>(word), FUTEX_WAIT,
+            expected, &ts, nullptr, 0);
+#else
+  (void)word;
+  (void)expected;
+  std::this_thread::sleep_for(
+      std::min(timeout, std::chrono::microseconds(100)));
+#endif
+}
+
+void futex_wake_all(std::atomic<uint32_t>* word) {
+#if defined(__linux__)
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX,
+            nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+size_t bitmap_words(size_t max_consumers) {
+  return (max_consumers + kBitsPerWord - 1) / kBitsPerWord;
+}
+
+}  // namespace
+
+bool shm_process_alive(int32_t pid) {
+  return pid <= 0 || ::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+// The fence pairs with notify()'s: either the reader's recheck sees the
+// frame just published, or the producer sees the flag.
+uint32_t ShmDoorbell::arm() {
+  uint32_t observed = seq.load(std::memory_order_acquire);
+  sleepers.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return observed;
+}
+
+void ShmDoorbell::notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers.load(std::memory_order_relaxed) != 0 &&
+      sleepers.exchange(0, std::memory_order_relaxed) != 0) {
+    ring();
+  }
+}
+
+void ShmDoorbell::ring() {
+  seq.fetch_add(1, std::memory_order_release);
+  futex_wake_all(&seq);
+}
+
+void ShmDoorbell::sleep(uint32_t observed, std::chrono::microseconds timeout) {
+  futex_wait(&seq, observed, timeout);
+}
+
+bool shm_sleep_any(ShmDoorbell* const* doorbells, const uint32_t* observed,
+                   size_t count, std::chrono::microseconds timeout) {
+#if defined(__linux__) && defined(SYS_futex_waitv) && defined(FUTEX_WAITV_MAX)
+  if (count == 0 || count > FUTEX_WAITV_MAX) {
+    return false;
+  }
+  futex_waitv waiters[FUTEX_WAITV_MAX] = {};
+  for (size_t i = 0; i < count; ++i) {
+    waiters[i].val = observed[i];
+    waiters[i].uaddr = reinterpret_cast<uintptr_t>(&doorbells[i]->seq);
+    waiters[i].flags = FUTEX_32;
+  }
+  timespec deadline{};
+  ::clock_gettime(CLOCK_MONOTONIC, &deadline);
+  int64_t nanos = deadline.tv_nsec + timeout.count() * 1000;
+  deadline.tv_sec += static_cast<time_t>(nanos / 1000000000);
+  deadline.tv_nsec = static_cast<long>(nanos % 1000000000);
+  long result = ::syscall(SYS_futex_waitv, waiters, count, 0, &deadline,
+                          CLOCK_MONOTONIC);
+  return result >= 0 || errno == EAGAIN || errno == ETIMEDOUT ||
+         errno == EINTR;
+#else
+  (void)doorbells;
+  (void)observed;
+  (void)count;
+  (void)timeout;
+  return false;
+#endif
+}
+
+struct ShmRing::Header {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t max_consumers;
+  ShmLagPolicy lag_policy;
+  uint8_t reap_dead_consumers;
+  uint64_t lag_limit;
+  int64_t heartbeat_timeout_ns;
+
+  alignas(kShmCacheLine) std::atomic<uint64_t> head;
+
+  alignas(kShmCacheLine) std::atomic<uint32_t> writer_lock;  // Holder's pid.
+  uint64_t next_sequence;
+  std::atomic<uint64_t> floor;
+  uint64_t min_tail;  // Lower bound on the slowest tail, under writer_lock.
+  uint8_t min_tail_valid;
+
+  ShmDoorbell doorbell;
+};
+
+struct alignas(kShmCacheLine) ShmRing::Cursor {
+  std::atomic<uint64_t> tail;
+  std::atomic<uint32_t> state;
+  std::atomic<int32_t> pid;
+  std::atomic<int64_t> heartbeat_ns;
+  std::atomic<uint64_t> expected_sequence;
+  std::atomic<uint64_t> lost;
+  std::atomic<uint64_t> evictions;
+};
+
+namespace {
+
+// Returns the frame at |*tail|, stepping over a wrap pad if there is one.
+const FrameHeader* frame_at(const uint8_t* data, uint64_t capacity,
+                            uint64_t mask, uint64_t* tail) {
+  uint64_t index = *tail & mask;
+  auto* frame = reinterpret_cast<const FrameHeader*>(data + index);
+  if (frame->flags & kFramePad) {
+    *tail += capacity - index;
+    frame = reinterpret_cast<const FrameHeader*>(data);
+  }
+  return frame;
+}
+
+}  // namespace
+
+size_t ShmRing::bitmap_offset() {
+  return shm_align_up(sizeof(Header), kShmCacheLine);
+}
+
+size_t ShmRing::cursors_offset(size_t max_consumers) {
+  return bitmap_offset() +
+         shm_align_up(bitmap_words(max_consumers) * sizeof(uint64_t),
+                  kShmCacheLine);
+}
+
+size_t ShmRing::header_bytes(size_t max_consumers) {
+  return cursors_offset(max_consumers) + max_consumers * sizeof(Cursor);
+}
+
+size_t ShmRing::segment_size(size_t capacity, size_t max_consumers) {
+  return header_bytes(max_consumers) + floor_pow2(capacity);
+}
+
+bool ShmRing::create(void* memory, size_t segment_bytes, size_t max_consumers,
+                     const ShmRingPolicy& policy) {
+  if (!memory || max_consumers == 0 ||
+      segment_bytes <= header_bytes(max_consumers)) {
+    return false;
+  }
+  size_t capacity = floor_pow2(segment_bytes - header_bytes(max_consumers));
+  if (capacity < 2 * kFrameAlign) {
+    return false;
+  }
+
+  auto* header = new (memory) Header();
+  header->magic.store(0, std::memory_order_relaxed);
+  header->version = kRingVersion;
+  header->capacity = capacity;
+  header->max_consumers = max_consumers;
+  header->lag_policy = policy.lag_policy;
+  header->reap_dead_consumers = policy.reap_dead_consumers ? 1 : 0;
+  header->lag_limit = policy.lag_limit_bytes == 0
+                          ? capacity
+                          : std::min<uint64_t>(policy.lag_limit_bytes, capacity);
+  header->heartbeat_timeout_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          policy.heartbeat_timeout)
+          .count();
+  header->head.store(0, std::memory_order_relaxed);
+  header->writer_lock.store(0, std::memory_order_relaxed);
+  header->next_sequence = 1;
+  header->floor.store(0, std::memory_order_relaxed);
+  header->min_tail = 0;
+  header->min_tail_valid = 1;
+  header->doorbell.seq.store(0, std::memory_order_relaxed);
+  header->doorbell.sleepers.store(0, std::memory_order_relaxed);
+
+  auto* base = static_cast<uint8_t*>(memory);
+  auto* bitmap =
+      reinterpret_cast<std::atomic<uint64_t>*>(base + bitmap_offset());
+  for (size_t i = 0; i < bitmap_words(max_consumers); ++i) {
+    new (&bitmap[i]) std::atomic<uint64_t>(0);
+  }
+  auto* cursors =
+      reinterpret_cast<Cursor*>(base + cursors_offset(max_consumers));
+  for (size_t i = 0; i < max_consumers; ++i) {
+    auto* cursor = new (&cursors[i]) Cursor();
+    cursor->tail.store(0, std::memory_order_relaxed);
+    cursor->state.store(kConsumerFree, std::memory_order_relaxed);
+    cursor->pid.store(0, std::memory_order_relaxed);
+    cursor->heartbeat_ns.store(0, std::memory_order_relaxed);
+    cursor->expected_sequence.store(1, std::memory_order_relaxed);
+    cursor->lost.store(0, std::memory_order_relaxed);
+    cursor->evictions.store(0, std::memory_order_relaxed);
+  }
+
+  header->magic.store(kRingMagic, std::memory_order_release);
+  return attach(memory, segment_bytes);
+}
+
+bool ShmRing::attach(void* memory, size_t segment_bytes) {
+  if (!memory || segment_bytes < sizeof(Header)) {
+    return false;
+  }
+  auto* header = static_cast<Header*>(memory);
+  if (header->magic.load(std::memory_order_acquire) != kRingMagic ||
+      header->version != kRingVersion) {
+    return false;
+  }
+  if (header_bytes(header->max_consumers) + header->capacity > segment_bytes) {
+    return false;
+  }
+
+  auto* base = static_cast<uint8_t*>(memory);
+  header_ = header;
+  bitmap_ = reinterpret_cast<std::atomic<uint64_t>*>(base + bitmap_offset());
+  cursors_ =
+      reinterpret_cast<Cursor*>(base + cursors_offset(header->max_consumers));
+  data_ = base + header_bytes(header->max_consumers);
+  mask_ = header->capacity - 1;
+  doorbell_ = &header->doorbell;
+  writer_pid_ = static_cast<uint32_t>(::getpid());
+  return true;
+}
+
+void ShmRing::detach() {
+  header_ = nullptr;
+  bitmap_ = nullptr;
+  cursors_ = nullptr;
+  data_ = nullptr;
+  mask_ = 0;
+  doorbell_ = nullptr;
+}
+
+void ShmRing::set_doorbell(ShmDoorbell* doorbell) {
+  if (header_) {
+    doorbell_ = doorbell ? doorbell : &header_->doorbell;
+  }
+}
+
+size_t ShmRing::capacity() const {
+  return header_ ? header_->capacity : 0;
+}
+
+size_t ShmRing::max_consumers() const {
+  return header_ ? header_->max_consumers : 0;
+}
+
+bool ShmRing::write(const uint8_t* data, size_t length) {
+  if (!header_ || (!data && length > 0)) {
+    return false;
+  }
+  uint64_t capacity = header_->capacity;
+  size_t frame = shm_align_up(sizeof(FrameHeader) + length, kFrameAlign);
+  if (length > UINT32_MAX || frame > capacity / 2) {
+    return false;
+  }
+
+  lock_writer();
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t index = head & mask_;
+  uint64_t remaining = capacity - index;
+  uint64_t needed = frame + (remaining < frame ? remaining : 0);
+  if (head + needed - admit(head, head + needed) > capacity) {
+    unlock_writer();
+    return false;
+  }
+  if (header_->lag_policy == ShmLagPolicy::kOverwrite &&
+      head + needed > capacity) {
+    reclaim(head + needed - capacity);
+  }
+
+  if (remaining < frame) {
+    auto* pad = reinterpret_cast<FrameHeader*>(data_ + index);
+    pad->length = 0;
+    pad->flags = kFramePad;
+    pad->sequence = 0;
+    head += remaining;
+    index = 0;
+  }
+
+  auto* header = reinterpret_cast<FrameHeader*>(data_ + index);
+  header->length = static_cast<uint32_t>(length);
+  header->flags = 0;
+  header->sequence = header_->next_sequence++;
+  header->timestamp_ns = now_ns();
+  if (length > 0) {
+    std::memcpy(header + 1, data, length);
+  }
+  header_->head.store(head + frame, std::memory_order_release);
+  unlock_writer();
+
+  doorbell_->notify();
+  return true;
+}
+
+bool ShmRing::add_consumer(size_t consumer_id) {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot) {
+    return false;
+  }
+  bitmap_[consumer_id / kBitsPerWord].fetch_or(
+      uint64_t{1} << (consumer_id % kBitsPerWord), std::memory_order_acq_rel);
+  activate(slot);
+  return true;
+}
+
+// Takes the lowest free slot, or failing that the slot of a consumer whose
+// process has exited without deregistering.
+bool ShmRing::claim_consumer(size_t* consumer_id) {
+  if (!header_ || !consumer_id) {
+    return false;
+  }
+  size_t max_consumers = header_->max_consumers;
+  for (size_t word = 0; word < bitmap_words(max_consumers); ++word) {
+    uint64_t bits = bitmap_[word].load(std::memory_order_acquire);
+    while (~bits != 0) {
+      size_t bit = static_cast<size_t>(__builtin_ctzll(~bits));
+      size_t id = word * kBitsPerWord + bit;
+      if (id >= max_consumers) {
+        break;
+      }
+      if (bitmap_[word].compare_exchange_weak(bits, bits | (uint64_t{1} << bit),
+                                              std::memory_order_acq_rel)) {
+        activate(&cursors_[id]);
+        *consumer_id = id;
+        return true;
+      }
+    }
+  }
+
+  int32_t pid = static_cast<int32_t>(::getpid());
+  for (size_t id = 0; id < max_consumers; ++id) {
+    int32_t owner = cursors_[id].pid.load(std::memory_order_acquire);
+    if (!shm_process_alive(owner) &&
+        cursors_[id].pid.compare_exchange_strong(owner, pid,
+                                                 std::memory_order_acq_rel)) {
+      activate(&cursors_[id]);
+      *consumer_id = id;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ShmRing::activate(Cursor* slot) {
+  lock_writer();
+  slot->tail.store(header_->head.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  slot->pid.store(static_cast<int32_t>(::getpid()), std::memory_order_relaxed);
+  slot->heartbeat_ns.store(now_ns(), std::memory_order_relaxed);
+  slot->expected_sequence.store(header_->next_sequence,
+                                std::memory_order_relaxed);
+  slot->lost.store(0, std::memory_order_relaxed);
+  slot->evictions.store(0, std::memory_order_relaxed);
+  slot->state.store(kConsumerActive, std::memory_order_release);
+  header_->min_tail_valid = 0;
+  unlock_writer();
+}
+
+// Unlike add_consumer() this keeps the expected sequence, so the frames
+// published while the consumer was evicted show up as lost.
+bool ShmRing::rejoin_consumer(size_t consumer_id) {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot) {
+    return false;
+  }
+  lock_writer();
+  slot->tail.store(header_->head.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  slot->heartbeat_ns.store(now_ns(), std::memory_order_relaxed);
+  slot->state.store(kConsumerActive, std::memory_order_release);
+  header_->min_tail_valid = 0;
+  unlock_writer();
+  return true;
+}
+
+void ShmRing::remove_consumer(size_t consumer_id) {
+  Cursor* slot = cursor(consumer_id);
+  if (slot) {
+    slot->state.store(kConsumerFree, std::memory_order_release);
+    slot->pid.store(0, std::memory_order_relaxed);
+    bitmap_[consumer_id / kBitsPerWord].fetch_and(
+        ~(uint64_t{1} << (consumer_id % kBitsPerWord)),
+        std::memory_order_acq_rel);
+  }
+}
+
+bool ShmRing::evicted(size_t consumer_id) const {
+  Cursor* slot = cursor(consumer_id);
+  return slot &&
+         slot->state.load(std::memory_order_acquire) == kConsumerEvicted;
+}
+
+ShmConsumerStats ShmRing::consumer_stats(size_t consumer_id) const {
+  ShmConsumerStats stats;
+  Cursor* slot = cursor(consumer_id);
+  if (slot) {
+    stats.lost_messages = slot->lost.load(std::memory_order_relaxed);
+    stats.evictions = slot->evictions.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+bool ShmRing::peek(size_t consumer_id, ShmFrameView* view) {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot || !view ||
+      slot->state.load(std::memory_order_relaxed) != kConsumerActive) {
+    return false;
+  }
+  uint64_t tail = slot->tail.load(std::memory_order_relaxed);
+  while (true) {
+    if (tail == header_->head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    uint64_t floor = header_->floor.load(std::memory_order_acquire);
+    if (tail < floor) {
+      tail = floor;
+      slot->tail.store(tail, std::memory_order_release);
+      continue;
+    }
+    uint64_t start = tail;
+    const FrameHeader* frame =
+        frame_at(data_, header_->capacity, mask_, &start);
+    view->data = reinterpret_cast<const uint8_t*>(frame + 1);
+    view->size = frame->length;
+    view->timestamp_ns = frame->timestamp_ns;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->floor.load(std::memory_order_relaxed) <= tail) {
+      return true;
+    }
+  }
+}
+
+bool ShmRing::consume(size_t consumer_id) {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot) {
+    return false;
+  }
+  uint64_t tail = slot->tail.load(std::memory_order_relaxed);
+  if (tail == header_->head.load(std::memory_order_acquire)) {
+    return false;
+  }
+  uint64_t start = tail;
+  const FrameHeader* frame = frame_at(data_, header_->capacity, mask_, &start);
+  uint64_t length = frame->length;
+  uint64_t sequence = frame->sequence;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header_->floor.load(std::memory_order_relaxed) > tail) {
+    return false;
+  }
+
+  uint64_t expected = slot->expected_sequence.load(std::memory_order_relaxed);
+  if (sequence > expected) {
+    slot->lost.fetch_add(sequence - expected, std::memory_order_relaxed);
+  }
+  slot->expected_sequence.store(sequence + 1, std::memory_order_relaxed);
+  // A clock read costs about as much as the rest of consume(), so a reader
+  // that keeps up only refreshes its heartbeat every kHeartbeatFrames.
+  if (header_->heartbeat_timeout_ns > 0 &&
+      (sequence != expected || sequence % kHeartbeatFrames == 0)) {
+    slot->heartbeat_ns.store(now_ns(), std::memory_order_relaxed);
+  }
+  slot->tail.store(
+      start + shm_align_up(sizeof(FrameHeader) + length, kFrameAlign),
+      std::memory_order_release);
+  return true;
+}
+
+bool ShmRing::read(size_t consumer_id, std::vector<uint8_t>* bytes) {
+  ShmFrameView view;
+  while (bytes && peek(consumer_id, &view)) {
+    bytes->assign(view.data, view.data + view.size);
+    if (consume(consumer_id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ShmRing::wait(size_t consumer_id, std::chrono::microseconds timeout) {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot) {
+    return false;
+  }
+  touch_consumer(consumer_id);
+  uint32_t seq = doorbell_->arm();
+  bool ready = readable(consumer_id);
+  if (!ready) {
+    doorbell_->sleep(seq, timeout);
+    ready = readable(consumer_id);
+  }
+  touch_consumer(consumer_id);
+  return ready;
+}
+
+bool ShmRing::readable(size_t consumer_id) const {
+  Cursor* slot = cursor(consumer_id);
+  if (!slot) {
+    return false;
+  }
+  return slot->state.load(std::memory_order_relaxed) != kConsumerActive ||
+         slot->tail.load(std::memory_order_relaxed) !=
+             header_->head.load(std::memory_order_seq_cst);
+}
+
+void ShmRing::touch_consumer(size_t consumer_id) {
+  Cursor* slot = cursor(consumer_id);
+  if (slot) {
+    slot->heartbeat_ns.store(now_ns(), std::memory_order_relaxed);
+  }
+}
+
+void ShmRing::notify_all() {
+  if (doorbell_) {
+    doorbell_->ring();
+  }
+}
+
+ShmRing::Cursor* ShmRing::cursor(size_t consumer_id) const {
+  if (!header_ || consumer_id >= header_->max_consumers) {
+    return nullptr;
+  }
+  return &cursors_[consumer_id];
+}
+
+// Returns the oldest tail the producer still has to respect when advancing
+// the head to |next_head|. Consumers past the lag limit are evicted or left
+// to be overwritten according to the ring policy; dead consumers are evicted
+// whenever they would otherwise hold the producer back.
+//
+// Tails only move forward and (re)joining consumers invalidate the cache, so
+// the minimum from the last scan stays a lower bound on every tail. While the
+// head is within the lag limit of it, no consumer can be over the limit or
+// short of space and the registry is not scanned at all.
+uint64_t ShmRing::admit(uint64_t head, uint64_t next_head) {
+  uint64_t lag_limit = header_->lag_limit;
+  if (header_->min_tail_valid && next_head - header_->min_tail <= lag_limit) {
+    return header_->min_tail;
+  }
+
+  uint64_t result = head;
+  uint64_t capacity = header_->capacity;
+  ShmLagPolicy policy = header_->lag_policy;
+  int64_t now = 0;
+  bool skipped_laggard = false;
+
+  for (size_t word = 0; word < bitmap_words(header_->max_consumers); ++word) {
+    uint64_t bits = bitmap_[word].load(std::memory_order_acquire);
+    while (bits != 0) {
+      size_t i = word * kBitsPerWord +
+                 static_cast<size_t>(__builtin_ctzll(bits));
+      bits &= bits - 1;
+      Cursor& slot = cursors_[i];
+      if (slot.state.load(std::memory_order_acquire) != kConsumerActive) {
+        continue;
+      }
+      uint64_t tail = slot.tail.load(std::memory_order_acquire);
+      uint64_t lag = next_head - tail;
+      bool over_limit = lag > lag_limit;
+      bool blocking = lag > capacity;
+      if (over_limit || blocking) {
+        if (now == 0) {
+          now = now_ns();
+        }
+        if (policy == ShmLagPolicy::kEvict || !consumer_alive(slot, now)) {
+          slot.state.store(kConsumerEvicted, std::memory_order_release);
+          slot.evictions.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        if (policy == ShmLagPolicy::kOverwrite) {
+          skipped_laggard = true;
+          continue;
+        }
+      }
+      if (tail < result) {
+        result = tail;
+      }
+    }
+  }
+  header_->min_tail = result;
+  header_->min_tail_valid = skipped_laggard ? 0 : 1;
+  return result;
+}
+
+bool ShmRing::consumer_alive(const Cursor& slot, int64_t now) const {
+  int64_t timeout = header_->heartbeat_timeout_ns;
+  if (timeout > 0 &&
+      now - slot.heartbeat_ns.load(std::memory_order_relaxed) > timeout) {
+    return false;
+  }
+  if (header_->reap_dead_consumers &&
+      !shm_process_alive(slot.pid.load(std::memory_order_relaxed))) {
+    return false;
+  }
+  return true;
+}
+
+// Advances the floor frame by frame until it reaches |target|. The floor is
+// published before the reclaimed bytes are reused so readers can detect that
+// a frame they were viewing has been overwritten.
+void ShmRing::reclaim(uint64_t target) {
+  uint64_t floor = header_->floor.load(std::memory_order_relaxed);
+  if (floor >= target) {
+    return;
+  }
+  while (floor < target) {
+    const FrameHeader* frame = frame_at(data_, header_->capacity, mask_, &floor);
+    floor += shm_align_up(sizeof(FrameHeader) + frame->length, kFrameAlign);
+  }
+  header_->floor.store(floor, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+// A process that dies holding the lock never releases it, so once the
+// spinning phase is over a waiter checks the holder's pid and takes the lock
+// over from a dead one. The dead writer's frame was never published (head
+// moves last), so the new holder simply writes over it.
+void ShmRing::lock_writer() {
+  int spins = 0;
+  while (true) {
+    uint32_t owner = 0;
+    if (header_->writer_lock.compare_exchange_weak(
+            owner, writer_pid_, std::memory_order_acquire,
+            std::memory_order_relaxed)) {
+      return;
+    }
+    while (owner != 0) {
+      if (++spins < kWriterSpinsBeforeYield) {
+        shm_cpu_relax();
+      } else {
+        if (spins % kWriterSpinsBeforeYield == 0 &&
+            !shm_process_alive(static_cast<int32_t>(owner)) &&
+            header_->writer_lock.compare_exchange_strong(
+                owner, writer_pid_, std::memory_order_acquire,
+                std::memory_order_relaxed)) {
+          header_->min_tail_valid = 0;
+          return;
+        }
+        std::this_thread::yield();
+      }
+      owner = header_->writer_lock.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void ShmRing::unlock_writer() {
+  header_->writer_lock.store(0, std::memory_order_release);
+}
+
+}  // namespace ipc
+}  // namespace rtos
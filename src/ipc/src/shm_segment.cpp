@@ -0,0 +1,338 @@
+#include "../include/ipc/shm_segment.h"
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <new>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kSegmentMagic = 0x53474D31;  // "SGM1"
+constexpr uint32_t kSegmentVersion = 1;
+
+constexpr uint32_t kProducerFree = 0;
+constexpr uint32_t kProducerClaimed = 1;
+
+constexpr int kSpinsPerClockCheck = 64;
+
+}  // namespace
+
+struct ShmSegment::Header {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint64_t max_producers;
+  uint64_t ring_capacity;
+  uint64_t ring_stride;
+
+  ShmDoorbell doorbell;
+};
+
+struct alignas(kShmCacheLine) ShmSegment::ProducerSlot {
+  std::atomic<uint32_t> state;
+  std::atomic<int32_t> pid;
+};
+
+size_t ShmSegment::header_bytes(size_t max_producers) {
+  return shm_align_up(sizeof(Header), kShmCacheLine) +
+         max_producers * sizeof(ProducerSlot);
+}
+
+size_t ShmSegment::ring_stride(size_t ring_capacity, size_t max_consumers) {
+  return shm_align_up(ShmRing::segment_size(ring_capacity, max_consumers),
+                  kShmCacheLine);
+}
+
+size_t ShmSegment::segment_size(size_t ring_capacity, size_t max_producers,
+                                size_t max_consumers) {
+  return header_bytes(max_producers) +
+         max_producers * ring_stride(ring_capacity, max_consumers);
+}
+
+bool ShmSegment::create(void* memory, size_t segment_bytes,
+                        size_t ring_capacity, size_t max_producers,
+                        size_t max_consumers, const ShmRingPolicy& policy) {
+  if (!memory || max_producers == 0 ||
+      segment_bytes <
+          segment_size(ring_capacity, max_producers, max_consumers)) {
+    return false;
+  }
+
+  auto* header = new (memory) Header();
+  header->magic.store(0, std::memory_order_relaxed);
+  header->version = kSegmentVersion;
+  header->max_producers = max_producers;
+  header->ring_capacity = ring_capacity;
+  header->ring_stride = ring_stride(ring_capacity, max_consumers);
+
+  auto* base = static_cast<uint8_t*>(memory);
+  auto* producers = reinterpret_cast<ProducerSlot*>(
+      base + shm_align_up(sizeof(Header), kShmCacheLine));
+  for (size_t i = 0; i < max_producers; ++i) {
+    auto* slot = new (&producers[i]) ProducerSlot();
+    slot->state.store(kProducerFree, std::memory_order_relaxed);
+    slot->pid.store(0, std::memory_order_relaxed);
+
+    ShmRing ring;
+    if (!ring.create(base + header_bytes(max_producers) +
+                         i * header->ring_stride,
+                     header->ring_stride, max_consumers, policy)) {
+      return false;
+    }
+  }
+
+  header->magic.store(kSegmentMagic, std::memory_order_release);
+  return attach(memory, segment_bytes);
+}
+
+bool ShmSegment::attach(void* memory, size_t segment_bytes) {
+  if (!memory || segment_bytes < sizeof(Header)) {
+    return false;
+  }
+  auto* header = static_cast<Header*>(memory);
+  if (header->magic.load(std::memory_order_acquire) != kSegmentMagic ||
+      header->version != kSegmentVersion) {
+    return false;
+  }
+  size_t max_producers = header->max_producers;
+  if (header_bytes(max_producers) + max_producers * header->ring_stride >
+      segment_bytes) {
+    return false;
+  }
+
+  auto* base = static_cast<uint8_t*>(memory);
+  rings_.assign(max_producers, ShmRing());
+  for (size_t i = 0; i < max_producers; ++i) {
+    if (!rings_[i].attach(
+            base + header_bytes(max_producers) + i * header->ring_stride,
+            header->ring_stride)) {
+      rings_.clear();
+      return false;
+    }
+    rings_[i].set_doorbell(&header->doorbell);
+  }
+  header_ = header;
+  producers_ = reinterpret_cast<ProducerSlot*>(
+      base + shm_align_up(sizeof(Header), kShmCacheLine));
+  doorbell_ = &header->doorbell;
+  return true;
+}
+
+void ShmSegment::detach() {
+  release_producer();
+  rings_.clear();
+  header_ = nullptr;
+  producers_ = nullptr;
+  doorbell_ = nullptr;
+  next_ring_ = 0;
+  current_ring_ = 0;
+}
+
+// Takes a free sub-ring, or one whose owner process has exited. When every
+// sub-ring has a live owner the producer shares one; the ring's writer lock
+// keeps that correct at the cost of contention.
+bool ShmSegment::claim_producer() {
+  std::lock_guard<std::mutex> lock(producer_mutex_);
+  if (!header_) {
+    return false;
+  }
+  if (producer_ring_.load(std::memory_order_relaxed) >= 0) {
+    return true;
+  }
+
+  int32_t pid = static_cast<int32_t>(::getpid());
+  for (size_t i = 0; i < rings_.size(); ++i) {
+    uint32_t expected = kProducerFree;
+    if (producers_[i].state.compare_exchange_strong(
+            expected, kProducerClaimed, std::memory_order_acq_rel)) {
+      producers_[i].pid.store(pid, std::memory_order_release);
+      owns_producer_slot_ = true;
+      producer_ring_.store(static_cast<int>(i), std::memory_order_release);
+      return true;
+    }
+  }
+  for (size_t i = 0; i < rings_.size(); ++i) {
+    int32_t owner = producers_[i].pid.load(std::memory_order_acquire);
+    if (!shm_process_alive(owner) &&
+        producers_[i].pid.compare_exchange_strong(owner, pid,
+                                                  std::memory_order_acq_rel)) {
+      owns_producer_slot_ = true;
+      producer_ring_.store(static_cast<int>(i), std::memory_order_release);
+      return true;
+    }
+  }
+
+  owns_producer_slot_ = false;
+  producer_ring_.store(
+      static_cast<int>(static_cast<size_t>(pid) % rings_.size()),
+      std::memory_order_release);
+  return true;
+}
+
+void ShmSegment::release_producer() {
+  std::lock_guard<std::mutex> lock(producer_mutex_);
+  int ring = producer_ring_.load(std::memory_order_relaxed);
+  if (ring >= 0 && owns_producer_slot_ && producers_) {
+    producers_[ring].pid.store(0, std::memory_order_relaxed);
+    producers_[ring].state.store(kProducerFree, std::memory_order_release);
+  }
+  producer_ring_.store(-1, std::memory_order_relaxed);
+  owns_producer_slot_ = false;
+}
+
+bool ShmSegment::shares_producer_ring() const {
+  std::lock_guard<std::mutex> lock(producer_mutex_);
+  return producer_ring_.load(std::memory_order_relaxed) >= 0 &&
+         !owns_producer_slot_;
+}
+
+bool ShmSegment::write(const uint8_t* data, size_t length) {
+  int ring = producer_ring_.load(std::memory_order_acquire);
+  if (ring < 0) {
+    if (!claim_producer()) {
+      return false;
+    }
+    ring = producer_ring_.load(std::memory_order_acquire);
+  }
+  return rings_[ring].write(data, length);
+}
+
+bool ShmSegment::add_consumer(size_t consumer_id) {
+  if (rings_.empty()) {
+    return false;
+  }
+  for (auto& ring : rings_) {
+    if (!ring.add_consumer(consumer_id)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShmSegment::claim_consumer(size_t* consumer_id) {
+  if (rings_.empty() || !rings_[0].claim_consumer(consumer_id)) {
+    return false;
+  }
+  for (size_t i = 1; i < rings_.size(); ++i) {
+    if (!rings_[i].add_consumer(*consumer_id)) {
+      remove_consumer(*consumer_id);
+      return false;
+    }
+  }
+  return true;
+}
+
+void ShmSegment::remove_consumer(size_t consumer_id) {
+  for (auto& ring : rings_) {
+    ring.remove_consumer(consumer_id);
+  }
+}
+
+ShmConsumerStats ShmSegment::consumer_stats(size_t consumer_id) const {
+  ShmConsumerStats total;
+  for (const auto& ring : rings_) {
+    ShmConsumerStats stats = ring.consumer_stats(consumer_id);
+    total.lost_messages += stats.lost_messages;
+    total.evictions += stats.evictions;
+  }
+  return total;
+}
+
+// An evicted consumer rejoins each sub-ring at its head. The eviction and
+// the frames it skipped show up in consumer_stats(), not here.
+bool ShmSegment::peek(size_t consumer_id, ShmMergeOrder order,
+                      ShmFrameView* view) {
+  if (!view || rings_.empty()) {
+    return false;
+  }
+
+  bool found = false;
+  size_t count = rings_.size();
+  for (size_t step = 0; step < count; ++step) {
+    size_t index = (next_ring_ + step) % count;
+    ShmRing& ring = rings_[index];
+    if (ring.evicted(consumer_id)) {
+      ring.rejoin_consumer(consumer_id);
+    }
+    ShmFrameView candidate;
+    if (!ring.peek(consumer_id, &candidate)) {
+      continue;
+    }
+    if (!found || candidate.timestamp_ns < view->timestamp_ns) {
+      *view = candidate;
+      current_ring_ = index;
+      found = true;
+    }
+    if (order == ShmMergeOrder::kRoundRobin) {
+      break;
+    }
+  }
+  if (found) {
+    next_ring_ = (current_ring_ + 1) % count;
+  }
+  return found;
+}
+
+bool ShmSegment::consume(size_t consumer_id) {
+  if (current_ring_ >= rings_.size()) {
+    return false;
+  }
+  return rings_[current_ring_].consume(consumer_id);
+}
+
+bool ShmSegment::readable(size_t consumer_id) {
+  bool ready = false;
+  for (auto& ring : rings_) {
+    ring.touch_consumer(consumer_id);
+    ready = ready || ring.readable(consumer_id);
+  }
+  return ready;
+}
+
+// Polls the sub-ring heads for up to |budget| without entering the kernel.
+bool ShmSegment::spin(size_t consumer_id, std::chrono::microseconds budget) {
+  for (auto& ring : rings_) {
+    ring.touch_consumer(consumer_id);
+  }
+  auto deadline = std::chrono::steady_clock::now() + budget;
+  while (true) {
+    for (int i = 0; i < kSpinsPerClockCheck; ++i) {
+      for (const auto& ring : rings_) {
+        if (ring.readable(consumer_id)) {
+          return true;
+        }
+      }
+      shm_cpu_relax();
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+  }
+}
+
+bool ShmSegment::wait(size_t consumer_id, std::chrono::microseconds timeout) {
+  if (!header_) {
+    return false;
+  }
+  ShmDoorbell& doorbell = *doorbell_;
+  uint32_t seq = doorbell.arm();
+  bool ready = readable(consumer_id);
+  if (!ready) {
+    doorbell.sleep(seq, timeout);
+  }
+  for (auto& ring : rings_) {
+    ring.touch_consumer(consumer_id);
+  }
+  return ready;
+}
+
+void ShmSegment::notify_all() {
+  if (doorbell_) {
+    doorbell_->ring();
+  }
+}
+
+}  // namespace ipc
+}  // namespace rtos
@@ -1,11 +1,22 @@
 #include "../include/ipc/shm_transport.h"
 
+#include "../include/ipc/ipc_reactor.h"
+
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
 
 namespace rtos {
@@ -13,7 +24,11 @@ namespace ipc {
 
 namespace {
 
-constexpr size_t kMaxConsumers = 8;
+constexpr size_t kMaxMutexConsumers = 8;
+constexpr std::chrono::microseconds kReceiveWaitSlice{100000};
+constexpr std::chrono::microseconds kFallbackWaitSlice{1000};
+constexpr size_t kReceiveBatch = 64;
+constexpr int kSpinsPerClockCheck = 64;
 
 struct ShmRingBuffer {
   pthread_mutex_t mutex;
@@ -23,8 +38,8 @@ struct ShmRingBuffer {
   size_t head;
   size_t tail;
   size_t max_consumers;
-  size_t tails[kMaxConsumers];
-  uint8_t active[kMaxConsumers];
+  size_t tails[kMaxMutexConsumers];
+  uint8_t active[kMaxMutexConsumers];
   uint8_t data[1];
 };
 
@@ -36,16 +51,30 @@ size_t aligned_size(size_t value) {
   return (value + (kAlign - 1)) & ~(kAlign - 1);
 }
 
+size_t ring_size(const ShmRingBuffer* ring, size_t tail) {
+  size_t head = ring->head;
+  size_t capacity = ring->capacity;
+  if (head >= tail) {
+    return head - tail;
+  }
+  return capacity - (tail - head);
+}
+
+// Tails wrap with the head, so the slowest consumer is the one with the most
+// unread bytes rather than the numerically smallest tail.
 size_t ring_min_tail(const ShmRingBuffer* ring) {
   size_t min_tail = ring->head;
-  bool found = false;
+  size_t max_unread = 0;
   for (size_t i = 0; i < ring->max_consumers; ++i) {
     if (ring->active[i]) {
-      min_tail = found ? std::min(min_tail, ring->tails[i]) : ring->tails[i];
-      found = true;
+      size_t unread = ring_size(ring, ring->tails[i]);
+      if (unread > max_unread) {
+        max_unread = unread;
+        min_tail = ring->tails[i];
+      }
     }
   }
-  return found ? min_tail : ring->head;
+  return min_tail;
 }
 
 bool ring_has_space(const ShmRingBuffer* ring, size_t needed) {
@@ -58,15 +87,6 @@ bool ring_has_space(const ShmRingBuffer* ring, size_t needed) {
   return (tail - head - 1) >= needed;
 }
 
-size_t ring_size(const ShmRingBuffer* ring, size_t tail) {
-  size_t head = ring->head;
-  size_t capacity = ring->capacity;
-  if (head >= tail) {
-    return head - tail;
-  }
-  return capacity - (tail - head);
-}
-
 void ring_write(ShmRingBuffer* ring, const uint8_t* data, size_t length) {
   size_t capacity = ring->capacity;
   size_t head = ring->head;
@@ -89,6 +109,126 @@ void ring_read(ShmRingBuffer* ring, size_t* tail, uint8_t* data, size_t length)
   *tail = (local_tail + length) % capacity;
 }
 
+size_t mapping_page_size(int fd, bool hugetlbfs) {
+  struct statfs fs {};
+  if (hugetlbfs && ::fstatfs(fd, &fs) == 0 && fs.f_bsize > 0) {
+    return static_cast<size_t>(fs.f_bsize);
+  }
+  return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+size_t round_up(size_t value, size_t align) {
+  return ((value + align - 1) / align) * align;
+}
+
+bool bind_numa_node(void* addr, size_t length, int node) {
+#if defined(__linux__)
+  constexpr size_t kBitsPerWord = sizeof(unsigned long) * CHAR_BIT;
+  std::vector<unsigned long> mask(static_cast<size_t>(node) / kBitsPerWord + 1,
+                                  0);
+  mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+  return ::syscall(SYS_mbind, addr, length, MPOL_BIND, mask.data(),
+                   mask.size() * kBitsPerWord + 1, 0) == 0;
+#else
+  (void)addr;
+  (void)length;
+  (void)node;
+  return false;
+#endif
+}
+
+void prefault_pages(void* addr, size_t length, size_t page_size) {
+#if defined(MADV_POPULATE_WRITE)
+  if (::madvise(addr, length, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  auto* bytes = static_cast<volatile uint8_t*>(addr);
+  for (size_t offset = 0; offset < length; offset += page_size) {
+    (void)bytes[offset];
+  }
+}
+
+// Placement policy has to be set before the pages are first touched, and
+// mlock() after prefaulting so it does not fault them in one at a time.
+// Returns whether the mapping is locked.
+bool harden_mapping(const ShmTransportConfig& config, void* addr,
+                    size_t length, size_t page_size, bool* numa_bound) {
+  if (config.huge_pages && config.hugetlbfs_path.empty()) {
+#if defined(MADV_HUGEPAGE)
+    ::madvise(addr, length, MADV_HUGEPAGE);
+#endif
+  }
+  *numa_bound = config.numa_node >= 0 &&
+                bind_numa_node(addr, length, config.numa_node);
+  if (config.prefault || config.lock_memory) {
+    prefault_pages(addr, length, page_size);
+  }
+  return config.lock_memory && ::mlock(addr, length) == 0;
+}
+
+int open_segment(const ShmTransportConfig& config, const std::string& name,
+                 int flags) {
+  if (config.hugetlbfs_path.empty()) {
+    return ::shm_open(name.c_str(), flags, 0666);
+  }
+  return ::open((config.hugetlbfs_path + name).c_str(), flags, 0666);
+}
+
+void unlink_segment(const ShmTransportConfig& config, const std::string& name) {
+  if (config.hugetlbfs_path.empty()) {
+    ::shm_unlink(name.c_str());
+  } else {
+    ::unlink((config.hugetlbfs_path + name).c_str());
+  }
+}
+
+// Opens and maps |name|. The creator sizes it to |bytes| rounded up to the
+// page size; everyone else maps it at the size the creator chose.
+bool map_segment(const ShmTransportConfig& config, const std::string& name,
+                 bool create, size_t bytes, int* fd, void** ptr, size_t* size,
+                 bool* locked, bool* numa_bound) {
+  *fd = open_segment(config, name, create ? O_RDWR | O_CREAT : O_RDWR);
+  if (*fd < 0) {
+    return false;
+  }
+  size_t page_size = mapping_page_size(*fd, !config.hugetlbfs_path.empty());
+  struct stat info {};
+  if (create) {
+    bytes = round_up(bytes, page_size);
+    if (::ftruncate(*fd, static_cast<off_t>(bytes)) != 0) {
+      return false;
+    }
+  } else if (::fstat(*fd, &info) == 0 && info.st_size > 0) {
+    bytes = static_cast<size_t>(info.st_size);
+  } else {
+    return false;
+  }
+
+  void* mapping =
+      ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  *ptr = mapping;
+  *size = bytes;
+  *locked = harden_mapping(config, mapping, bytes, page_size, numa_bound);
+  return true;
+}
+
+std::string channel_name(const ShmTransportConfig& config, size_t index) {
+  return config.name + ".ch" + std::to_string(index);
+}
+
+ShmRingPolicy ring_policy(const ShmTransportConfig& config) {
+  ShmRingPolicy policy;
+  policy.lag_policy = config.lag_policy;
+  policy.lag_limit_bytes = config.lag_limit_bytes;
+  policy.heartbeat_timeout = config.heartbeat_timeout;
+  policy.reap_dead_consumers = config.reap_dead_consumers;
+  return policy;
+}
+
 void init_ring(ShmRingBuffer* ring, size_t capacity, size_t max_consumers) {
   pthread_mutexattr_t mutex_attr;
   pthread_mutexattr_init(&mutex_attr);
@@ -106,7 +246,7 @@ void init_ring(ShmRingBuffer* ring, size_t capacity, size_t max_consumers) {
   ring->capacity = capacity;
   ring->head = 0;
   ring->tail = 0;
-  ring->max_consumers = std::min(max_consumers, kMaxConsumers);
+  ring->max_consumers = std::min(max_consumers, kMaxMutexConsumers);
   for (size_t i = 0; i < ring->max_consumers; ++i) {
     ring->tails[i] = 0;
     ring->active[i] = 0;
@@ -115,9 +255,32 @@ void init_ring(ShmRingBuffer* ring, size_t capacity, size_t max_consumers) {
 
 }  // namespace
 
+struct ShmTransport::Channel {
+  int fd = -1;
+  void* ptr = nullptr;
+  size_t size = 0;
+  bool locked = false;
+  bool numa_bound = false;
+  ShmSegment segment;
+  size_t consumer_id = kShmAutoConsumerId;
+  size_t topics = 0;
+  bool registered = false;
+  std::atomic<bool> receiving{false};
+
+  ~Channel() {
+    segment.detach();
+    if (ptr) {
+      ::munmap(ptr, size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+};
+
 ShmTransport::ShmTransport(ShmTransportConfig config)
     : config_(std::move(config)),
-      consumer_id_(std::min(config_.consumer_id, kMaxConsumers - 1)) {}
+      consumer_id_(config_.consumer_id) {}
 
 ShmTransport::~ShmTransport() {
   stop();
@@ -126,30 +289,51 @@ ShmTransport::~ShmTransport() {
 void ShmTransport::start(TransportReceiveHandler handler) {
   handler_ = std::move(handler);
   running_.store(true);
-
-  int flags = O_RDWR;
-  if (config_.is_owner) {
-    flags |= O_CREAT;
+  if (config_.per_topic_channels) {
+    start_channels();
+    return;
   }
-  shm_fd_ = ::shm_open(config_.name.c_str(), flags, 0666);
-  if (shm_fd_ < 0) {
-    running_.store(false);
+
+  size_t max_consumers = config_.ring == ShmRingKind::kLockFree
+                             ? std::max<size_t>(config_.max_consumers, 1)
+                             : std::min(config_.max_consumers, kMaxMutexConsumers);
+  size_t total_size =
+      config_.ring == ShmRingKind::kLockFree
+          ? ShmSegment::segment_size(config_.size_bytes,
+                                     std::max<size_t>(config_.max_producers, 1),
+                                     max_consumers)
+          : aligned_size(kHeaderSize + config_.size_bytes);
+  bool numa_bound = false;
+  if (!map_segment(config_, config_.name, config_.is_owner, total_size,
+                   &shm_fd_, &shm_ptr_, &shm_size_, &memory_locked_,
+                   &numa_bound)) {
+    stop();
     return;
   }
 
-  size_t total_size = aligned_size(kHeaderSize + config_.size_bytes);
-  if (config_.is_owner) {
-    if (::ftruncate(shm_fd_, static_cast<off_t>(total_size)) != 0) {
+  numa_bound_.store(numa_bound);
+
+  if (config_.ring == ShmRingKind::kLockFree) {
+    bool attached =
+        config_.is_owner
+            ? segment_.create(shm_ptr_, shm_size_, config_.size_bytes,
+                              std::max<size_t>(config_.max_producers, 1),
+                              max_consumers, ring_policy(config_))
+            : segment_.attach(shm_ptr_, shm_size_);
+    if (!attached) {
       stop();
       return;
     }
-  }
-
-  shm_ptr_ = ::mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                    shm_fd_, 0);
-  if (shm_ptr_ == MAP_FAILED) {
-    shm_ptr_ = nullptr;
-    stop();
+    if (config_.receive) {
+      bool registered = consumer_id_ == kShmAutoConsumerId
+                            ? segment_.claim_consumer(&consumer_id_)
+                            : segment_.add_consumer(consumer_id_);
+      if (!registered) {
+        stop();
+        return;
+      }
+      start_receiver();
+    }
     return;
   }
 
@@ -158,8 +342,20 @@ void ShmTransport::start(TransportReceiveHandler handler) {
     init_ring(ring, config_.size_bytes, config_.max_consumers);
   }
 
+  if (!config_.receive) {
+    return;
+  }
+
   {
     pthread_mutex_lock(&ring->mutex);
+    if (consumer_id_ == kShmAutoConsumerId) {
+      consumer_id_ = 0;
+      while (consumer_id_ + 1 < ring->max_consumers &&
+             ring->active[consumer_id_]) {
+        ++consumer_id_;
+      }
+    }
+    consumer_id_ = std::min(consumer_id_, kMaxMutexConsumers - 1);
     if (consumer_id_ < ring->max_consumers) {
       ring->active[consumer_id_] = 1;
       ring->tails[consumer_id_] = ring->head;
@@ -174,8 +370,20 @@ void ShmTransport::stop() {
   if (!running_.exchange(false)) {
     return;
   }
+  if (in_reactor_) {
+    config_.reactor->remove_shm(this);
+    in_reactor_ = false;
+  }
 
-  if (shm_ptr_) {
+  if (directory_.valid()) {
+    wake_.ring();
+  } else if (segment_.valid()) {
+    if (config_.receive) {
+      segment_.remove_consumer(consumer_id_);
+    }
+    segment_.notify_all();
+  } else if (shm_ptr_ && config_.ring == ShmRingKind::kMutex &&
+             config_.receive) {
     auto* ring = reinterpret_cast<ShmRingBuffer*>(shm_ptr_);
     pthread_mutex_lock(&ring->mutex);
     if (consumer_id_ < ring->max_consumers) {
@@ -191,17 +399,21 @@ void ShmTransport::stop() {
     receiver_thread_.join();
   }
 
+  stop_channels();
+  segment_.detach();
   if (shm_ptr_) {
-    size_t total_size = aligned_size(kHeaderSize + config_.size_bytes);
-    ::munmap(shm_ptr_, total_size);
+    ::munmap(shm_ptr_, shm_size_);
     shm_ptr_ = nullptr;
+    shm_size_ = 0;
   }
   if (shm_fd_ >= 0) {
     ::close(shm_fd_);
     shm_fd_ = -1;
   }
+  memory_locked_ = false;
+  numa_bound_.store(false);
   if (config_.is_owner) {
-    ::shm_unlink(config_.name.c_str());
+    unlink_segment(config_, config_.name);
   }
 }
 
@@ -209,17 +421,353 @@ bool ShmTransport::publish(const std::vector<uint8_t>& bytes) {
   if (!running_.load()) {
     return false;
   }
+  if (config_.per_topic_channels) {
+    return publish_topic(std::string(), bytes);
+  }
   return write_frame(bytes);
 }
 
+bool ShmTransport::publish_topic(const std::string& topic,
+                                 const std::vector<uint8_t>& bytes) {
+  if (!config_.per_topic_channels) {
+    return publish(bytes);
+  }
+  if (!running_.load()) {
+    return false;
+  }
+  // Channels live until stop(), so only the lookup needs the lock.
+  Channel* target = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(channels_mutex_);
+    target = channel(topic);
+  }
+  return target && target->segment.write(bytes.data(), bytes.size());
+}
+
+void ShmTransport::subscribe_topic(const std::string& topic) {
+  if (!config_.per_topic_channels || !config_.receive || !running_.load()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  Channel* target = channel(topic);
+  if (!target || target->topics++ > 0) {
+    return;
+  }
+  if (!target->registered) {
+    target->consumer_id = config_.consumer_id;
+    target->registered =
+        target->consumer_id == kShmAutoConsumerId
+            ? target->segment.claim_consumer(&target->consumer_id)
+            : target->segment.add_consumer(target->consumer_id);
+    if (!target->registered) {
+      target->topics = 0;
+      return;
+    }
+  }
+  target->receiving.store(true, std::memory_order_release);
+  channels_version_.fetch_add(1, std::memory_order_release);
+  wake_.ring();
+}
+
+// The receiver deregisters from the channel itself, so it never consumes from
+// a slot that has already been handed to another reader.
+void ShmTransport::unsubscribe_topic(const std::string& topic) {
+  if (!config_.per_topic_channels || !config_.receive) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  auto it = topic_channels_.find(topic);
+  if (it == topic_channels_.end() || it->second->topics == 0) {
+    return;
+  }
+  if (--it->second->topics == 0) {
+    it->second->receiving.store(false, std::memory_order_release);
+    channels_version_.fetch_add(1, std::memory_order_release);
+    wake_.ring();
+  }
+}
+
+size_t ShmTransport::channel_count() const {
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  return channels_.size();
+}
+
+ShmConsumerStats ShmTransport::consumer_stats() const {
+  return segment_.consumer_stats(consumer_id_);
+}
+
+void ShmTransport::start_channels() {
+  size_t max_channels = std::max<size_t>(config_.max_channels, 1);
+  bool numa_bound = false;
+  if (!map_segment(config_, config_.name, config_.is_owner,
+                   ShmDirectory::segment_size(max_channels), &shm_fd_,
+                   &shm_ptr_, &shm_size_, &memory_locked_, &numa_bound)) {
+    stop();
+    return;
+  }
+  numa_bound_.store(numa_bound);
+  bool attached = config_.is_owner
+                      ? directory_.create(shm_ptr_, shm_size_, max_channels)
+                      : directory_.attach(shm_ptr_, shm_size_);
+  if (!attached) {
+    stop();
+    return;
+  }
+  if (config_.receive) {
+    // Untagged publishes travel on the channel with the empty key.
+    subscribe_topic(std::string());
+    start_receiver();
+  }
+}
+
+void ShmTransport::stop_channels() {
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  for (auto& entry : channels_) {
+    Channel& target = *entry.second;
+    if (target.registered) {
+      target.segment.remove_consumer(target.consumer_id);
+    }
+  }
+  if (config_.is_owner) {
+    for (size_t i = 0; i < directory_.max_channels(); ++i) {
+      if (directory_.ready(i)) {
+        unlink_segment(config_, channel_name(config_, i));
+      }
+    }
+  }
+  active_channels_.clear();
+  active_version_ = UINT64_MAX;
+  channels_.clear();
+  topic_channels_.clear();
+  directory_.detach();
+}
+
+// Resolves |topic| to its channel, creating the channel segment if no process
+// has published or subscribed to it yet. Called with channels_mutex_ held.
+ShmTransport::Channel* ShmTransport::channel(const std::string& topic) {
+  auto cached = topic_channels_.find(topic);
+  if (cached != topic_channels_.end()) {
+    return cached->second;
+  }
+
+  std::string key = topic;
+  size_t ring_bytes = config_.size_bytes;
+  for (const auto& group : config_.channel_groups) {
+    if (std::find(group.topics.begin(), group.topics.end(), topic) !=
+        group.topics.end()) {
+      key = group.name;
+      ring_bytes = group.size_bytes > 0 ? group.size_bytes : ring_bytes;
+      break;
+    }
+  }
+
+  auto& slot = channels_[key];
+  if (!slot) {
+    auto created = std::make_unique<Channel>();
+    Channel* target = created.get();
+    size_t producers = std::max<size_t>(config_.max_producers, 1);
+    size_t consumers = std::max<size_t>(config_.max_consumers, 1);
+    int index = directory_.find_or_add(key, [&](size_t i) {
+      return map_segment(config_, channel_name(config_, i), true,
+                         ShmSegment::segment_size(ring_bytes, producers,
+                                                  consumers),
+                         &target->fd, &target->ptr, &target->size,
+                         &target->locked, &target->numa_bound) &&
+             target->segment.create(target->ptr, target->size, ring_bytes,
+                                    producers, consumers,
+                                    ring_policy(config_));
+    });
+    bool ready =
+        index >= 0 &&
+        (target->segment.valid() ||
+         (map_segment(config_, channel_name(config_, index), false, 0,
+                      &target->fd, &target->ptr, &target->size,
+                      &target->locked, &target->numa_bound) &&
+          target->segment.attach(target->ptr, target->size)));
+    if (!ready) {
+      channels_.erase(key);
+      return nullptr;
+    }
+    if (!target->numa_bound) {
+      numa_bound_.store(false);
+    }
+    slot = std::move(created);
+  }
+  topic_channels_[topic] = slot.get();
+  return slot.get();
+}
+
+void ShmTransport::refresh_channels() {
+  std::lock_guard<std::mutex> lock(channels_mutex_);
+  active_channels_.clear();
+  for (auto& entry : channels_) {
+    Channel& target = *entry.second;
+    if (target.receiving.load(std::memory_order_acquire)) {
+      active_channels_.push_back(&target);
+    } else if (target.registered) {
+      target.segment.remove_consumer(target.consumer_id);
+      target.registered = false;
+    }
+  }
+}
+
+bool ShmTransport::channels_ready() {
+  if (channels_version_.load(std::memory_order_acquire) != active_version_) {
+    return true;
+  }
+  bool ready = false;
+  for (Channel* target : active_channels_) {
+    ready = target->segment.readable(target->consumer_id) || ready;
+  }
+  return ready;
+}
+
+bool ShmTransport::spin_channels(std::chrono::microseconds budget) {
+  auto deadline = std::chrono::steady_clock::now() + budget;
+  while (running_.load(std::memory_order_relaxed)) {
+    for (int i = 0; i < kSpinsPerClockCheck; ++i) {
+      if (channels_ready()) {
+        return true;
+      }
+      shm_cpu_relax();
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Each channel segment has its own doorbell, so publishers on one channel do
+// not wake readers of the others. The receiver sleeps on the doorbells of the
+// channels it reads plus its own wake word in one futex_waitv(); without it
+// (or past 127 channels) it wakes every millisecond to poll.
+void ShmTransport::wait_channels() {
+  if (config_.receive_mode == ShmReceiveMode::kBusyPoll) {
+    spin_channels(kReceiveWaitSlice);
+    return;
+  }
+  if (config_.receive_mode == ShmReceiveMode::kSpinThenBlock &&
+      spin_channels(config_.spin_budget)) {
+    return;
+  }
+  wait_doorbells_.clear();
+  doorbells(&wait_doorbells_);
+  wait_seqs_.clear();
+  for (ShmDoorbell* doorbell : wait_doorbells_) {
+    wait_seqs_.push_back(doorbell->arm());
+  }
+  if (!running_.load() || channels_ready()) {
+    return;
+  }
+  if (!shm_sleep_any(wait_doorbells_.data(), wait_seqs_.data(),
+                     wait_doorbells_.size(), kReceiveWaitSlice)) {
+    wake_.sleep(wait_seqs_.front(), kFallbackWaitSlice);
+  }
+}
+
+size_t ShmTransport::poll(size_t budget) {
+  size_t delivered = 0;
+  ShmFrameView view;
+  if (directory_.valid()) {
+    uint64_t version = channels_version_.load(std::memory_order_acquire);
+    if (version != active_version_) {
+      active_version_ = version;
+      refresh_channels();
+    }
+    for (Channel* target : active_channels_) {
+      for (size_t n = 0;
+           n < kReceiveBatch && delivered < budget &&
+           target->segment.peek(target->consumer_id, config_.merge_order,
+                                &view);
+           ++n) {
+        frame_.assign(view.data, view.data + view.size);
+        if (target->segment.consume(target->consumer_id)) {
+          ++delivered;
+          if (handler_) {
+            handler_(frame_);
+          }
+        }
+      }
+    }
+    return delivered;
+  }
+
+  while (delivered < budget && segment_.valid() &&
+         segment_.peek(consumer_id_, config_.merge_order, &view)) {
+    frame_.assign(view.data, view.data + view.size);
+    if (segment_.consume(consumer_id_)) {
+      ++delivered;
+      if (handler_) {
+        handler_(frame_);
+      }
+    }
+  }
+  return delivered;
+}
+
+bool ShmTransport::readable() {
+  if (directory_.valid()) {
+    return channels_ready();
+  }
+  return segment_.valid() && segment_.readable(consumer_id_);
+}
+
+void ShmTransport::doorbells(std::vector<ShmDoorbell*>* out) {
+  if (directory_.valid()) {
+    out->push_back(&wake_);
+    for (Channel* target : active_channels_) {
+      out->push_back(target->segment.doorbell());
+    }
+  } else if (segment_.valid()) {
+    out->push_back(segment_.doorbell());
+  }
+}
+
+void ShmTransport::start_receiver() {
+  if (config_.reactor) {
+    config_.reactor->add_shm(this);
+    in_reactor_ = true;
+    return;
+  }
+  receiver_thread_ = std::thread([this]() { receive_loop(); });
+}
+
+void ShmTransport::wait_for_frames() {
+  if (directory_.valid()) {
+    wait_channels();
+    return;
+  }
+  switch (config_.receive_mode) {
+    case ShmReceiveMode::kBusyPoll:
+      segment_.spin(consumer_id_, kReceiveWaitSlice);
+      break;
+    case ShmReceiveMode::kSpinThenBlock:
+      if (!segment_.spin(consumer_id_, config_.spin_budget)) {
+        segment_.wait(consumer_id_, kReceiveWaitSlice);
+      }
+      break;
+    case ShmReceiveMode::kBlock:
+      segment_.wait(consumer_id_, kReceiveWaitSlice);
+      break;
+  }
+}
+
 void ShmTransport::receive_loop() {
+  if (segment_.valid() || directory_.valid()) {
+    while (running_.load()) {
+      if (poll(kReceiveBatch) == 0) {
+        wait_for_frames();
+      }
+    }
+    return;
+  }
   while (running_.load()) {
-    std::vector<uint8_t> frame;
-    if (!read_frame(&frame)) {
+    if (!read_frame(&frame_)) {
       continue;
     }
     if (handler_) {
-      handler_(frame);
+      handler_(frame_);
     }
   }
 }
@@ -228,6 +776,9 @@ bool ShmTransport::write_frame(const std::vector<uint8_t>& bytes) {
   if (!shm_ptr_) {
     return false;
   }
+  if (segment_.valid()) {
+    return segment_.write(bytes.data(), bytes.size());
+  }
 
   auto* ring = reinterpret_cast<ShmRingBuffer*>(shm_ptr_);
   uint32_t length = static_cast<uint32_t>(bytes.size());
@@ -242,7 +793,7 @@ bool ShmTransport::write_frame(const std::vector<uint8_t>& bytes) {
 
   ring_write(ring, reinterpret_cast<uint8_t*>(&length), sizeof(length));
   ring_write(ring, bytes.data(), length);
-  pthread_cond_signal(&ring->not_empty);
+  pthread_cond_broadcast(&ring->not_empty);
   pthread_mutex_unlock(&ring->mutex);
   return true;
 }
@@ -251,7 +802,6 @@ bool ShmTransport::read_frame(std::vector<uint8_t>* bytes) {
   if (!shm_ptr_ || !bytes) {
     return false;
   }
-
   auto* ring = reinterpret_cast<ShmRingBuffer*>(shm_ptr_);
   pthread_mutex_lock(&ring->mutex);
   if (consumer_id_ >= ring->max_consumers || !ring->active[consumer_id_]) {
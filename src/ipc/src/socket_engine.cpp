@@ -0,0 +1,1424 @@
+#include "../include/ipc/socket_engine.h"
+
+#include "../include/ipc/io_uring_ring.h"
+#include "../include/ipc/ipc_reactor.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr size_t kFrameHeaderBytes = sizeof(uint32_t);
+constexpr size_t kReadChunk = 64 * 1024;
+constexpr int kReadsPerWake = 16;
+constexpr int kMaxEpollEvents = 64;
+constexpr size_t kMaxIovecs = 64;
+// A length prefix with the top bit set announces a payload passed as a memfd;
+// the rest of the prefix is the payload size and no body follows.
+constexpr uint32_t kPassedFdFlag = 0x80000000u;
+constexpr size_t kMaxPassedFds = 8;
+// Packets taken by one recvmmsg() on a SOCK_SEQPACKET connection.
+constexpr size_t kPacketBatch = 16;
+
+constexpr unsigned kUringEntries = 256;
+constexpr uint16_t kRecvBuffers = 64;
+constexpr uint32_t kRecvBufferBytes = 16 * 1024;
+constexpr size_t kMaxLinkedSends = 4;
+
+// io_uring user_data carries the object in the upper bits and the operation
+// in the low three, which are free in any heap pointer.
+constexpr uint64_t kTagWake = 1;
+constexpr uint64_t kTagAccept = 2;
+constexpr uint64_t kTagRecv = 3;
+constexpr uint64_t kTagSend = 4;
+constexpr uint64_t kTagMask = 7;
+
+bool set_non_blocking(int fd, bool enabled = true) {
+  int flags = ::fcntl(fd, F_GETFL, 0);
+  if (flags < 0) {
+    return false;
+  }
+  flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return ::fcntl(fd, F_SETFL, flags) == 0;
+}
+
+// Multishot receive needs Linux 6.0; older kernels only probe as supporting
+// the plain opcodes.
+bool kernel_at_least(int major, int minor) {
+  utsname name{};
+  int found_major = 0;
+  int found_minor = 0;
+  if (::uname(&name) != 0 ||
+      std::sscanf(name.release, "%d.%d", &found_major, &found_minor) != 2) {
+    return false;
+  }
+  return found_major > major || (found_major == major && found_minor >= minor);
+}
+
+uint64_t user_data(const void* object, uint64_t tag) {
+  return reinterpret_cast<uintptr_t>(object) | tag;
+}
+
+// Sealed against writes and resizing, so a receiver can map it without the
+// sender changing the bytes or truncating them under the mapping.
+int create_sealed_memfd(const uint8_t* data, size_t length) {
+  int fd = ::memfd_create("rtos_ipc_frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t written = 0;
+  while (written < length) {
+    ssize_t result = ::write(fd, data + written, length - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      ::close(fd);
+      return -1;
+    }
+    written += static_cast<size_t>(result);
+  }
+  if (::fcntl(fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Reads the payload straight into the connection's reused frame buffer: one
+// copy out of the page cache, without mapping the memfd (an mmap, page
+// faults and an munmap per frame).
+bool read_passed_payload(int fd, size_t length, std::vector<uint8_t>* frame) {
+  constexpr int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_WRITE;
+  int seals = ::fcntl(fd, F_GET_SEALS);
+  struct stat info {};
+  if (seals < 0 || (seals & kRequiredSeals) != kRequiredSeals ||
+      ::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < length) {
+    return false;
+  }
+  frame->resize(length);
+  size_t done = 0;
+  while (done < length) {
+    ssize_t result = ::pread(fd, frame->data() + done, length - done,
+                             static_cast<off_t>(done));
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+void collect_fds(msghdr* message, std::deque<int>* fds) {
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(message); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(message, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; ++i) {
+      int passed = -1;
+      std::memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      fds->push_back(passed);
+    }
+  }
+}
+
+// Unix stream sockets return at most one message's descriptors per call, and
+// never data from past the message that carried them.
+ssize_t receive_with_fds(int fd, uint8_t* data, size_t length,
+                         std::deque<int>* fds) {
+  iovec iov{data, length};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t result = ::recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  if (result >= 0) {
+    collect_fds(&message, fds);
+  }
+  return result;
+}
+
+void fill_passed_fd(msghdr* message, char* control, size_t control_bytes,
+                    int fd) {
+  message->msg_control = control;
+  message->msg_controllen = control_bytes;
+  cmsghdr* cmsg = CMSG_FIRSTHDR(message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+}
+
+}  // namespace
+
+struct SocketEngine::Worker {
+  int epoll_fd = -1;
+  int wake_fd = -1;
+  IoUring ring;
+  std::thread thread;
+
+  // recvmmsg() slots shared by the worker's SOCK_SEQPACKET connections.
+  struct PacketSlot {
+    iovec iov;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  };
+  std::vector<uint8_t> packet_buffers;
+  std::vector<PacketSlot> packet_slots;
+  std::vector<mmsghdr> packets;
+};
+
+// Closed once every connection that queued it has sent it; the receivers
+// hold their own duplicates.
+struct SocketEngine::PassedFd {
+  explicit PassedFd(int value) : fd(value) {}
+  ~PassedFd() { ::close(fd); }
+  PassedFd(const PassedFd&) = delete;
+  PassedFd& operator=(const PassedFd&) = delete;
+
+  int fd;
+};
+
+struct SocketEngine::Connection {
+  // Length prefix and body in one buffer, shared by every connection. A
+  // frame with |passed| set is just the prefix, and the payload's memfd
+  // rides along with its first byte.
+  struct Frame {
+    std::shared_ptr<const std::vector<uint8_t>> bytes;
+    std::shared_ptr<const PassedFd> passed;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+
+  // A zerocopy send's pages must stay untouched until the kernel reports
+  // its sequence number complete.
+  struct ZerocopyPending {
+    uint32_t sequence;
+    std::shared_ptr<const std::vector<uint8_t>> bytes;
+  };
+
+  int fd = -1;
+  uint64_t id = 0;
+  Worker* worker = nullptr;
+  bool unix_socket = false;
+
+  // Owned by the worker's thread.
+  std::vector<uint8_t> inbound;
+  size_t inbound_start = 0;
+  size_t inbound_end = 0;
+  std::vector<uint8_t> frame;
+  std::deque<int> passed_fds;
+  // Written by the worker, read by connection_stats().
+  std::atomic<uint64_t> receive_calls{0};
+  std::atomic<uint64_t> received_frames{0};
+
+  std::mutex mutex;
+  std::condition_variable drained;
+  std::deque<Frame> outbound;
+  size_t outbound_offset = 0;  // Bytes of the front frame already sent.
+  size_t queued_bytes = 0;
+  size_t blocked_publishers = 0;
+  bool want_write = false;
+  bool closed = false;
+  bool zerocopy = false;
+  uint32_t zerocopy_sequence = 0;
+  std::deque<ZerocopyPending> zerocopy_pending;
+  ConnectionStats stats;
+
+  // io_uring backend. The kernel reads the send descriptors until the send
+  // completes, and a connection is only freed once nothing is in flight.
+  struct SendSlot {
+    msghdr message;
+    iovec iov[kMaxIovecs];
+  };
+  std::vector<SendSlot> send_slots;
+  size_t sends_in_flight = 0;
+  bool recv_armed = false;
+  bool closing = false;
+};
+
+SocketEngine::SocketEngine(SocketEngineConfig config) : config_(config) {}
+
+SocketEngine::~SocketEngine() {
+  stop();
+}
+
+bool SocketEngine::start(TransportReceiveHandler handler, int listen_fd) {
+  if (running_.exchange(true)) {
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+    }
+    return false;
+  }
+  handler_ = std::move(handler);
+  listen_fd_ = listen_fd;
+
+  size_t count =
+      config_.reactor ? 1 : std::max<size_t>(1, config_.io_threads);
+  bool uring = config_.backend == SocketBackend::kIoUring &&
+               !config_.seqpacket && !config_.reactor &&
+               kernel_at_least(6, 0) &&
+               start_workers(count, true);
+  if (!uring && !start_workers(count, false)) {
+    stop();
+    return false;
+  }
+  backend_ = uring ? SocketBackend::kIoUring : SocketBackend::kEpoll;
+
+  if (listen_fd_ >= 0) {
+    configure_socket(listen_fd_, true);
+    if (uring) {
+      if (!set_non_blocking(listen_fd_, false)) {
+        stop();
+        return false;
+      }
+      arm_accept();
+      workers_.front()->ring.submit(false);
+    } else {
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.ptr = &listen_fd_;
+      if (!set_non_blocking(listen_fd_) ||
+          ::epoll_ctl(workers_.front()->epoll_fd, EPOLL_CTL_ADD, listen_fd_,
+                      &event) != 0) {
+        stop();
+        return false;
+      }
+    }
+  }
+
+  for (auto& worker : workers_) {
+    Worker* raw = worker.get();
+    if (config_.reactor) {
+      config_.reactor->add_fd(worker->epoll_fd,
+                              [this, raw]() { poll_events(raw, 0); });
+    } else {
+      worker->thread = std::thread([this, raw]() { run(raw); });
+    }
+  }
+  return true;
+}
+
+// On failure the partly built workers are discarded, so an io_uring attempt
+// can fall back to epoll.
+bool SocketEngine::start_workers(size_t count, bool uring) {
+  static const uint8_t kOpcodes[] = {IORING_OP_NOP, IORING_OP_ACCEPT,
+                                     IORING_OP_RECV, IORING_OP_SENDMSG,
+                                     IORING_OP_PROVIDE_BUFFERS};
+  for (size_t i = 0; i < count; ++i) {
+    auto worker = std::make_unique<Worker>();
+    bool ok = false;
+    if (uring) {
+      ok = worker->ring.init(kUringEntries, kOpcodes, sizeof(kOpcodes)) &&
+           worker->ring.register_buffers(0, kRecvBuffers, kRecvBufferBytes);
+    } else {
+      worker->epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+      worker->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.ptr = nullptr;
+      ok = worker->epoll_fd >= 0 && worker->wake_fd >= 0 &&
+           ::epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd,
+                       &event) == 0;
+    }
+    if (!ok) {
+      if (worker->epoll_fd >= 0) {
+        ::close(worker->epoll_fd);
+      }
+      if (worker->wake_fd >= 0) {
+        ::close(worker->wake_fd);
+      }
+      for (auto& built : workers_) {
+        built->ring.destroy();
+        if (built->epoll_fd >= 0) {
+          ::close(built->epoll_fd);
+        }
+        if (built->wake_fd >= 0) {
+          ::close(built->wake_fd);
+        }
+      }
+      workers_.clear();
+      return false;
+    }
+    workers_.push_back(std::move(worker));
+  }
+  return true;
+}
+
+void SocketEngine::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+
+  for (auto& worker : workers_) {
+    if (worker->ring.valid()) {
+      {
+        std::lock_guard<std::mutex> lock(worker->ring.lock());
+        io_uring_sqe* sqe = worker->ring.get_sqe();
+        if (sqe) {
+          sqe->opcode = IORING_OP_NOP;
+          sqe->user_data = user_data(nullptr, kTagWake);
+        }
+      }
+      worker->ring.submit(false);
+    }
+    uint64_t one = 1;
+    if (worker->wake_fd >= 0 &&
+        ::write(worker->wake_fd, &one, sizeof(one)) < 0) {
+      // The eventfd counter cannot overflow from a single write.
+    }
+  }
+  for (auto& worker : workers_) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+    if (config_.reactor) {
+      config_.reactor->remove_fd(worker->epoll_fd);
+    }
+  }
+
+  // Closing a ring cancels its requests before their buffers are released.
+  // The teardown finishes asynchronously and keeps the sockets open until it
+  // does, so shut them down first to free the port and tell peers right away.
+  if (listen_fd_ >= 0) {
+    ::shutdown(listen_fd_, SHUT_RDWR);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : connections_) {
+      ::shutdown(entry.second->fd, SHUT_RDWR);
+    }
+  }
+  for (auto& worker : workers_) {
+    worker->ring.destroy();
+  }
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : connections_) {
+      std::lock_guard<std::mutex> connection_lock(entry.second->mutex);
+      entry.second->closed = true;
+      entry.second->drained.notify_all();
+      ::close(entry.second->fd);
+      for (int passed : entry.second->passed_fds) {
+        ::close(passed);
+      }
+    }
+    connections_.clear();
+  }
+  for (auto& worker : workers_) {
+    if (worker->epoll_fd >= 0) {
+      ::close(worker->epoll_fd);
+    }
+    if (worker->wake_fd >= 0) {
+      ::close(worker->wake_fd);
+    }
+  }
+  workers_.clear();
+  next_worker_ = 0;
+  backend_ = SocketBackend::kEpoll;
+}
+
+bool SocketEngine::add_connection(int fd) {
+  if (fd < 0) {
+    return false;
+  }
+  if (!running_.load() ||
+      !set_non_blocking(fd, backend_ == SocketBackend::kEpoll)) {
+    ::close(fd);
+    return false;
+  }
+  return attach(fd);
+}
+
+bool SocketEngine::publish(const std::vector<uint8_t>& bytes) {
+  if (!running_.load() || bytes.empty()) {
+    return false;
+  }
+
+  std::vector<std::shared_ptr<Connection>> targets;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    targets.reserve(connections_.size());
+    for (const auto& entry : connections_) {
+      targets.push_back(entry.second);
+    }
+  }
+
+  std::shared_ptr<const PassedFd> passed;
+  if (config_.fd_passing_threshold > 0 &&
+      bytes.size() >= config_.fd_passing_threshold &&
+      backend_ == SocketBackend::kEpoll && !targets.empty()) {
+    int fd = create_sealed_memfd(bytes.data(), bytes.size());
+    if (fd >= 0) {
+      passed = std::make_shared<const PassedFd>(fd);
+    }
+  }
+
+  // Packets need no length prefix, except to size a passed payload.
+  size_t header_bytes = passed || !config_.seqpacket ? kFrameHeaderBytes : 0;
+  size_t body_bytes = passed ? 0 : bytes.size();
+  if (config_.seqpacket && body_bytes > config_.max_packet_bytes) {
+    return false;
+  }
+  auto frame =
+      std::make_shared<std::vector<uint8_t>>(header_bytes + body_bytes);
+  uint32_t length = static_cast<uint32_t>(bytes.size());
+  length = htonl(passed ? (length | kPassedFdFlag) : length);
+  std::memcpy(frame->data(), &length, header_bytes);
+  std::memcpy(frame->data() + header_bytes, bytes.data(), body_bytes);
+  std::shared_ptr<const std::vector<uint8_t>> shared = std::move(frame);
+
+  bool ok = true;
+  for (const auto& connection : targets) {
+    ok = enqueue(connection.get(), shared, passed) && ok;
+  }
+  if (backend_ == SocketBackend::kIoUring) {
+    // One submission per I/O thread carries the sends for all its peers.
+    for (auto& worker : workers_) {
+      worker->ring.submit(false);
+    }
+  }
+  return ok;
+}
+
+size_t SocketEngine::connection_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return connections_.size();
+}
+
+std::vector<ConnectionStats> SocketEngine::connection_stats() const {
+  std::vector<std::shared_ptr<Connection>> connections;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : connections_) {
+      connections.push_back(entry.second);
+    }
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  std::vector<ConnectionStats> stats;
+  stats.reserve(connections.size());
+  for (const auto& connection : connections) {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    ConnectionStats entry = connection->stats;
+    entry.receive_calls =
+        connection->receive_calls.load(std::memory_order_relaxed);
+    entry.received_frames =
+        connection->received_frames.load(std::memory_order_relaxed);
+    entry.queued_frames = connection->outbound.size();
+    entry.queued_bytes = connection->queued_bytes;
+    if (!connection->outbound.empty()) {
+      entry.lag = now - connection->outbound.front().queued_at;
+      entry.max_lag = std::max(entry.max_lag, entry.lag);
+    }
+    stats.push_back(entry);
+  }
+  std::sort(stats.begin(), stats.end(),
+            [](const ConnectionStats& a, const ConnectionStats& b) {
+              return a.id < b.id;
+            });
+  return stats;
+}
+
+// The connection lock is held until the socket is registered, so a publish
+// that has to arm EPOLLOUT always finds it in the worker's epoll set.
+bool SocketEngine::attach(int fd) {
+  configure_socket(fd, false);
+  auto connection = std::make_shared<Connection>();
+  connection->fd = fd;
+  int domain = 0;
+  socklen_t domain_length = sizeof(domain);
+  connection->unix_socket =
+      ::getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_length) == 0 &&
+      domain == AF_UNIX;
+  if (config_.zerocopy_threshold > 0) {
+    int one = 1;
+    connection->zerocopy =
+        ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+  }
+  std::lock_guard<std::mutex> connection_lock(connection->mutex);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (workers_.empty() || connections_.size() >= config_.max_connections) {
+      ::close(fd);
+      return false;
+    }
+    connection->worker = workers_[next_worker_++ % workers_.size()].get();
+    connection->id = next_connection_id_++;
+    connection->stats.id = connection->id;
+    connections_[fd] = connection;
+  }
+
+  if (backend_ == SocketBackend::kIoUring) {
+    connection->recv_armed = true;
+    arm_recv(connection.get());
+    connection->worker->ring.submit(false);
+    return true;
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.ptr = connection.get();
+  if (::epoll_ctl(connection->worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) !=
+      0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections_.erase(fd);
+    }
+    connection->closed = true;
+    ::close(fd);
+    return false;
+  }
+  return true;
+}
+
+// Buffer sizes go on the listening socket too, so accepted sockets inherit
+// them before the handshake fixes the window scale. TCP options simply fail
+// on Unix sockets.
+void SocketEngine::configure_socket(int fd, bool listening) {
+  if (config_.send_buffer_bytes > 0) {
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config_.send_buffer_bytes,
+                 sizeof(config_.send_buffer_bytes));
+  }
+  if (config_.receive_buffer_bytes > 0) {
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config_.receive_buffer_bytes,
+                 sizeof(config_.receive_buffer_bytes));
+  }
+  if (listening) {
+    return;
+  }
+  int one = 1;
+  if (config_.tcp_nodelay) {
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  if (config_.tcp_quickack) {
+    ::setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+  }
+}
+
+void SocketEngine::run(Worker* worker) {
+  if (backend_ == SocketBackend::kIoUring) {
+    run_uring(worker);
+    return;
+  }
+  while (poll_events(worker, -1)) {
+  }
+}
+
+// One epoll_wait() and the handling of what it returned. A reactor calls this
+// with no timeout each time the worker's epoll set turns readable.
+bool SocketEngine::poll_events(Worker* worker, int timeout_ms) {
+  if (!running_.load()) {
+    return false;
+  }
+  epoll_event events[kMaxEpollEvents];
+  int count =
+      ::epoll_wait(worker->epoll_fd, events, kMaxEpollEvents, timeout_ms);
+  if (count < 0) {
+    return errno == EINTR;
+  }
+  for (int i = 0; i < count && running_.load(); ++i) {
+    void* source = events[i].data.ptr;
+    if (source == nullptr) {
+      continue;
+    }
+    if (source == &listen_fd_) {
+      accept_connections();
+      continue;
+    }
+    auto* connection = static_cast<Connection*>(source);
+    if ((events[i].events & EPOLLERR) != 0 && connection->zerocopy) {
+      reap_zerocopy(connection);
+    }
+    if ((events[i].events & EPOLLOUT) != 0) {
+      write_connection(connection);
+    }
+    if ((events[i].events & ~static_cast<uint32_t>(EPOLLOUT)) != 0) {
+      if (config_.seqpacket) {
+        read_packets(worker, connection);
+      } else {
+        read_connection(connection);
+      }
+    }
+  }
+  return true;
+}
+
+void SocketEngine::accept_connections() {
+  while (running_.load()) {
+    int fd = ::accept4(listen_fd_, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // EAGAIN once the backlog is empty; anything else is per-connection
+      // (ECONNABORTED) or resource exhaustion that the next wake-up retries.
+      return;
+    }
+    attach(fd);
+  }
+}
+
+// Level-triggered: a busy socket is read a bounded number of times per wake-up
+// so it cannot starve the worker's other connections.
+void SocketEngine::read_connection(Connection* connection) {
+  for (int i = 0; i < kReadsPerWake; ++i) {
+    auto& inbound = connection->inbound;
+    if (inbound.size() - connection->inbound_end < kReadChunk / 4) {
+      if (connection->inbound_start > 0) {
+        std::memmove(inbound.data(), inbound.data() + connection->inbound_start,
+                     connection->inbound_end - connection->inbound_start);
+        connection->inbound_end -= connection->inbound_start;
+        connection->inbound_start = 0;
+      }
+      if (inbound.size() - connection->inbound_end < kReadChunk / 4) {
+        inbound.resize(connection->inbound_end + kReadChunk);
+      }
+    }
+
+    size_t space = inbound.size() - connection->inbound_end;
+    uint8_t* data = inbound.data() + connection->inbound_end;
+    ssize_t result =
+        connection->unix_socket
+            ? receive_with_fds(connection->fd, data, space,
+                               &connection->passed_fds)
+            : ::recv(connection->fd, data, space, 0);
+    connection->receive_calls.fetch_add(1, std::memory_order_relaxed);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (result <= 0) {
+      close_connection(connection);
+      return;
+    }
+    connection->inbound_end += static_cast<size_t>(result);
+    if (config_.tcp_quickack) {
+      int one = 1;
+      ::setsockopt(connection->fd, IPPROTO_TCP, TCP_QUICKACK, &one,
+                   sizeof(one));
+    }
+    if (!parse_frames(connection)) {
+      close_connection(connection);
+      return;
+    }
+    if (static_cast<size_t>(result) < space) {
+      return;
+    }
+  }
+}
+
+bool SocketEngine::append_inbound(Connection* connection, const uint8_t* data,
+                                  size_t length) {
+  auto& inbound = connection->inbound;
+  if (inbound.size() - connection->inbound_end < length) {
+    size_t available = connection->inbound_end - connection->inbound_start;
+    std::memmove(inbound.data(), inbound.data() + connection->inbound_start,
+                 available);
+    connection->inbound_start = 0;
+    connection->inbound_end = available;
+    if (inbound.size() - available < length) {
+      inbound.resize(available + std::max(length, kReadChunk));
+    }
+  }
+  std::memcpy(inbound.data() + connection->inbound_end, data, length);
+  connection->inbound_end += length;
+  return parse_frames(connection);
+}
+
+// Delivers every complete frame in the buffer. A partial frame stays put, and
+// the buffer is grown once to hold all of it, so large frames are not read in
+// many small steps.
+bool SocketEngine::parse_frames(Connection* connection) {
+  auto& inbound = connection->inbound;
+  while (connection->inbound_end - connection->inbound_start >=
+         kFrameHeaderBytes) {
+    uint32_t length = 0;
+    std::memcpy(&length, inbound.data() + connection->inbound_start,
+                sizeof(length));
+    length = ntohl(length);
+    bool passed = (length & kPassedFdFlag) != 0;
+    length &= ~kPassedFdFlag;
+    if (length == 0 || length > config_.max_frame_bytes) {
+      return false;
+    }
+
+    size_t total = kFrameHeaderBytes + (passed ? 0 : length);
+    size_t available = connection->inbound_end - connection->inbound_start;
+    if (available < total) {
+      if (inbound.size() - connection->inbound_start < total) {
+        std::memmove(inbound.data(), inbound.data() + connection->inbound_start,
+                     available);
+        connection->inbound_start = 0;
+        connection->inbound_end = available;
+        if (inbound.size() < total) {
+          inbound.resize(total);
+        }
+      }
+      break;
+    }
+
+    if (passed) {
+      // The descriptor arrived with the prefix's first byte.
+      if (connection->passed_fds.empty()) {
+        return false;
+      }
+      int fd = connection->passed_fds.front();
+      connection->passed_fds.pop_front();
+      bool mapped = read_passed_payload(fd, length, &connection->frame);
+      ::close(fd);
+      if (!mapped) {
+        return false;
+      }
+    } else {
+      const uint8_t* body =
+          inbound.data() + connection->inbound_start + kFrameHeaderBytes;
+      connection->frame.assign(body, body + length);
+    }
+    connection->inbound_start += total;
+    connection->received_frames.fetch_add(1, std::memory_order_relaxed);
+    if (handler_) {
+      handler_(connection->frame);
+    }
+  }
+  if (connection->inbound_start == connection->inbound_end) {
+    connection->inbound_start = 0;
+    connection->inbound_end = 0;
+  }
+  return true;
+}
+
+void SocketEngine::write_connection(Connection* connection) {
+  std::lock_guard<std::mutex> lock(connection->mutex);
+  if (!connection->closed) {
+    flush_locked(connection);
+  }
+}
+
+// Zerocopy completions arrive on the socket's error queue as ranges of send
+// sequence numbers; the buffers of completed sends are released.
+void SocketEngine::reap_zerocopy(Connection* connection) {
+  while (true) {
+    char control[128];
+    msghdr message{};
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (::recvmsg(connection->fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      return;
+    }
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+      bool recverr = (cmsg->cmsg_level == SOL_IP &&
+                      cmsg->cmsg_type == IP_RECVERR) ||
+                     (cmsg->cmsg_level == SOL_IPV6 &&
+                      cmsg->cmsg_type == IPV6_RECVERR);
+      if (!recverr) {
+        continue;
+      }
+      sock_extended_err error{};
+      std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+      if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      if ((error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+        connection->stats.zerocopy_copied += error.ee_data - error.ee_info + 1;
+      }
+      auto& pending = connection->zerocopy_pending;
+      while (!pending.empty() &&
+             static_cast<int32_t>(error.ee_data - pending.front().sequence) >=
+                 0) {
+        pending.pop_front();
+      }
+    }
+  }
+}
+
+// A frame larger than the whole queue is still accepted into an empty queue,
+// otherwise it could never be sent.
+bool SocketEngine::enqueue(
+    Connection* connection,
+    const std::shared_ptr<const std::vector<uint8_t>>& frame,
+    const std::shared_ptr<const PassedFd>& passed) {
+  size_t frame_bytes = frame->size();
+  std::unique_lock<std::mutex> lock(connection->mutex);
+  auto full = [&]() {
+    return connection->queued_bytes > 0 &&
+           connection->queued_bytes + frame_bytes > config_.max_queued_bytes;
+  };
+
+  if (!connection->closed && full()) {
+    switch (config_.overflow_policy) {
+      case SendOverflowPolicy::kDrop:
+        break;
+      case SendOverflowPolicy::kDisconnect:
+        ::shutdown(connection->fd, SHUT_RDWR);
+        connection->closed = true;
+        overflow_disconnects_.fetch_add(1);
+        break;
+      case SendOverflowPolicy::kBlock:
+        ++connection->blocked_publishers;
+        connection->drained.wait_for(lock, config_.block_timeout, [&]() {
+          return connection->closed || !full();
+        });
+        --connection->blocked_publishers;
+        break;
+    }
+  }
+  if (connection->closed) {
+    return false;
+  }
+  if (full()) {
+    ++connection->stats.dropped_frames;
+    return false;
+  }
+
+  connection->outbound.push_back(
+      Connection::Frame{frame, passed, std::chrono::steady_clock::now()});
+  connection->queued_bytes += frame_bytes;
+  connection->stats.peak_queued_bytes =
+      std::max(connection->stats.peak_queued_bytes, connection->queued_bytes);
+  return flush_locked(connection);
+}
+
+// Writes queued frames until the socket is full, then arms EPOLLOUT so the
+// worker finishes the job. Small frames are coalesced into one sendmsg();
+// a frame over the zerocopy threshold goes out on its own with MSG_ZEROCOPY,
+// and so does a memfd frame, whose descriptor must ride with its first byte.
+// A failed socket is shut down rather than closed: only the worker closes
+// descriptors, so a publisher can never write to a reused descriptor number.
+bool SocketEngine::flush_locked(Connection* connection) {
+  if (backend_ == SocketBackend::kIoUring) {
+    submit_sends_locked(connection);
+    return !connection->closed;
+  }
+
+  auto& outbound = connection->outbound;
+  size_t queued_before = connection->queued_bytes;
+  bool ok = true;
+  bool allow_zerocopy = connection->zerocopy;
+  while (!outbound.empty()) {
+    if (config_.seqpacket) {
+      ssize_t result = send_packets_locked(connection);
+      if (result > 0 || (result < 0 && errno == EINTR)) {
+        continue;
+      }
+      if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      ::shutdown(connection->fd, SHUT_RDWR);
+      ok = false;
+      break;
+    }
+
+    auto is_large = [&](const Connection::Frame& frame) {
+      return allow_zerocopy &&
+             frame.bytes->size() >= config_.zerocopy_threshold;
+    };
+
+    iovec iov[kMaxIovecs];
+    size_t count = 0;
+    bool zerocopy = is_large(outbound.front());
+    bool passing = outbound.front().passed && connection->outbound_offset == 0;
+    for (const auto& frame : outbound) {
+      if (count == kMaxIovecs ||
+          (count > 0 && (zerocopy || passing || is_large(frame) ||
+                         frame.passed))) {
+        break;
+      }
+      size_t skip = count == 0 ? connection->outbound_offset : 0;
+      iov[count].iov_base = const_cast<uint8_t*>(frame.bytes->data()) + skip;
+      iov[count].iov_len = frame.bytes->size() - skip;
+      ++count;
+    }
+
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (passing) {
+      fill_passed_fd(&message, control, sizeof(control),
+                     outbound.front().passed->fd);
+    }
+    int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (zerocopy ? MSG_ZEROCOPY : 0);
+    ssize_t result = ::sendmsg(connection->fd, &message, flags);
+    if (result > 0) {
+      ++connection->stats.send_calls;
+      if (passing) {
+        ++connection->stats.passed_frames;
+      }
+      if (zerocopy) {
+        ++connection->stats.zerocopy_sends;
+        connection->zerocopy_pending.push_back(Connection::ZerocopyPending{
+            connection->zerocopy_sequence++, outbound.front().bytes});
+      }
+      complete_send_locked(connection, static_cast<size_t>(result));
+      continue;
+    }
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0 && errno == ENOBUFS && zerocopy) {
+      // Out of pinned-page budget (optmem); fall back to a copying send.
+      allow_zerocopy = false;
+      continue;
+    }
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    ::shutdown(connection->fd, SHUT_RDWR);
+    ok = false;
+    break;
+  }
+
+  if (connection->blocked_publishers > 0 &&
+      connection->queued_bytes < queued_before) {
+    connection->drained.notify_all();
+  }
+  bool want_write = ok && !outbound.empty();
+  if (want_write != connection->want_write) {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP |
+                   (want_write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.ptr = connection;
+    ::epoll_ctl(connection->worker->epoll_fd, EPOLL_CTL_MOD, connection->fd,
+                &event);
+    connection->want_write = want_write;
+  }
+  return ok;
+}
+
+void SocketEngine::complete_send_locked(Connection* connection, size_t sent) {
+  auto& outbound = connection->outbound;
+  connection->queued_bytes -= sent;
+  auto now = std::chrono::steady_clock::now();
+  while (sent > 0) {
+    Connection::Frame& front = outbound.front();
+    size_t remaining = front.bytes->size() - connection->outbound_offset;
+    if (sent < remaining) {
+      connection->outbound_offset += sent;
+      return;
+    }
+    sent -= remaining;
+    connection->stats.max_lag = std::max(
+        connection->stats.max_lag,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - front.queued_at));
+    ++connection->stats.sent_frames;
+    connection->outbound_offset = 0;
+    outbound.pop_front();
+  }
+}
+
+// Each queued frame is one packet; up to kMaxIovecs of them leave in a single
+// sendmmsg(). Returns the packets sent, or -1 with errno set.
+ssize_t SocketEngine::send_packets_locked(Connection* connection) {
+  mmsghdr packets[kMaxIovecs];
+  iovec iov[kMaxIovecs];
+  alignas(cmsghdr) char control[kMaxIovecs][CMSG_SPACE(sizeof(int))];
+  size_t count = 0;
+  for (const auto& frame : connection->outbound) {
+    if (count == kMaxIovecs) {
+      break;
+    }
+    iov[count].iov_base = const_cast<uint8_t*>(frame.bytes->data());
+    iov[count].iov_len = frame.bytes->size();
+    packets[count] = mmsghdr{};
+    packets[count].msg_hdr.msg_iov = &iov[count];
+    packets[count].msg_hdr.msg_iovlen = 1;
+    if (frame.passed) {
+      fill_passed_fd(&packets[count].msg_hdr, control[count],
+                     sizeof(control[count]), frame.passed->fd);
+    }
+    ++count;
+  }
+
+  int result = ::sendmmsg(connection->fd, packets, static_cast<unsigned>(count),
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (result <= 0) {
+    return result < 0 ? -1 : 0;
+  }
+  ++connection->stats.send_calls;
+  size_t sent_bytes = 0;
+  auto frame = connection->outbound.begin();
+  for (int i = 0; i < result; ++i, ++frame) {
+    sent_bytes += frame->bytes->size();
+    if (frame->passed) {
+      ++connection->stats.passed_frames;
+    }
+  }
+  complete_send_locked(connection, sent_bytes);
+  return result;
+}
+
+// SOCK_SEQPACKET keeps message boundaries, so each packet is a whole message
+// and a batch of them arrives in one recvmmsg() into the worker's slots.
+// A packet that carries a descriptor is the length prefix of a passed
+// payload. A zero-length packet means the peer closed.
+void SocketEngine::read_packets(Worker* worker, Connection* connection) {
+  size_t slot_bytes = config_.max_packet_bytes + kFrameHeaderBytes;
+  if (worker->packets.empty()) {
+    worker->packet_buffers.resize(kPacketBatch * slot_bytes);
+    worker->packet_slots.resize(kPacketBatch);
+    worker->packets.resize(kPacketBatch);
+  }
+
+  for (int round = 0; round < kReadsPerWake; ++round) {
+    for (size_t i = 0; i < kPacketBatch; ++i) {
+      Worker::PacketSlot& slot = worker->packet_slots[i];
+      slot.iov.iov_base = worker->packet_buffers.data() + i * slot_bytes;
+      slot.iov.iov_len = slot_bytes;
+      mmsghdr& packet = worker->packets[i];
+      packet = mmsghdr{};
+      packet.msg_hdr.msg_iov = &slot.iov;
+      packet.msg_hdr.msg_iovlen = 1;
+      packet.msg_hdr.msg_control = slot.control;
+      packet.msg_hdr.msg_controllen = sizeof(slot.control);
+    }
+
+    int count = ::recvmmsg(connection->fd, worker->packets.data(),
+                           static_cast<unsigned>(kPacketBatch),
+                           MSG_DONTWAIT | MSG_CMSG_CLOEXEC, nullptr);
+    connection->receive_calls.fetch_add(1, std::memory_order_relaxed);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (count <= 0) {
+      close_connection(connection);
+      return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      mmsghdr& packet = worker->packets[i];
+      size_t length = packet.msg_len;
+      const auto* data =
+          static_cast<const uint8_t*>(packet.msg_hdr.msg_iov->iov_base);
+      bool truncated =
+          (packet.msg_hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0;
+      collect_fds(&packet.msg_hdr, &connection->passed_fds);
+      if (length == 0 || truncated) {
+        close_connection(connection);
+        return;
+      }
+
+      if (!connection->passed_fds.empty()) {
+        uint32_t prefix = 0;
+        int fd = connection->passed_fds.front();
+        connection->passed_fds.pop_front();
+        bool mapped = false;
+        if (length == kFrameHeaderBytes) {
+          std::memcpy(&prefix, data, sizeof(prefix));
+          prefix = ntohl(prefix);
+          size_t payload = prefix & ~kPassedFdFlag;
+          mapped = (prefix & kPassedFdFlag) != 0 && payload > 0 &&
+                   payload <= config_.max_frame_bytes &&
+                   read_passed_payload(fd, payload, &connection->frame);
+        }
+        ::close(fd);
+        if (!mapped) {
+          close_connection(connection);
+          return;
+        }
+      } else {
+        connection->frame.assign(data, data + length);
+      }
+      connection->received_frames.fetch_add(1, std::memory_order_relaxed);
+      if (handler_) {
+        handler_(connection->frame);
+      }
+    }
+    if (static_cast<size_t>(count) < kPacketBatch) {
+      return;
+    }
+  }
+}
+
+// Runs on the connection's worker. The entry leaves the table before the
+// descriptor is closed, so an accept that reuses the number cannot collide.
+void SocketEngine::close_connection(Connection* connection) {
+  ::epoll_ctl(connection->worker->epoll_fd, EPOLL_CTL_DEL, connection->fd,
+              nullptr);
+  std::shared_ptr<Connection> owner;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = connections_.find(connection->fd);
+    if (it != connections_.end() && it->second.get() == connection) {
+      owner = std::move(it->second);
+      connections_.erase(it);
+    }
+  }
+  std::lock_guard<std::mutex> lock(connection->mutex);
+  connection->closed = true;
+  connection->drained.notify_all();
+  ::close(connection->fd);
+  for (int passed : connection->passed_fds) {
+    ::close(passed);
+  }
+  connection->passed_fds.clear();
+}
+
+// The io_uring worker sleeps in io_uring_enter() until a completion arrives,
+// submitting whatever was prepared meanwhile on the way in.
+void SocketEngine::run_uring(Worker* worker) {
+  IoUring& ring = worker->ring;
+  while (running_.load()) {
+    if (ring.submit(true) < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      break;
+    }
+    while (io_uring_cqe* cqe = ring.peek_cqe()) {
+      uint64_t data = cqe->user_data;
+      int32_t result = cqe->res;
+      uint32_t flags = cqe->flags;
+      ring.cqe_seen();
+
+      auto* connection = reinterpret_cast<Connection*>(data & ~kTagMask);
+      switch (data & kTagMask) {
+        case kTagAccept:
+          on_accept(result, flags);
+          break;
+        case kTagRecv:
+          on_recv(worker, connection, result, flags);
+          break;
+        case kTagSend:
+          on_send(connection, result);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+}
+
+void SocketEngine::arm_accept() {
+  IoUring& ring = workers_.front()->ring;
+  std::lock_guard<std::mutex> lock(ring.lock());
+  io_uring_sqe* sqe = ring.get_sqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = user_data(nullptr, kTagAccept);
+}
+
+// One multishot receive serves the connection until it ends or the provided
+// buffers run out; each completion names the buffer it filled.
+void SocketEngine::arm_recv(Connection* connection) {
+  IoUring& ring = connection->worker->ring;
+  std::lock_guard<std::mutex> lock(ring.lock());
+  io_uring_sqe* sqe = ring.get_sqe();
+  if (!sqe) {
+    connection->recv_armed = false;
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = connection->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = ring.buffer_group();
+  sqe->user_data = user_data(connection, kTagRecv);
+}
+
+// Queued frames go out as a chain of linked sendmsg() requests, each
+// gathering up to kMaxIovecs frames. MSG_WAITALL makes io_uring finish short
+// sends itself, and the links keep the chain in order on the stream. The next
+// chain is prepared once the whole current one has completed.
+void SocketEngine::submit_sends_locked(Connection* connection) {
+  if (connection->sends_in_flight > 0 || connection->closed ||
+      connection->outbound.empty()) {
+    return;
+  }
+  if (connection->send_slots.empty()) {
+    connection->send_slots.resize(kMaxLinkedSends);
+  }
+
+  IoUring& ring = connection->worker->ring;
+  std::lock_guard<std::mutex> lock(ring.lock());
+  auto frame = connection->outbound.begin();
+  size_t skip = connection->outbound_offset;
+  for (size_t slot_index = 0;
+       slot_index < kMaxLinkedSends && frame != connection->outbound.end();
+       ++slot_index) {
+    Connection::SendSlot& slot = connection->send_slots[slot_index];
+    size_t count = 0;
+    for (; count < kMaxIovecs && frame != connection->outbound.end();
+         ++count, ++frame) {
+      slot.iov[count].iov_base =
+          const_cast<uint8_t*>(frame->bytes->data()) + skip;
+      slot.iov[count].iov_len = frame->bytes->size() - skip;
+      skip = 0;
+    }
+    slot.message = msghdr{};
+    slot.message.msg_iov = slot.iov;
+    slot.message.msg_iovlen = count;
+
+    io_uring_sqe* sqe = ring.get_sqe();
+    if (!sqe) {
+      break;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = connection->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = user_data(connection, kTagSend);
+    if (slot_index + 1 < kMaxLinkedSends &&
+        frame != connection->outbound.end()) {
+      sqe->flags = IOSQE_IO_LINK;
+    }
+    ++connection->sends_in_flight;
+    ++connection->stats.send_calls;
+  }
+}
+
+void SocketEngine::on_accept(int32_t result, uint32_t flags) {
+  if (result >= 0) {
+    attach(result);
+  }
+  if ((flags & IORING_CQE_F_MORE) == 0 && running_.load() &&
+      result != -ECANCELED && result != -EBADF && result != -EINVAL) {
+    arm_accept();
+  }
+}
+
+void SocketEngine::on_recv(Worker* worker, Connection* connection,
+                           int32_t result, uint32_t flags) {
+  if ((flags & IORING_CQE_F_BUFFER) != 0) {
+    auto id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    if (result > 0 && !connection->closing) {
+      if (config_.tcp_quickack) {
+        int one = 1;
+        ::setsockopt(connection->fd, IPPROTO_TCP, TCP_QUICKACK, &one,
+                     sizeof(one));
+      }
+      if (!append_inbound(connection, worker->ring.buffer(id),
+                          static_cast<size_t>(result))) {
+        begin_close(connection);
+      }
+    }
+    worker->ring.recycle_buffer(id);
+  }
+
+  // -ENOBUFS only means every provided buffer was in use; re-arm.
+  if (result == 0 || (result < 0 && result != -ENOBUFS && result != -EAGAIN &&
+                      result != -EINTR)) {
+    begin_close(connection);
+  }
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    connection->recv_armed = false;
+    if (!connection->closing && running_.load()) {
+      connection->recv_armed = true;
+      arm_recv(connection);
+    }
+  }
+  finish_close(connection);
+}
+
+void SocketEngine::on_send(Connection* connection, int32_t result) {
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    size_t queued_before = connection->queued_bytes;
+    --connection->sends_in_flight;
+    if (result > 0) {
+      complete_send_locked(connection, static_cast<size_t>(result));
+    } else if (result != -ECANCELED && result != -EAGAIN && result != -EINTR) {
+      // A canceled link follows a failed or short send earlier in its chain.
+      failed = true;
+    }
+    if (connection->sends_in_flight == 0 && !failed) {
+      submit_sends_locked(connection);
+    }
+    if (connection->blocked_publishers > 0 &&
+        connection->queued_bytes < queued_before) {
+      connection->drained.notify_all();
+    }
+  }
+  if (failed) {
+    begin_close(connection);
+  }
+  finish_close(connection);
+}
+
+// Shutting the socket down ends the multishot receive and fails pending
+// sends; the descriptor is closed by finish_close() once both have completed.
+void SocketEngine::begin_close(Connection* connection) {
+  if (connection->closing) {
+    return;
+  }
+  connection->closing = true;
+  {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    connection->closed = true;
+    connection->drained.notify_all();
+  }
+  ::shutdown(connection->fd, SHUT_RDWR);
+}
+
+void SocketEngine::finish_close(Connection* connection) {
+  if (!connection->closing || connection->recv_armed) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    if (connection->sends_in_flight > 0) {
+      return;
+    }
+  }
+
+  std::shared_ptr<Connection> owner;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = connections_.find(connection->fd);
+    if (it != connections_.end() && it->second.get() == connection) {
+      owner = std::move(it->second);
+      connections_.erase(it);
+    }
+  }
+  if (owner) {
+    ::close(connection->fd);
+  }
+}
+
+}  // namespace ipc
+}  // namespace rtos
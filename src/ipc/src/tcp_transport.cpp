@@ -1,92 +1,108 @@
 #include "../include/ipc/tcp_transport.h"
 
+#include "../include/ipc/lz_codec.h"
+
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include <algorithm>
-#include <cstring>
-#include <iostream>
+#include <utility>
 
 namespace rtos {
 namespace ipc {
 
 namespace {
 
-constexpr int kBacklog = 8;
+constexpr int kBacklog = SOMAXCONN;
 
-bool send_all(int socket_fd, const uint8_t* data, size_t length) {
-  size_t sent = 0;
-  while (sent < length) {
-    ssize_t result = ::send(socket_fd, data + sent, length - sent, 0);
-    if (result <= 0) {
-      return false;
-    }
-    sent += static_cast<size_t>(result);
+// With compression on, each frame starts with a flag byte. Compressed frames
+// follow it with the original payload length (4 bytes, big-endian).
+constexpr uint8_t kFrameRaw = 0;
+constexpr uint8_t kFrameCompressed = 1;
+constexpr size_t kCompressedHeaderBytes = 5;
+constexpr size_t kMaxPayloadBytes = 64 * 1024 * 1024;
+
+void append_length(std::vector<uint8_t>* frame, size_t length) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    frame->push_back(static_cast<uint8_t>(length >> shift));
   }
-  return true;
 }
 
-bool recv_all(int socket_fd, uint8_t* data, size_t length) {
-  size_t received = 0;
-  while (received < length) {
-    ssize_t result = ::recv(socket_fd, data + received, length - received, 0);
-    if (result <= 0) {
-      return false;
+// Strips the flag byte and inflates compressed frames into a per-thread
+// buffer that the next frame on the same I/O thread reuses.
+TransportReceiveHandler decompressing(TransportReceiveHandler handler) {
+  return [handler = std::move(handler)](const std::vector<uint8_t>& frame) {
+    thread_local std::vector<uint8_t> payload;
+    if (frame.empty()) {
+      return;
     }
-    received += static_cast<size_t>(result);
-  }
-  return true;
+    if (frame[0] == kFrameRaw) {
+      payload.assign(frame.begin() + 1, frame.end());
+    } else if (frame[0] == kFrameCompressed &&
+               frame.size() >= kCompressedHeaderBytes) {
+      size_t length = 0;
+      for (size_t i = 1; i < kCompressedHeaderBytes; ++i) {
+        length = (length << 8) | frame[i];
+      }
+      if (length > kMaxPayloadBytes ||
+          !lz_decompress(frame.data() + kCompressedHeaderBytes,
+                         frame.size() - kCompressedHeaderBytes, length,
+                         &payload)) {
+        return;
+      }
+    } else {
+      return;
+    }
+    handler(payload);
+  };
 }
 
 }  // namespace
 
-TcpTransport::TcpTransport(TcpTransportConfig config) : config_(std::move(config)) {}
+TcpTransport::TcpTransport(TcpTransportConfig config)
+    : config_(std::move(config)),
+      engine_(engine_config(config_)) {}
 
 TcpTransport::~TcpTransport() {
   stop();
 }
 
 void TcpTransport::start(TransportReceiveHandler handler) {
-  handler_ = std::move(handler);
-  running_.store(true);
-
+  if (config_.compress && handler) {
+    handler = decompressing(std::move(handler));
+  }
   if (config_.is_server) {
-    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd_ < 0) {
-      running_.store(false);
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
       return;
     }
 
     int opt = 1;
-    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(config_.port);
 
-    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+    if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
         0) {
-      close_socket(listen_fd_);
-      running_.store(false);
+      close_socket(listen_fd);
       return;
     }
 
-    if (::listen(listen_fd_, kBacklog) < 0) {
-      close_socket(listen_fd_);
-      running_.store(false);
+    if (::listen(listen_fd, kBacklog) < 0) {
+      close_socket(listen_fd);
       return;
     }
 
-    accept_thread_ = std::thread([this]() { run_accept_loop(); });
+    engine_.start(std::move(handler), listen_fd);
     return;
   }
 
-  server_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd_ < 0) {
-    running_.store(false);
+  int server_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server_fd < 0) {
     return;
   }
 
@@ -94,113 +110,93 @@ void TcpTransport::start(TransportReceiveHandler handler) {
   addr.sin_family = AF_INET;
   addr.sin_port = htons(config_.port);
   if (::inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) <= 0) {
-    close_socket(server_fd_);
-    running_.store(false);
+    close_socket(server_fd);
     return;
   }
 
-  if (::connect(server_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+  if (::connect(server_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
       0) {
-    close_socket(server_fd_);
-    running_.store(false);
+    close_socket(server_fd);
     return;
   }
 
-  client_threads_.emplace_back([this]() { run_receive_loop(server_fd_); });
-}
-
-void TcpTransport::stop() {
-  if (!running_.exchange(false)) {
+  if (!engine_.start(std::move(handler), -1)) {
+    close_socket(server_fd);
     return;
   }
+  engine_.add_connection(server_fd);
+}
 
-  close_socket(listen_fd_);
-  close_socket(server_fd_);
-
-  {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-    for (int& fd : client_fds_) {
-      close_socket(fd);
-    }
-  }
-
-  if (accept_thread_.joinable()) {
-    accept_thread_.join();
-  }
-
-  for (auto& thread : client_threads_) {
-    if (thread.joinable()) {
-      thread.join();
-    }
-  }
-  client_threads_.clear();
+void TcpTransport::stop() {
+  engine_.stop();
 }
 
 bool TcpTransport::publish(const std::vector<uint8_t>& bytes) {
-  if (!running_.load()) {
+  if (!config_.is_server && engine_.connection_count() == 0) {
     return false;
   }
+  return config_.compress ? publish_compressed(bytes) : engine_.publish(bytes);
+}
 
-  if (config_.is_server) {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-    bool ok = true;
-    for (int fd : client_fds_) {
-      ok = send_frame(fd, bytes) && ok;
-    }
-    return ok;
-  }
+TcpCompressionStats TcpTransport::compression_stats() const {
+  TcpCompressionStats stats;
+  stats.compressed_frames = compressed_frames_.load();
+  stats.bypassed_frames = bypassed_frames_.load();
+  stats.input_bytes = compressed_input_bytes_.load();
+  stats.output_bytes = compressed_output_bytes_.load();
+  return stats;
+}
 
-  if (server_fd_ < 0) {
+// Frames are built in a per-thread buffer; the engine copies each one into
+// its own shared frame before publish() returns.
+bool TcpTransport::publish_compressed(const std::vector<uint8_t>& bytes) {
+  thread_local std::vector<uint8_t> frame;
+  if (bytes.empty()) {
     return false;
   }
-  return send_frame(server_fd_, bytes);
-}
-
-void TcpTransport::run_accept_loop() {
-  while (running_.load()) {
-    sockaddr_in client_addr{};
-    socklen_t len = sizeof(client_addr);
-    int client_fd =
-        ::accept(listen_fd_, reinterpret_cast<sockaddr*>(&client_addr), &len);
-    if (client_fd < 0) {
-      continue;
-    }
-
-    {
-      std::lock_guard<std::mutex> lock(socket_mutex_);
-      if (client_fds_.size() >= config_.max_clients) {
-        ::close(client_fd);
-        continue;
+  frame.clear();
+  if (bytes.size() >= config_.compression_threshold &&
+      bytes.size() <= kMaxPayloadBytes) {
+    uint64_t candidate = compression_candidates_.fetch_add(1);
+    if (candidate < bypass_until_.load(std::memory_order_relaxed)) {
+      bypassed_frames_.fetch_add(1);
+    } else {
+      frame.push_back(kFrameCompressed);
+      append_length(&frame, bytes.size());
+      lz_compress(bytes.data(), bytes.size(), &frame);
+      size_t compressed = frame.size() - kCompressedHeaderBytes;
+      if (compressed < bytes.size() * config_.compression_max_ratio) {
+        compressed_frames_.fetch_add(1);
+        compressed_input_bytes_.fetch_add(bytes.size());
+        compressed_output_bytes_.fetch_add(compressed);
+        return engine_.publish(frame);
       }
-      client_fds_.push_back(client_fd);
+      bypass_until_.store(candidate + 1 + config_.compression_bypass_frames,
+                          std::memory_order_relaxed);
+      frame.clear();
     }
-
-    client_threads_.emplace_back([this, client_fd]() {
-      run_receive_loop(client_fd);
-    });
   }
+  frame.reserve(bytes.size() + 1);
+  frame.push_back(kFrameRaw);
+  frame.insert(frame.end(), bytes.begin(), bytes.end());
+  return engine_.publish(frame);
 }
 
-void TcpTransport::run_receive_loop(int socket_fd) {
-  while (running_.load()) {
-    std::vector<uint8_t> frame;
-    if (!recv_frame(socket_fd, &frame)) {
-      break;
-    }
-    if (handler_) {
-      handler_(frame);
-    }
-  }
-  if (config_.is_server) {
-    remove_client_fd(socket_fd);
-  }
-  close_socket(socket_fd);
-}
-
-void TcpTransport::remove_client_fd(int socket_fd) {
-  std::lock_guard<std::mutex> lock(socket_mutex_);
-  auto it = std::remove(client_fds_.begin(), client_fds_.end(), socket_fd);
-  client_fds_.erase(it, client_fds_.end());
+SocketEngineConfig TcpTransport::engine_config(const TcpTransportConfig& config) {
+  SocketEngineConfig engine;
+  engine.backend = config.backend;
+  engine.io_threads = config.io_threads;
+  engine.reactor = config.reactor;
+  engine.max_connections = config.is_server ? config.max_clients : 1;
+  engine.max_queued_bytes = config.max_queued_bytes;
+  engine.overflow_policy = config.overflow_policy;
+  engine.block_timeout = config.block_timeout;
+  engine.send_buffer_bytes = config.send_buffer_bytes;
+  engine.receive_buffer_bytes = config.receive_buffer_bytes;
+  engine.tcp_nodelay = config.tcp_nodelay;
+  engine.tcp_quickack = config.tcp_quickack;
+  engine.zerocopy_threshold = config.zerocopy_threshold;
+  return engine;
 }
 
 void TcpTransport::close_socket(int& socket_fd) {
@@ -210,27 +206,5 @@ void TcpTransport::close_socket(int& socket_fd) {
   }
 }
 
-bool TcpTransport::send_frame(int socket_fd,
-                              const std::vector<uint8_t>& bytes) {
-  uint32_t length = htonl(static_cast<uint32_t>(bytes.size()));
-  if (!send_all(socket_fd, reinterpret_cast<uint8_t*>(&length), sizeof(length))) {
-    return false;
-  }
-  return send_all(socket_fd, bytes.data(), bytes.size());
-}
-
-bool TcpTransport::recv_frame(int socket_fd, std::vector<uint8_t>* bytes) {
-  uint32_t length = 0;
-  if (!recv_all(socket_fd, reinterpret_cast<uint8_t*>(&length), sizeof(length))) {
-    return false;
-  }
-  length = ntohl(length);
-  if (length == 0) {
-    return false;
-  }
-  bytes->resize(length);
-  return recv_all(socket_fd, bytes->data(), length);
-}
-
 }  // namespace ipc
 }  // namespace rtos
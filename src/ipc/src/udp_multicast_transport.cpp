@@ -0,0 +1,699 @@
+#include "../include/ipc/udp_multicast_transport.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <random>
+
+namespace rtos {
+namespace ipc {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x52544D43;  // "RTMC"
+constexpr size_t kHeaderBytes = 40;
+constexpr size_t kIpUdpOverhead = 28;
+constexpr size_t kMaxFragments = UINT16_MAX;
+constexpr size_t kSendBatch = 64;
+constexpr size_t kReceiveBatch = 32;
+constexpr int kBatchesPerWake = 4;
+
+constexpr uint8_t kTypeData = 1;
+constexpr uint8_t kTypeNack = 2;
+constexpr uint8_t kTypeLost = 3;
+constexpr uint8_t kTypeHeartbeat = 4;
+constexpr uint8_t kFlagReliable = 1;
+
+void put16(uint8_t* out, uint16_t value) {
+  value = htobe16(value);
+  std::memcpy(out, &value, sizeof(value));
+}
+
+void put32(uint8_t* out, uint32_t value) {
+  value = htobe32(value);
+  std::memcpy(out, &value, sizeof(value));
+}
+
+void put64(uint8_t* out, uint64_t value) {
+  value = htobe64(value);
+  std::memcpy(out, &value, sizeof(value));
+}
+
+uint16_t get16(const uint8_t* in) {
+  uint16_t value = 0;
+  std::memcpy(&value, in, sizeof(value));
+  return be16toh(value);
+}
+
+uint32_t get32(const uint8_t* in) {
+  uint32_t value = 0;
+  std::memcpy(&value, in, sizeof(value));
+  return be32toh(value);
+}
+
+uint64_t get64(const uint8_t* in) {
+  uint64_t value = 0;
+  std::memcpy(&value, in, sizeof(value));
+  return be64toh(value);
+}
+
+}  // namespace
+
+// Every datagram starts with this header. For data, |sequence| is the
+// reliable sequence number; NACK and LOST name the first sequence of a range
+// of |count|; a heartbeat announces the next sequence the sender will use.
+struct UdpMulticastTransport::Header {
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  uint16_t fragment_index = 0;
+  uint16_t fragment_count = 0;
+  uint16_t fragment_bytes = 0;
+  uint32_t sender = 0;
+  uint64_t message_id = 0;
+  uint64_t sequence = 0;
+  uint32_t count = 0;  // Message bytes for data, range length otherwise.
+
+  void encode(uint8_t* out) const {
+    put32(out, kMagic);
+    out[4] = type;
+    out[5] = flags;
+    put16(out + 6, fragment_index);
+    put16(out + 8, fragment_count);
+    put16(out + 10, fragment_bytes);
+    put32(out + 12, sender);
+    put64(out + 16, message_id);
+    put64(out + 24, sequence);
+    put32(out + 32, count);
+    put32(out + 36, 0);
+  }
+
+  bool decode(const uint8_t* in, size_t length) {
+    if (length < kHeaderBytes || get32(in) != kMagic) {
+      return false;
+    }
+    type = in[4];
+    flags = in[5];
+    fragment_index = get16(in + 6);
+    fragment_count = get16(in + 8);
+    fragment_bytes = get16(in + 10);
+    sender = get32(in + 12);
+    message_id = get64(in + 16);
+    sequence = get64(in + 24);
+    count = get32(in + 32);
+    return true;
+  }
+};
+
+UdpMulticastTransport::UdpMulticastTransport(UdpMulticastConfig config)
+    : config_(std::move(config)) {
+  std::random_device random;
+  do {
+    sender_id_ = random();
+  } while (sender_id_ == 0);
+}
+
+UdpMulticastTransport::~UdpMulticastTransport() {
+  stop();
+}
+
+void UdpMulticastTransport::start(TransportReceiveHandler handler) {
+  if (running_.load()) {
+    return;
+  }
+  if (config_.mtu <= kIpUdpOverhead + kHeaderBytes) {
+    return;
+  }
+  fragment_bytes_ = std::min<size_t>(
+      config_.mtu - kIpUdpOverhead - kHeaderBytes, UINT16_MAX);
+  if (!open_sockets()) {
+    close_sockets();
+    return;
+  }
+
+  handler_ = std::move(handler);
+  receive_buffers_.resize(kReceiveBatch * config_.mtu);
+  next_heartbeat_ = Clock::now();
+  running_.store(true);
+  thread_ = std::thread([this]() { run(); });
+}
+
+void UdpMulticastTransport::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  uint64_t one = 1;
+  if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+    // The eventfd counter cannot overflow from a single write.
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  close_sockets();
+  peers_.clear();
+  partials_.clear();
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  history_.clear();
+}
+
+bool UdpMulticastTransport::publish(const std::vector<uint8_t>& bytes) {
+  return publish_message(config_.reliable, bytes);
+}
+
+bool UdpMulticastTransport::publish_topic(const std::string& topic,
+                                          const std::vector<uint8_t>& bytes) {
+  return publish_message(is_reliable(topic), bytes);
+}
+
+UdpMulticastStats UdpMulticastTransport::stats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return stats_;
+}
+
+bool UdpMulticastTransport::publish_message(bool reliable,
+                                            const std::vector<uint8_t>& bytes) {
+  if (!running_.load() || bytes.empty() ||
+      bytes.size() > config_.max_message_bytes ||
+      bytes.size() > kMaxFragments * fragment_bytes_) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  uint64_t message_id = next_message_id_++;
+  uint64_t sequence = 0;
+  if (reliable) {
+    sequence = next_sequence_++;
+    history_.push_back(SentMessage{
+        sequence, message_id,
+        std::make_shared<const std::vector<uint8_t>>(bytes)});
+    while (history_.size() > config_.history_messages) {
+      history_.pop_front();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    ++stats_.sent_messages;
+  }
+  // A reliable message that fails to send is still repaired on NACK.
+  return send_locked(bytes, message_id, sequence, reliable, group_address_);
+}
+
+bool UdpMulticastTransport::open_sockets() {
+  group_address_ = sockaddr_in{};
+  group_address_.sin_family = AF_INET;
+  group_address_.sin_port = htons(config_.port);
+  in_addr interface_address{};
+  if (::inet_pton(AF_INET, config_.group.c_str(), &group_address_.sin_addr) !=
+          1 ||
+      ::inet_pton(AF_INET, config_.interface_address.c_str(),
+                  &interface_address) != 1) {
+    return false;
+  }
+
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  data_fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  control_fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (wake_fd_ < 0 || data_fd_ < 0 || control_fd_ < 0) {
+    return false;
+  }
+
+  // Several receivers on one host share the group port.
+  int one = 1;
+  int zero = 0;
+  ::setsockopt(data_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  ::setsockopt(data_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  if (config_.receive_buffer_bytes > 0) {
+    ::setsockopt(data_fd_, SOL_SOCKET, SO_RCVBUF, &config_.receive_buffer_bytes,
+                 sizeof(config_.receive_buffer_bytes));
+  }
+  ip_mreq membership{};
+  membership.imr_multiaddr = group_address_.sin_addr;
+  membership.imr_interface = interface_address;
+  if (::bind(data_fd_, reinterpret_cast<const sockaddr*>(&group_address_),
+             sizeof(group_address_)) != 0 ||
+      ::setsockopt(data_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+                   sizeof(membership)) != 0) {
+    return false;
+  }
+  ::setsockopt(data_fd_, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof(zero));
+
+  sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_addr = interface_address;
+  int loop = config_.loopback ? 1 : 0;
+  int ttl = config_.ttl;
+  int pmtu = IP_PMTUDISC_DO;
+  if (::bind(control_fd_, reinterpret_cast<const sockaddr*>(&local),
+             sizeof(local)) != 0 ||
+      ::setsockopt(control_fd_, IPPROTO_IP, IP_MULTICAST_IF,
+                   &interface_address, sizeof(interface_address)) != 0) {
+    return false;
+  }
+  ::setsockopt(control_fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  ::setsockopt(control_fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  ::setsockopt(control_fd_, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu, sizeof(pmtu));
+  return true;
+}
+
+void UdpMulticastTransport::close_sockets() {
+  for (int* fd : {&data_fd_, &control_fd_, &wake_fd_}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void UdpMulticastTransport::run() {
+  pollfd fds[3] = {{data_fd_, POLLIN, 0},
+                   {control_fd_, POLLIN, 0},
+                   {wake_fd_, POLLIN, 0}};
+  while (running_.load()) {
+    Clock::time_point now = Clock::now();
+    Clock::time_point next = service_timers(now);
+    auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - now);
+    int timeout = static_cast<int>(std::max<int64_t>(0, wait.count()));
+    int ready = ::poll(fds, 3, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      receive_batch(data_fd_);
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+      receive_batch(control_fd_);
+    }
+  }
+}
+
+// Datagrams larger than the configured MTU are truncated and dropped, so
+// every member of a group must use the same mtu.
+void UdpMulticastTransport::receive_batch(int fd) {
+  size_t slot_bytes = config_.mtu;
+  mmsghdr packets[kReceiveBatch];
+  iovec iov[kReceiveBatch];
+  sockaddr_in sources[kReceiveBatch];
+  for (int round = 0; round < kBatchesPerWake && running_.load(); ++round) {
+    for (size_t i = 0; i < kReceiveBatch; ++i) {
+      iov[i].iov_base = receive_buffers_.data() + i * slot_bytes;
+      iov[i].iov_len = slot_bytes;
+      packets[i] = mmsghdr{};
+      packets[i].msg_hdr.msg_name = &sources[i];
+      packets[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+      packets[i].msg_hdr.msg_iov = &iov[i];
+      packets[i].msg_hdr.msg_iovlen = 1;
+    }
+    int count = ::recvmmsg(fd, packets, kReceiveBatch, MSG_DONTWAIT, nullptr);
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.receive_calls;
+      stats_.received_datagrams += count > 0 ? static_cast<size_t>(count) : 0;
+    }
+    if (count <= 0) {
+      return;
+    }
+    for (int i = 0; i < count; ++i) {
+      if ((packets[i].msg_hdr.msg_flags & MSG_TRUNC) == 0) {
+        on_datagram(static_cast<const uint8_t*>(iov[i].iov_base),
+                    packets[i].msg_len, sources[i]);
+      }
+    }
+    if (static_cast<size_t>(count) < kReceiveBatch) {
+      return;
+    }
+  }
+}
+
+void UdpMulticastTransport::on_datagram(const uint8_t* data, size_t length,
+                                        const sockaddr_in& from) {
+  Header header;
+  if (!header.decode(data, length)) {
+    return;
+  }
+  switch (header.type) {
+    case kTypeData:
+      if (header.sender != sender_id_) {
+        on_fragment(header, data + kHeaderBytes, length - kHeaderBytes, from);
+      }
+      break;
+    case kTypeHeartbeat:
+      if (header.sender != sender_id_) {
+        Peer& peer = peers_[header.sender];
+        peer.address = from;
+        on_sequence_hint(peer, header.sequence);
+      }
+      break;
+    case kTypeNack:
+      // Addressed by sender id, since receivers NACK the publisher directly.
+      if (header.sender == sender_id_) {
+        on_nack(header, from);
+      }
+      break;
+    case kTypeLost: {
+      auto it = peers_.find(header.sender);
+      if (it != peers_.end() && header.sequence <= it->second.expected) {
+        skip_to(it->second, header.sequence + header.count);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void UdpMulticastTransport::on_fragment(const Header& header,
+                                        const uint8_t* body, size_t length,
+                                        const sockaddr_in& from) {
+  bool reliable = (header.flags & kFlagReliable) != 0;
+  Peer* peer = nullptr;
+  if (reliable) {
+    peer = &peers_[header.sender];
+    peer->address = from;
+    if (!peer->synced) {
+      // A late joiner starts at the first message it hears.
+      on_sequence_hint(*peer, header.sequence);
+    }
+    if (header.sequence < peer->expected ||
+        peer->pending.count(header.sequence) != 0) {
+      return;
+    }
+    on_sequence_hint(*peer, header.sequence + 1);
+  }
+
+  size_t message_bytes = header.count;
+  size_t offset = static_cast<size_t>(header.fragment_index) *
+                  header.fragment_bytes;
+  bool last = header.fragment_index + 1 == header.fragment_count;
+  if (header.fragment_index >= header.fragment_count ||
+      message_bytes > config_.max_message_bytes ||
+      offset + length > message_bytes ||
+      (last ? offset + length != message_bytes
+            : length != header.fragment_bytes)) {
+    return;
+  }
+
+  if (header.fragment_count == 1) {
+    std::vector<uint8_t> bytes(body, body + length);
+    if (reliable) {
+      accept_reliable(*peer, header.sequence, std::move(bytes));
+    } else {
+      deliver(bytes);
+    }
+    return;
+  }
+
+  auto key = std::make_pair(header.sender, header.message_id);
+  auto inserted = partials_.try_emplace(key);
+  Partial& partial = inserted.first->second;
+  if (inserted.second) {
+    partial.bytes.resize(message_bytes);
+    partial.received.assign(header.fragment_count, false);
+    partial.remaining = header.fragment_count;
+    partial.reliable = reliable;
+    partial.sequence = header.sequence;
+    partial.started = Clock::now();
+  }
+  if (partial.bytes.size() != message_bytes ||
+      partial.received.size() != header.fragment_count) {
+    return;
+  }
+  if (!partial.received[header.fragment_index]) {
+    std::memcpy(partial.bytes.data() + offset, body, length);
+    partial.received[header.fragment_index] = true;
+    --partial.remaining;
+  }
+  if (partial.remaining > 0) {
+    return;
+  }
+
+  std::vector<uint8_t> bytes = std::move(partial.bytes);
+  partials_.erase(inserted.first);
+  if (reliable) {
+    accept_reliable(*peer, header.sequence, std::move(bytes));
+  } else {
+    deliver(bytes);
+  }
+}
+
+// Repairs go straight back to the receiver that asked. Sequences that have
+// left the history are reported lost so the receiver stops waiting.
+void UdpMulticastTransport::on_nack(const Header& header,
+                                    const sockaddr_in& from) {
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  uint64_t first = header.sequence;
+  uint64_t end = first + std::min<uint64_t>(header.count,
+                                            config_.history_messages);
+  uint64_t oldest =
+      history_.empty() ? next_sequence_ : history_.front().sequence;
+  {
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    ++stats_.nacks_received;
+  }
+  if (first < oldest) {
+    send_control_locked(kTypeLost, sender_id_, first,
+                        static_cast<uint32_t>(std::min(end, oldest) - first),
+                        from);
+  }
+  for (uint64_t sequence = std::max(first, oldest);
+       sequence < std::min(end, next_sequence_); ++sequence) {
+    const SentMessage& message = history_[sequence - oldest];
+    send_locked(*message.bytes, message.message_id, message.sequence, true,
+                from);
+    std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+    ++stats_.retransmitted_messages;
+  }
+}
+
+// |end| is one past the highest sequence the publisher has used. Anything
+// between the next expected sequence and it is a gap to repair.
+void UdpMulticastTransport::on_sequence_hint(Peer& peer, uint64_t end) {
+  if (!peer.synced) {
+    peer.synced = true;
+    peer.expected = end;
+    peer.known_end = end;
+    return;
+  }
+  if (end > peer.known_end) {
+    if (peer.expected == peer.known_end) {
+      peer.gap_since = Clock::now();
+      peer.nacks = 0;
+    }
+    peer.known_end = end;
+  }
+}
+
+void UdpMulticastTransport::accept_reliable(Peer& peer, uint64_t sequence,
+                                            std::vector<uint8_t> bytes) {
+  if (sequence < peer.expected) {
+    return;
+  }
+  if (sequence > peer.expected) {
+    if (peer.pending.size() < config_.history_messages) {
+      peer.pending.emplace(sequence, std::move(bytes));
+    }
+    return;
+  }
+  deliver(bytes);
+  ++peer.expected;
+  skip_to(peer, peer.expected);
+}
+
+// Moves delivery up to |sequence|, handing over what arrived and counting the
+// rest lost, then delivers whatever follows without a gap.
+void UdpMulticastTransport::skip_to(Peer& peer, uint64_t sequence) {
+  sequence = std::min(sequence, peer.known_end);
+  uint64_t lost = 0;
+  while (peer.expected < sequence) {
+    auto next = peer.pending.begin();
+    if (next != peer.pending.end() && next->first == peer.expected) {
+      deliver(next->second);
+      peer.pending.erase(next);
+      ++peer.expected;
+      continue;
+    }
+    uint64_t stop = next == peer.pending.end()
+                        ? sequence
+                        : std::min(next->first, sequence);
+    lost += stop - peer.expected;
+    peer.expected = stop;
+  }
+  while (!peer.pending.empty() &&
+         peer.pending.begin()->first == peer.expected) {
+    deliver(peer.pending.begin()->second);
+    peer.pending.erase(peer.pending.begin());
+    ++peer.expected;
+  }
+  peer.gap_since = Clock::now();
+  peer.nacks = 0;
+  if (lost > 0) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.lost_messages += lost;
+  }
+}
+
+void UdpMulticastTransport::deliver(const std::vector<uint8_t>& bytes) {
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.received_messages;
+  }
+  if (handler_) {
+    handler_(bytes);
+  }
+}
+
+// Sends heartbeats and NACKs that are due, expires stale fragments, and
+// returns when it next needs to run.
+UdpMulticastTransport::Clock::time_point UdpMulticastTransport::service_timers(
+    Clock::time_point now) {
+  Clock::time_point next = now + config_.heartbeat_interval;
+
+  if (config_.reliable || !config_.reliable_topics.empty()) {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (now >= next_heartbeat_) {
+      send_control_locked(kTypeHeartbeat, sender_id_, next_sequence_, 0,
+                          group_address_);
+      next_heartbeat_ = now + config_.heartbeat_interval;
+    }
+    next = std::min(next, next_heartbeat_);
+  }
+
+  for (auto& entry : peers_) {
+    Peer& peer = entry.second;
+    if (peer.expected >= peer.known_end) {
+      continue;
+    }
+    Clock::time_point due = std::max(peer.gap_since + config_.nack_delay,
+                                     peer.last_nack + config_.nack_interval);
+    if (now < due) {
+      next = std::min(next, due);
+      continue;
+    }
+    uint64_t stop =
+        peer.pending.empty() ? peer.known_end : peer.pending.begin()->first;
+    if (peer.nacks >= config_.nack_retries) {
+      skip_to(peer, stop);
+      next = now;
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(send_mutex_);
+      send_control_locked(kTypeNack, entry.first, peer.expected,
+                          static_cast<uint32_t>(std::min<uint64_t>(
+                              stop - peer.expected, UINT32_MAX)),
+                          peer.address);
+    }
+    ++peer.nacks;
+    peer.last_nack = now;
+    next = std::min(next, now + config_.nack_interval);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.nacks_sent;
+  }
+
+  for (auto it = partials_.begin(); it != partials_.end();) {
+    if (now - it->second.started < config_.reassembly_timeout) {
+      ++it;
+      continue;
+    }
+    if (!it->second.reliable) {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.expired_messages;
+    }
+    it = partials_.erase(it);
+  }
+  return next;
+}
+
+// Fragments leave kSendBatch at a time through sendmmsg(). Each datagram is
+// gathered from its header and a slice of |bytes|, so nothing is copied.
+bool UdpMulticastTransport::send_locked(const std::vector<uint8_t>& bytes,
+                                        uint64_t message_id, uint64_t sequence,
+                                        bool reliable, const sockaddr_in& to) {
+  size_t count = (bytes.size() + fragment_bytes_ - 1) / fragment_bytes_;
+  uint8_t headers[kSendBatch][kHeaderBytes];
+  iovec iov[kSendBatch][2];
+  mmsghdr packets[kSendBatch];
+  uint64_t send_calls = 0;
+  bool ok = true;
+  for (size_t start = 0; start < count && ok; start += kSendBatch) {
+    size_t batch = std::min(kSendBatch, count - start);
+    for (size_t i = 0; i < batch; ++i) {
+      size_t index = start + i;
+      size_t offset = index * fragment_bytes_;
+      Header header;
+      header.type = kTypeData;
+      header.flags = reliable ? kFlagReliable : 0;
+      header.fragment_index = static_cast<uint16_t>(index);
+      header.fragment_count = static_cast<uint16_t>(count);
+      header.fragment_bytes = static_cast<uint16_t>(fragment_bytes_);
+      header.sender = sender_id_;
+      header.message_id = message_id;
+      header.sequence = sequence;
+      header.count = static_cast<uint32_t>(bytes.size());
+      header.encode(headers[i]);
+
+      iov[i][0].iov_base = headers[i];
+      iov[i][0].iov_len = kHeaderBytes;
+      iov[i][1].iov_base = const_cast<uint8_t*>(bytes.data()) + offset;
+      iov[i][1].iov_len = std::min(fragment_bytes_, bytes.size() - offset);
+      packets[i] = mmsghdr{};
+      packets[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&to);
+      packets[i].msg_hdr.msg_namelen = sizeof(to);
+      packets[i].msg_hdr.msg_iov = iov[i];
+      packets[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    size_t sent = 0;
+    while (sent < batch) {
+      int result = ::sendmmsg(control_fd_, packets + sent,
+                              static_cast<unsigned>(batch - sent), 0);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        ok = false;
+        break;
+      }
+      ++send_calls;
+      sent += static_cast<size_t>(result);
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.sent_datagrams += sent;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.send_calls += send_calls;
+  return ok;
+}
+
+void UdpMulticastTransport::send_control_locked(uint8_t type, uint32_t sender,
+                                                uint64_t sequence,
+                                                uint32_t count,
+                                                const sockaddr_in& to) {
+  uint8_t datagram[kHeaderBytes];
+  Header header;
+  header.type = type;
+  header.sender = sender;
+  header.sequence = sequence;
+  header.count = count;
+  header.encode(datagram);
+  ::sendto(control_fd_, datagram, sizeof(datagram), 0,
+           reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+}
+
+bool UdpMulticastTransport::is_reliable(const std::string& topic) const {
+  return config_.reliable ||
+         std::find(config_.reliable_topics.begin(),
+                   config_.reliable_topics.end(),
+                   topic) != config_.reliable_topics.end();
+}
+
+}  // namespace ipc
+}  // namespace rtos
@@ -1,7 +1,528 @@
 #include "../include/ipc/ipc_bus.h"
 
+#include "../include/ipc/binary_serializer.h"
+#include "../include/ipc/ipc_runtime.h"
+#include "../include/ipc/local_transport.h"
+#include "../include/ipc/tcp_transport.h"
+
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t kTestPort = 55751;
+
+size_t thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Threads:", 0) == 0) {
+      return std::stoul(line.substr(8));
+    }
+  }
+  return 0;
+}
+
+bool wait_until(const std::function<bool()>& done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return done();
+}
+
+// Counts what the bus sends and never answers, so at-least-once messages
+// are resent until their retries run out.
+class SilentTransport final : public rtos::ipc::IpcTransport {
+ public:
+  void start(rtos::ipc::TransportReceiveHandler) override {}
+  void stop() override {}
+  bool publish(const std::vector<uint8_t>&) override {
+    sent.fetch_add(1);
+    return true;
+  }
+
+  std::atomic<size_t> sent{0};
+};
+
+// Buses start no threads until they need one, and with a runtime they never
+// do: retries run on its timer thread and handlers on its executor.
+void shared_runtime() {
+  size_t threads_before = thread_count();
+  {
+    rtos::ipc::IpcBus own;
+    own.subscribe("cmd", [](const rtos::ipc::IpcMessage&) {});
+    rtos::ipc::IpcMessage command;
+    command.topic = "cmd";
+    own.publish(command);
+    assert(thread_count() == threads_before);
+    command.qos = rtos::ipc::DeliveryQos::kAtLeastOnce;
+    own.publish(command);
+    assert(thread_count() == threads_before + 1);
+  }
+
+  rtos::ipc::IpcRuntimeConfig config;
+  config.dispatch_threads = 2;
+  rtos::ipc::IpcRuntime runtime(config);
+  runtime.start();
+  threads_before = thread_count();
+
+  rtos::ipc::IpcBus::Options options;
+  options.runtime = &runtime;
+  constexpr size_t kBuses = 14;
+  constexpr uint64_t kMessages = 50;
+  std::vector<std::unique_ptr<rtos::ipc::IpcBus>> buses;
+  std::vector<std::unique_ptr<std::atomic<uint64_t>>> last(kBuses);
+  std::atomic<size_t> inline_calls{0};
+  std::thread::id publisher = std::this_thread::get_id();
+  for (size_t i = 0; i < kBuses; ++i) {
+    buses.push_back(std::make_unique<rtos::ipc::IpcBus>(
+        std::make_unique<rtos::ipc::LocalTransport>(),
+        std::make_unique<rtos::ipc::BinarySerializer>(), options));
+    last[i] = std::make_unique<std::atomic<uint64_t>>(0);
+    auto* seen = last[i].get();
+    buses[i]->subscribe("cmd", [&, seen](const rtos::ipc::IpcMessage& msg) {
+      inline_calls += std::this_thread::get_id() == publisher ? 1 : 0;
+      // Each bus's messages stay in publish order.
+      assert(msg.sequence == seen->load() + 1);
+      seen->store(msg.sequence);
+    });
+  }
+  for (uint64_t sequence = 1; sequence <= kMessages; ++sequence) {
+    for (auto& bus : buses) {
+      rtos::ipc::IpcMessage command;
+      command.topic = "cmd";
+      command.qos = rtos::ipc::DeliveryQos::kAtLeastOnce;
+      bus->publish(command);
+    }
+  }
+  bool delivered = wait_until([&]() {
+    for (auto& seen : last) {
+      if (seen->load() != kMessages) {
+        return false;
+      }
+    }
+    return true;
+  });
+  assert(delivered);
+  assert(inline_calls.load() == 0);
+  assert(thread_count() == threads_before);
+
+  // Unanswered messages are retried from the runtime's timer.
+  options.retry_count = 3;
+  options.retry_interval = std::chrono::milliseconds(5);
+  auto silent = std::make_unique<SilentTransport>();
+  auto* sent = &silent->sent;
+  rtos::ipc::IpcBus unanswered(std::move(silent),
+                               std::make_unique<rtos::ipc::BinarySerializer>(),
+                               options);
+  rtos::ipc::IpcMessage command;
+  command.topic = "cmd";
+  command.qos = rtos::ipc::DeliveryQos::kAtLeastOnce;
+  unanswered.publish(command);
+  bool retried = wait_until([&]() { return sent->load() == 4; });
+  assert(retried);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  assert(sent->load() == 4);
+  assert(thread_count() == threads_before);
+
+  buses.clear();
+}
+
+// Counts serializations, which the publisher skips for decimated messages,
+// and optionally the bytes they produce.
+class CountingSerializer final : public rtos::ipc::IpcSerializer {
+ public:
+  explicit CountingSerializer(std::atomic<size_t>* count,
+                              std::atomic<size_t>* bytes = nullptr)
+      : count_(count), bytes_(bytes) {}
+
+  std::vector<uint8_t> serialize(
+      const rtos::ipc::IpcMessage& message) const override {
+    count_->fetch_add(1);
+    auto serialized = inner_.serialize(message);
+    if (bytes_) {
+      bytes_->fetch_add(serialized.size());
+    }
+    return serialized;
+  }
+  bool deserialize(const std::vector<uint8_t>& bytes,
+                   rtos::ipc::IpcMessage* message) const override {
+    return inner_.deserialize(bytes, message);
+  }
+
+ private:
+  rtos::ipc::BinarySerializer inner_;
+  std::atomic<size_t>* count_;
+  std::atomic<size_t>* bytes_;
+};
+
+struct Received {
+  std::atomic<size_t> count{0};
+  std::atomic<uint32_t> last{0};
+
+  rtos::ipc::IpcHandler handler() {
+    return [this](const rtos::ipc::IpcMessage& msg) {
+      last.store(msg.payload.empty() ? 0 : msg.payload[0]);
+      count.fetch_add(1);
+    };
+  }
+};
+
+// Publishes kRateMessages numbered messages about a millisecond apart and
+// returns how long that took.
+constexpr size_t kRateMessages = 200;
+
+std::chrono::milliseconds publish_burst(rtos::ipc::IpcBus* bus,
+                                        const std::string& topic) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 1; i <= kRateMessages; ++i) {
+    rtos::ipc::IpcMessage message;
+    message.topic = topic;
+    message.payload = {static_cast<uint8_t>(i)};
+    bus->publish(std::move(message));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+}
+
+// At most one delivery per interval, plus the first message.
+size_t max_deliveries(std::chrono::milliseconds elapsed,
+                      std::chrono::milliseconds interval) {
+  return static_cast<size_t>(elapsed.count() * 10 / (interval.count() * 9)) +
+         1;
+}
+
+// Each subscriber gets its own rate on a shared topic; with only limited
+// subscribers the publisher drops messages before serializing them.
+void rate_limits() {
+  using rtos::ipc::IpcBus;
+  constexpr std::chrono::milliseconds kInterval(20);
+  std::atomic<size_t> serialized{0};
+  IpcBus::Options options;
+  options.in_process_fast_path = false;
+  IpcBus bus(std::make_unique<rtos::ipc::LocalTransport>(),
+             std::make_unique<CountingSerializer>(&serialized), options);
+
+  Received sampled;
+  Received latest;
+  Received full;
+  bus.subscribe("joint", sampled.handler(), IpcBus::SubscribeOptions(kInterval));
+  bus.subscribe("joint", latest.handler(),
+                IpcBus::SubscribeOptions(kInterval, true));
+  uint64_t full_id = bus.subscribe("joint", full.handler());
+  auto elapsed = publish_burst(&bus, "joint");
+  assert(full.count.load() == kRateMessages);
+  assert(serialized.load() == kRateMessages);
+  assert(sampled.count.load() >= 2);
+  assert(sampled.count.load() <= max_deliveries(elapsed, kInterval));
+  // The last message was held back and arrives once its interval ends.
+  bool flushed =
+      wait_until([&]() { return latest.last.load() == kRateMessages; });
+  assert(flushed);
+  assert(latest.count.load() <= max_deliveries(elapsed, kInterval) + 1);
+
+  bus.unsubscribe(full_id);
+  serialized.store(0);
+  sampled.count.store(0);
+  elapsed = publish_burst(&bus, "joint");
+  assert(serialized.load() <= max_deliveries(elapsed, kInterval) + 1);
+  assert(sampled.count.load() >= 2);
+}
+
+// Subscribers announce their rates to a publisher in another bus, which
+// stops sending what no subscriber wants, unless one of them takes
+// everything.
+void announced_rates() {
+  using rtos::ipc::IpcBus;
+  constexpr std::chrono::milliseconds kInterval(20);
+  IpcBus::Options options;
+  options.announce_rates = true;
+  options.rate_refresh = std::chrono::milliseconds(50);
+
+  auto server = std::make_unique<rtos::ipc::TcpTransport>(
+      rtos::ipc::TcpTransportConfig{true, "127.0.0.1", kTestPort, 2});
+  auto* server_transport = server.get();
+  IpcBus publisher(std::move(server),
+                   std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  IpcBus dashboard(std::make_unique<rtos::ipc::TcpTransport>(
+                       rtos::ipc::TcpTransportConfig{false, "127.0.0.1",
+                                                     kTestPort, 1}),
+                   std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  Received sampled;
+  dashboard.subscribe("joint", sampled.handler(),
+                      IpcBus::SubscribeOptions(kInterval, true));
+  // Wait for the next refresh to reach the publisher.
+  std::this_thread::sleep_for(options.rate_refresh * 2);
+
+  auto frames = [&]() {
+    size_t sent = 0;
+    for (const auto& stats : server_transport->connection_stats()) {
+      sent = std::max<size_t>(sent, stats.sent_frames);
+    }
+    return sent;
+  };
+  auto elapsed = publish_burst(&publisher, "joint");
+  bool delivered =
+      wait_until([&]() { return sampled.last.load() == kRateMessages; });
+  assert(delivered);
+  assert(frames() <= max_deliveries(elapsed, kInterval) + 2);
+  assert(sampled.count.load() <= max_deliveries(elapsed, kInterval) + 1);
+
+  // A second subscriber that wants every message turns decimation off.
+  IpcBus logger(std::make_unique<rtos::ipc::TcpTransport>(
+                    rtos::ipc::TcpTransportConfig{false, "127.0.0.1",
+                                                  kTestPort, 1}),
+                std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  Received full;
+  logger.subscribe("joint", full.handler());
+  bool connected =
+      wait_until([&]() { return server_transport->connection_count() == 2; });
+  assert(connected);
+  std::this_thread::sleep_for(options.rate_refresh * 2);
+  publish_burst(&publisher, "joint");
+  delivered = wait_until([&]() { return full.count.load() == kRateMessages; });
+  assert(delivered);
+}
+
+// A 2 KB state blob in which message i changes a handful of bytes.
+std::vector<uint8_t> state_blob(uint32_t i) {
+  std::vector<uint8_t> blob(2048);
+  for (size_t k = 0; k < blob.size(); ++k) {
+    blob[k] = static_cast<uint8_t>(k * 7);
+  }
+  std::memcpy(blob.data(), &i, sizeof(i));
+  blob[64 + (i % 32) * 8] = static_cast<uint8_t>(~i);
+  return blob;
+}
+
+uint32_t blob_index(const std::vector<uint8_t>& blob) {
+  uint32_t i = 0;
+  std::memcpy(&i, blob.data(), sizeof(i));
+  return i;
+}
+
+// Records the index of every state blob delivered and checks its contents.
+struct StateLog {
+  std::mutex mutex;
+  std::vector<uint32_t> indices;
+
+  rtos::ipc::IpcHandler handler() {
+    return [this](const rtos::ipc::IpcMessage& msg) {
+      assert(msg.payload.size() == 2048);
+      uint32_t i = blob_index(msg.payload);
+      assert(msg.payload == state_blob(i));
+      std::lock_guard<std::mutex> lock(mutex);
+      indices.push_back(i);
+    };
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return indices.size();
+  }
+};
+
+// Delta topics send only what changed, and the subscriber across TCP still
+// sees every blob exactly as published.
+void delta_topics() {
+  using rtos::ipc::IpcBus;
+  constexpr uint32_t kMessages = 200;
+  IpcBus::Options options;
+  options.delta_topics = {"state"};
+  options.delta_keyframe_interval = 50;
+
+  std::atomic<size_t> serialized{0};
+  std::atomic<size_t> bytes{0};
+  auto server = std::make_unique<rtos::ipc::TcpTransport>(
+      rtos::ipc::TcpTransportConfig{true, "127.0.0.1", kTestPort + 1, 1});
+  auto* server_transport = server.get();
+  IpcBus publisher(std::move(server),
+                   std::make_unique<CountingSerializer>(&serialized, &bytes),
+                   options);
+  IpcBus subscriber(std::make_unique<rtos::ipc::TcpTransport>(
+                        rtos::ipc::TcpTransportConfig{false, "127.0.0.1",
+                                                      kTestPort + 1, 1}),
+                    std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  StateLog log;
+  subscriber.subscribe("state", log.handler());
+  bool connected =
+      wait_until([&]() { return server_transport->connection_count() == 1; });
+  assert(connected);
+
+  for (uint32_t i = 1; i <= kMessages; ++i) {
+    rtos::ipc::IpcMessage message;
+    message.topic = "state";
+    message.payload = state_blob(i);
+    publisher.publish(std::move(message));
+  }
+  bool delivered = wait_until([&]() { return log.size() == kMessages; });
+  assert(delivered);
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    assert(log.indices[i] == i + 1);
+  }
+  // Four keyframes and small deltas instead of 200 full blobs.
+  assert(bytes.load() < kMessages * 2048 / 10);
+
+  // Topics not listed are sent whole.
+  Received plain;
+  subscriber.subscribe("plain", plain.handler());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bytes.store(0);
+  rtos::ipc::IpcMessage message;
+  message.topic = "plain";
+  message.payload = state_blob(1);
+  publisher.publish(std::move(message));
+  delivered = wait_until([&]() { return plain.count.load() == 1; });
+  assert(delivered);
+  assert(bytes.load() > 2048);
+}
+
+// Loops bytes straight back to the bus, dropping every seventh frame.
+class LossyTransport final : public rtos::ipc::IpcTransport {
+ public:
+  void start(rtos::ipc::TransportReceiveHandler handler) override {
+    handler_ = std::move(handler);
+  }
+  void stop() override {}
+  bool publish(const std::vector<uint8_t>& bytes) override {
+    if (++frames_ % 7 != 0 && handler_) {
+      handler_(bytes);
+    }
+    return true;
+  }
+
+ private:
+  rtos::ipc::TransportReceiveHandler handler_;
+  size_t frames_ = 0;
+};
+
+// A lost delta is never applied to the wrong base: the stream goes quiet
+// until the next keyframe and resumes from there.
+void delta_recovery() {
+  using rtos::ipc::IpcBus;
+  // Message 98 is dropped; 101 is the keyframe after it.
+  constexpr uint32_t kMessages = 101;
+  constexpr uint32_t kKeyframeInterval = 10;
+  IpcBus::Options options;
+  options.delta_topics = {"state"};
+  options.delta_keyframe_interval = kKeyframeInterval;
+  IpcBus bus(std::make_unique<LossyTransport>(),
+             std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  StateLog log;
+  bus.subscribe("state", log.handler());
+
+  for (uint32_t i = 1; i <= kMessages; ++i) {
+    rtos::ipc::IpcMessage message;
+    message.topic = "state";
+    message.payload = state_blob(i);
+    bus.publish(std::move(message));
+  }
+
+  std::vector<uint32_t> expected;
+  bool synced = true;
+  for (uint32_t i = 1; i <= kMessages; ++i) {
+    bool keyframe = i % kKeyframeInterval == 1;
+    bool dropped = i % 7 == 0;
+    synced = !dropped && (synced || keyframe);
+    if (synced) {
+      expected.push_back(i);
+    }
+  }
+  assert(log.indices == expected);
+  assert(expected.size() < kMessages);
+  assert(log.indices.back() == kMessages);
+}
+
+// Keeps what a bus publishes, for the test to hand to another bus.
+class CaptureTransport final : public rtos::ipc::IpcTransport {
+ public:
+  void start(rtos::ipc::TransportReceiveHandler handler) override {
+    handler_ = std::move(handler);
+  }
+  void stop() override {}
+  bool publish(const std::vector<uint8_t>& bytes) override {
+    frames.push_back(bytes);
+    return true;
+  }
+  void deliver(const std::vector<uint8_t>& bytes) { handler_(bytes); }
+
+  std::vector<std::vector<uint8_t>> frames;
+
+ private:
+  rtos::ipc::TransportReceiveHandler handler_;
+};
+
+// A subscriber drops the delta state of senders it has not heard from in a
+// while, or of the least recent one past its cap; a forgotten sender's
+// deltas are skipped until its next keyframe.
+void delta_eviction() {
+  using rtos::ipc::IpcBus;
+  IpcBus::Options options;
+  options.delta_topics = {"state"};
+  options.delta_keyframe_interval = 3;
+  auto publish = [](IpcBus* bus, uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      rtos::ipc::IpcMessage message;
+      message.topic = "state";
+      message.payload = state_blob(i);
+      bus->publish(std::move(message));
+    }
+  };
+  std::vector<std::vector<uint8_t>> frames[2];
+  for (auto& sent : frames) {
+    auto transport = std::make_unique<CaptureTransport>();
+    auto* capture = transport.get();
+    IpcBus sender(std::move(transport),
+                  std::make_unique<rtos::ipc::BinarySerializer>(), options);
+    publish(&sender, 1, 6);
+    // Keyframe, delta, delta, keyframe, delta, delta.
+    sent = capture->frames;
+    assert(sent.size() == 6);
+  }
+
+  options.max_delta_senders = 1;
+  auto capped_transport = std::make_unique<CaptureTransport>();
+  auto* capped = capped_transport.get();
+  IpcBus capped_bus(std::move(capped_transport),
+                    std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  StateLog capped_log;
+  capped_bus.subscribe("state", capped_log.handler());
+  capped->deliver(frames[0][0]);
+  capped->deliver(frames[0][1]);
+  capped->deliver(frames[1][0]);
+  capped->deliver(frames[0][2]);
+  capped->deliver(frames[0][3]);
+  assert((capped_log.indices == std::vector<uint32_t>{1, 2, 1, 4}));
+
+  options.max_delta_senders = 0;
+  options.delta_idle_timeout = std::chrono::milliseconds(20);
+  auto idle_transport = std::make_unique<CaptureTransport>();
+  auto* idle = idle_transport.get();
+  IpcBus idle_bus(std::move(idle_transport),
+                  std::make_unique<rtos::ipc::BinarySerializer>(), options);
+  StateLog idle_log;
+  idle_bus.subscribe("state", idle_log.handler());
+  idle->deliver(frames[0][0]);
+  idle->deliver(frames[1][0]);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  idle->deliver(frames[1][1]);
+  idle->deliver(frames[0][3]);
+  idle->deliver(frames[0][4]);
+  assert((idle_log.indices == std::vector<uint32_t>{1, 1, 4, 5}));
+}
+
+}  // namespace
 
 int main() {
   rtos::ipc::IpcBus bus;
@@ -18,5 +539,57 @@ int main() {
 
   assert(id != 0);
   assert(received);
+
+  // In-process subscribers get the published object: the payload buffer is
+  // the publisher's own, and a shared subscriber can keep the message.
+  std::shared_ptr<const rtos::ipc::IpcMessage> kept;
+  bus.subscribe_shared(
+      "lidar.scan",
+      [&](const std::shared_ptr<const rtos::ipc::IpcMessage>& msg) {
+        kept = msg;
+      });
+  rtos::ipc::IpcMessage scan;
+  scan.topic = "lidar.scan";
+  scan.payload.assign(1 << 20, 0x5A);
+  const uint8_t* payload = scan.payload.data();
+  bus.publish(std::move(scan));
+  assert(kept && kept->payload.data() == payload);
+  assert(kept->sequence != 0);
+
+  // At-least-once acks travel the same path, so nothing is redelivered.
+  size_t deliveries = 0;
+  bus.subscribe("cmd", [&](const rtos::ipc::IpcMessage&) { ++deliveries; });
+  rtos::ipc::IpcMessage command;
+  command.topic = "cmd";
+  command.qos = rtos::ipc::DeliveryQos::kAtLeastOnce;
+  bus.publish(command);
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  assert(deliveries == 1);
+
+  // With the fast path off the same transport carries serialized bytes.
+  rtos::ipc::IpcBus::Options options;
+  options.in_process_fast_path = false;
+  rtos::ipc::IpcBus bytes_bus(std::make_unique<rtos::ipc::LocalTransport>(),
+                              std::make_unique<rtos::ipc::BinarySerializer>(),
+                              options);
+  std::shared_ptr<const rtos::ipc::IpcMessage> copied;
+  bytes_bus.subscribe_shared(
+      "lidar.scan",
+      [&](const std::shared_ptr<const rtos::ipc::IpcMessage>& msg) {
+        copied = msg;
+      });
+  scan.topic = "lidar.scan";
+  scan.payload.assign(64, 0x11);
+  payload = scan.payload.data();
+  bytes_bus.publish(std::move(scan));
+  assert(copied && copied->payload.data() != payload);
+  assert(copied->payload == std::vector<uint8_t>(64, 0x11));
+
+  shared_runtime();
+  rate_limits();
+  announced_rates();
+  delta_topics();
+  delta_recovery();
+  delta_eviction();
   return 0;
 }
@@ -1,14 +1,39 @@
 #include "../include/ipc/binary_serializer.h"
 #include "../include/ipc/ipc_bus.h"
+#include "../include/ipc/ipc_reactor.h"
+#include "../include/ipc/shm_directory.h"
+#include "../include/ipc/shm_ring.h"
+#include "../include/ipc/shm_segment.h"
 #include "../include/ipc/shm_transport.h"
 
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
 #include <thread>
 
-int main() {
-  auto transport = std::make_unique<rtos::ipc::ShmTransport>(
-      rtos::ipc::ShmTransportConfig{"/rtos_ipc_test_shm", 1 << 16, true});
+namespace {
+
+bool round_trip(rtos::ipc::ShmRingKind ring, bool per_topic_channels = false) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_test_shm";
+  config.size_bytes = 1 << 16;
+  config.is_owner = true;
+  config.ring = ring;
+  config.per_topic_channels = per_topic_channels;
+  auto transport = std::make_unique<rtos::ipc::ShmTransport>(config);
   auto serializer = std::make_unique<rtos::ipc::BinarySerializer>();
   rtos::ipc::IpcBus bus(std::move(transport), std::move(serializer));
 
@@ -26,7 +51,487 @@ int main() {
   while (!received && std::chrono::steady_clock::now() < deadline) {
     std::this_thread::sleep_for(std::chrono::milliseconds(5));
   }
+  return received;
+}
+
+// Child processes are killed while writing in a loop, some of them inside
+// the writer lock; the parent must still get its writes through.
+bool dead_writer() {
+  constexpr size_t kSegment = 1 << 14;
+  void* memory = ::mmap(nullptr, kSegment, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(memory != MAP_FAILED);
+  rtos::ipc::ShmRingPolicy policy;
+  policy.lag_policy = rtos::ipc::ShmLagPolicy::kOverwrite;
+  rtos::ipc::ShmRing ring;
+  bool ready = ring.create(memory, kSegment, 1, policy);
+  assert(ready);
+
+  bool passed = true;
+  for (int round = 0; round < 20 && passed; ++round) {
+    pid_t child = ::fork();
+    if (child == 0) {
+      rtos::ipc::ShmRing writer;
+      if (!writer.attach(memory, kSegment)) {
+        ::_exit(1);
+      }
+      uint8_t value = 0;
+      while (true) {
+        writer.write(&value, 1);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ::kill(child, SIGKILL);
+    ::waitpid(child, nullptr, 0);
+    uint8_t value = 1;
+    passed = ring.write(&value, 1);
+  }
+  ring.detach();
+  ::munmap(memory, kSegment);
+  return passed;
+}
+
+// A child is killed while creating a channel segment; the parent finds the
+// entry pending and takes the creation over.
+bool dead_creator() {
+  constexpr size_t kChannels = 4;
+  size_t bytes = rtos::ipc::ShmDirectory::segment_size(kChannels);
+  void* memory = ::mmap(nullptr, bytes + sizeof(std::atomic<uint32_t>),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+  assert(memory != MAP_FAILED);
+  auto* creating = new (static_cast<uint8_t*>(memory) + bytes)
+      std::atomic<uint32_t>(0);
+  rtos::ipc::ShmDirectory directory;
+  bool ready = directory.create(memory, bytes, kChannels);
+  assert(ready);
+
+  pid_t child = ::fork();
+  if (child == 0) {
+    rtos::ipc::ShmDirectory stuck;
+    if (stuck.attach(memory, bytes)) {
+      stuck.find_or_add("a", [&](size_t) {
+        creating->store(1);
+        while (true) {
+          ::pause();
+        }
+        return true;
+      });
+    }
+    ::_exit(1);
+  }
+  while (creating->load() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ::kill(child, SIGKILL);
+  ::waitpid(child, nullptr, 0);
+
+  int created = -1;
+  int index = directory.find_or_add("a", [&](size_t i) {
+    created = static_cast<int>(i);
+    return true;
+  });
+  int other = directory.find_or_add("b", [](size_t) { return true; });
+  bool passed = index >= 0 && created == index &&
+                directory.find("a") == index && other >= 0 && other != index;
+  directory.detach();
+  ::munmap(memory, bytes + sizeof(std::atomic<uint32_t>));
+  return passed;
+}
+
+// Consumer 1 never reads; returns how many frames consumer 0 got through.
+size_t stalled_reader(rtos::ipc::ShmLagPolicy lag_policy,
+                      rtos::ipc::ShmConsumerStats* stalled_stats) {
+  constexpr size_t kSegment = 1 << 14;
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, kSegment);
+  rtos::ipc::ShmRingPolicy policy;
+  policy.lag_policy = lag_policy;
+  rtos::ipc::ShmRing ring;
+  bool ready = ring.create(memory, kSegment, 2, policy) &&
+               ring.add_consumer(0) && ring.add_consumer(1);
+  assert(ready);
+
+  std::vector<uint8_t> payload(100, 0xAB);
+  std::vector<uint8_t> frame;
+  size_t delivered = 0;
+  for (int i = 0; i < 1000; ++i) {
+    if (!ring.write(payload.data(), payload.size())) {
+      break;
+    }
+    if (ring.read(0, &frame)) {
+      assert(frame == payload);
+      ++delivered;
+    }
+  }
+
+  if (ring.evicted(1)) {
+    bool rejoined = ring.rejoin_consumer(1);
+    assert(rejoined);
+    bool written = ring.write(payload.data(), payload.size());
+    assert(written);
+  }
+  while (ring.read(1, &frame)) {
+    assert(frame == payload);
+  }
+  *stalled_stats = ring.consumer_stats(1);
+  std::free(memory);
+  return delivered;
+}
+
+// A segment reader evicted from its sub-ring rejoins on the next peek, and
+// learns about the eviction only from its stats.
+bool segment_rejoin() {
+  size_t bytes = rtos::ipc::ShmSegment::segment_size(1 << 12, 1, 1);
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, bytes);
+  rtos::ipc::ShmRingPolicy policy;
+  policy.lag_policy = rtos::ipc::ShmLagPolicy::kEvict;
+  rtos::ipc::ShmSegment segment;
+  bool ready = segment.create(memory, bytes, 1 << 12, 1, 1, policy) &&
+               segment.add_consumer(0);
+  assert(ready);
+
+  std::vector<uint8_t> payload(100, 0xEF);
+  for (int i = 0; i < 100; ++i) {
+    bool written = segment.write(payload.data(), payload.size());
+    assert(written);
+  }
+  bool counted = segment.consumer_stats(0).evictions == 1;
+  auto order = rtos::ipc::ShmMergeOrder::kRoundRobin;
+  rtos::ipc::ShmFrameView view;
+  bool skipped = !segment.peek(0, order, &view);
+  bool written = segment.write(payload.data(), payload.size());
+  assert(written);
+  bool resumed = segment.peek(0, order, &view) &&
+                 view.size == payload.size() && segment.consume(0);
+  bool lost = segment.consumer_stats(0).lost_messages > 0;
+  segment.detach();
+  std::free(memory);
+  return counted && skipped && resumed && lost;
+}
+
+// Claims 100 consumer slots; consumer 70 lags and must hold the producer
+// back until it reads, even though the producer skips the registry scan.
+bool registry() {
+  constexpr size_t kConsumers = 100;
+  size_t bytes = rtos::ipc::ShmRing::segment_size(1 << 12, kConsumers);
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, bytes);
+  rtos::ipc::ShmRing ring;
+  bool created = ring.create(memory, bytes, kConsumers);
+  assert(created);
+  size_t id = 0;
+  for (size_t i = 0; i < kConsumers; ++i) {
+    bool claimed = ring.claim_consumer(&id);
+    assert(claimed && id == i);
+  }
+  bool claimed = ring.claim_consumer(&id);
+  assert(!claimed);
+  ring.remove_consumer(42);
+  claimed = ring.claim_consumer(&id);
+  assert(claimed && id == 42);
+
+  std::vector<uint8_t> payload(100, 0xCD);
+  std::vector<uint8_t> frame;
+  size_t written = 0;
+  while (ring.write(payload.data(), payload.size())) {
+    ++written;
+    for (size_t i = 0; i < kConsumers; ++i) {
+      if (i != 70) {
+        bool read = ring.read(i, &frame);
+        assert(read);
+      }
+    }
+  }
+  bool blocked = written > 0 && written < 1000;
+  bool read = ring.read(70, &frame);
+  assert(read && frame == payload);
+  bool resumed = ring.write(payload.data(), payload.size());
+  std::free(memory);
+  return blocked && resumed;
+}
+
+// Two producers on separate sub-rings publish a1, a2, b1.
+std::vector<uint8_t> merged(rtos::ipc::ShmMergeOrder order) {
+  size_t bytes = rtos::ipc::ShmSegment::segment_size(1 << 12, 2, 1);
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, bytes);
+  rtos::ipc::ShmSegment consumer;
+  rtos::ipc::ShmSegment producer_a;
+  rtos::ipc::ShmSegment producer_b;
+  bool ready = consumer.create(memory, bytes, 1 << 12, 2, 1) &&
+               producer_a.attach(memory, bytes) &&
+               producer_a.claim_producer() &&
+               producer_b.attach(memory, bytes) &&
+               producer_b.claim_producer() && consumer.add_consumer(0);
+  assert(ready);
+
+  uint8_t a1 = 0xA1;
+  uint8_t a2 = 0xA2;
+  uint8_t b1 = 0xB1;
+  bool written = producer_a.write(&a1, 1) && producer_a.write(&a2, 1) &&
+                 producer_b.write(&b1, 1);
+  assert(written);
+
+  std::vector<uint8_t> order_seen;
+  rtos::ipc::ShmFrameView view;
+  while (consumer.peek(0, order, &view)) {
+    order_seen.push_back(view.data[0]);
+    bool consumed = consumer.consume(0);
+    assert(consumed);
+  }
+  producer_a.detach();
+  producer_b.detach();
+  consumer.detach();
+  std::free(memory);
+  return order_seen;
+}
+
+// Threads racing on one producer's first write end up on one claim, and a
+// producer past max_producers shares a sub-ring instead of failing.
+size_t shared_producers() {
+  size_t bytes = rtos::ipc::ShmSegment::segment_size(1 << 14, 1, 1);
+  void* memory = std::aligned_alloc(rtos::ipc::kShmCacheLine, bytes);
+  rtos::ipc::ShmSegment consumer;
+  rtos::ipc::ShmSegment producer;
+  rtos::ipc::ShmSegment extra;
+  bool ready = consumer.create(memory, bytes, 1 << 14, 1, 1) &&
+               producer.attach(memory, bytes) &&
+               extra.attach(memory, bytes) && consumer.add_consumer(0);
+  assert(ready);
+
+  std::vector<std::thread> writers;
+  for (uint8_t t = 0; t < 4; ++t) {
+    writers.emplace_back([&producer, t]() {
+      for (int i = 0; i < 50; ++i) {
+        bool written = producer.write(&t, 1);
+        assert(written);
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  assert(!producer.shares_producer_ring());
+  uint8_t value = 0xEE;
+  bool written = extra.write(&value, 1);
+  assert(written && extra.shares_producer_ring());
+
+  size_t frames = 0;
+  rtos::ipc::ShmFrameView view;
+  while (consumer.peek(0, rtos::ipc::ShmMergeOrder::kRoundRobin, &view)) {
+    ++frames;
+    bool consumed = consumer.consume(0);
+    assert(consumed);
+  }
+  producer.detach();
+  extra.detach();
+  consumer.detach();
+  std::free(memory);
+  return frames;
+}
+
+// The reader subscribes to chan.a only: it maps that channel and the untagged
+// one, and frames published on the chan.b/chan.c group never reach it.
+bool per_topic_channels() {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_test_dir";
+  config.size_bytes = 1 << 14;
+  config.per_topic_channels = true;
+  config.channel_groups = {{"group.bc", {"chan.b", "chan.c"}, 1 << 12}};
+
+  config.is_owner = true;
+  rtos::ipc::ShmTransport reader(config);
+  std::atomic<int> wanted{0};
+  std::atomic<int> unwanted{0};
+  reader.start([&](const std::vector<uint8_t>& bytes) {
+    (bytes[0] == 0xA ? wanted : unwanted).fetch_add(1);
+  });
+  reader.subscribe_topic("chan.a");
+
+  config.is_owner = false;
+  config.receive = false;
+  rtos::ipc::ShmTransport writer(config);
+  writer.start([](const std::vector<uint8_t>&) {});
+  bool published = writer.publish_topic("chan.b", {0xB}) &&
+                   writer.publish_topic("chan.c", {0xC}) &&
+                   writer.publish_topic("chan.a", {0xA});
+  assert(published);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (wanted.load() < 1 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  bool routed = wanted.load() == 1 && reader.channel_count() == 2 &&
+                writer.channel_count() == 2;
+
+  reader.unsubscribe_topic("chan.a");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  published = writer.publish_topic("chan.a", {0xA});
+  assert(published);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bool detached = wanted.load() == 1;
+
+  writer.stop();
+  reader.stop();
+  return routed && detached && unwanted.load() == 0;
+}
+
+// One reactor thread serves three segments and a socket; every handler must
+// run on that thread.
+bool reactor() {
+  constexpr int kSegments = 3;
+  rtos::ipc::IpcReactor reactor;
+  reactor.start();
+
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<int> frames{0};
+  std::vector<std::unique_ptr<rtos::ipc::ShmTransport>> transports;
+  for (int i = 0; i < kSegments; ++i) {
+    rtos::ipc::ShmTransportConfig config;
+    config.name = "/rtos_ipc_test_reactor" + std::to_string(i);
+    config.size_bytes = 1 << 12;
+    config.is_owner = true;
+    config.reactor = &reactor;
+    transports.push_back(std::make_unique<rtos::ipc::ShmTransport>(config));
+    transports.back()->start([&](const std::vector<uint8_t>&) {
+      std::lock_guard<std::mutex> lock(mutex);
+      threads.insert(std::this_thread::get_id());
+      frames.fetch_add(1);
+    });
+  }
+
+  int sockets[2];
+  int result = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets);
+  assert(result == 0);
+  std::atomic<int> socket_bytes{0};
+  reactor.add_fd(sockets[0], [&]() {
+    char buffer[64];
+    ssize_t n = 0;
+    while ((n = ::read(sockets[0], buffer, sizeof(buffer))) > 0) {
+      socket_bytes.fetch_add(static_cast<int>(n));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.insert(std::this_thread::get_id());
+  });
+
+  for (int round = 0; round < 10; ++round) {
+    for (auto& transport : transports) {
+      bool published = transport->publish({0x01, 0x02});
+      assert(published);
+    }
+    ssize_t written = ::write(sockets[1], "ping", 4);
+    assert(written == 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while ((frames.load() < 10 * kSegments || socket_bytes.load() < 40) &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  reactor.remove_fd(sockets[0]);
+  transports.clear();
+  reactor.stop();
+  ::close(sockets[0]);
+  ::close(sockets[1]);
+  return frames.load() == 10 * kSegments && socket_bytes.load() == 40 &&
+         threads.size() == 1;
+}
+
+long minor_faults() {
+  struct rusage usage {};
+  ::getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_minflt;
+}
+
+// With the segment prefaulted and locked, wrapping the ring several times
+// must not take a single page fault on the publishing thread.
+long hardened_publish_faults() {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_test_shm_rt";
+  config.size_bytes = 1 << 16;
+  config.is_owner = true;
+  config.receive = false;
+  config.prefault = true;
+  config.lock_memory = true;
+  config.lag_policy = rtos::ipc::ShmLagPolicy::kOverwrite;
+  rtos::ipc::ShmTransport transport(config);
+  transport.start([](const std::vector<uint8_t>&) {});
+
+  std::vector<uint8_t> payload(1024, 0x5A);
+  transport.publish(payload);
+  long before = minor_faults();
+  for (int i = 0; i < 512; ++i) {
+    transport.publish(payload);
+  }
+  long faults = minor_faults() - before;
+  transport.stop();
+  return faults;
+}
+
+// Whether the owner's segment ended up bound to |node|.
+bool numa_binding(int node) {
+  rtos::ipc::ShmTransportConfig config;
+  config.name = "/rtos_ipc_test_shm_numa";
+  config.size_bytes = 1 << 16;
+  config.is_owner = true;
+  config.receive = false;
+  config.numa_node = node;
+  rtos::ipc::ShmTransport transport(config);
+  transport.start([](const std::vector<uint8_t>&) {});
+  bool bound = transport.numa_bound();
+  transport.stop();
+  return bound;
+}
+
+}  // namespace
+
+int main() {
+  bool delivered = round_trip(rtos::ipc::ShmRingKind::kMutex);
+  assert(delivered);
+  delivered = round_trip(rtos::ipc::ShmRingKind::kLockFree);
+  assert(delivered);
+  delivered = round_trip(rtos::ipc::ShmRingKind::kLockFree, true);
+  assert(delivered);
+
+  rtos::ipc::ShmConsumerStats stats;
+  size_t frames = stalled_reader(rtos::ipc::ShmLagPolicy::kBlock, &stats);
+  assert(frames < 1000);
+  assert(stats.lost_messages == 0 && stats.evictions == 0);
+
+  frames = stalled_reader(rtos::ipc::ShmLagPolicy::kEvict, &stats);
+  assert(frames == 1000);
+  assert(stats.evictions == 1 && stats.lost_messages > 0);
+
+  frames = stalled_reader(rtos::ipc::ShmLagPolicy::kOverwrite, &stats);
+  assert(frames == 1000);
+  assert(stats.evictions == 0 && stats.lost_messages > 0);
+
+  std::vector<uint8_t> order = merged(rtos::ipc::ShmMergeOrder::kTimestamp);
+  assert((order == std::vector<uint8_t>{0xA1, 0xA2, 0xB1}));
+  order = merged(rtos::ipc::ShmMergeOrder::kRoundRobin);
+  assert((order == std::vector<uint8_t>{0xA1, 0xB1, 0xA2}));
+
+  size_t shared = shared_producers();
+  assert(shared == 201);
+
+  bool passed = dead_writer();
+  assert(passed);
+  passed = dead_creator();
+  assert(passed);
+  passed = segment_rejoin();
+  assert(passed);
+  passed = registry();
+  assert(passed);
+  passed = per_topic_channels();
+  assert(passed);
+  passed = reactor();
+  assert(passed);
 
-  assert(received);
+  long faults = hardened_publish_faults();
+  assert(faults == 0);
+  bool bound = numa_binding(-1);
+  assert(!bound);
+  bound = numa_binding(1000);
+  assert(!bound);
   return 0;
 }
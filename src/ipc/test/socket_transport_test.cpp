@@ -0,0 +1,627 @@
+#include "../include/ipc/ipc_runtime.h"
+#include "../include/ipc/lz_codec.h"
+#include "../include/ipc/tcp_transport.h"
+#include "../include/ipc/unix_transport.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t kTestPort = 55731;
+constexpr const char* kTestPath = "/tmp/rtos_ipc_socket_test.sock";
+
+bool wait_until(const std::function<bool()>& done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return done();
+}
+
+size_t thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Threads:", 0) == 0) {
+      return std::stoul(line.substr(8));
+    }
+  }
+  return 0;
+}
+
+size_t open_fd_count() {
+  size_t count = 0;
+  DIR* dir = ::opendir("/proc/self/fd");
+  while (dir && ::readdir(dir)) {
+    ++count;
+  }
+  if (dir) {
+    ::closedir(dir);
+  }
+  return count;
+}
+
+int connect_tcp(int receive_buffer = 0) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (receive_buffer > 0) {
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer,
+                 sizeof(receive_buffer));
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(kTestPort);
+  ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  int result = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  assert(result == 0);
+  return fd;
+}
+
+int connect_unix() {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, kTestPath, sizeof(addr.sun_path) - 1);
+  int result = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  assert(result == 0);
+  return fd;
+}
+
+std::vector<uint8_t> encode(const std::vector<uint8_t>& body) {
+  uint32_t length = htonl(static_cast<uint32_t>(body.size()));
+  std::vector<uint8_t> frame(sizeof(length));
+  std::memcpy(frame.data(), &length, sizeof(length));
+  frame.insert(frame.end(), body.begin(), body.end());
+  return frame;
+}
+
+bool read_exact(int fd, uint8_t* data, size_t length) {
+  size_t received = 0;
+  while (received < length) {
+    ssize_t result = ::recv(fd, data + received, length - received, 0);
+    if (result <= 0) {
+      return false;
+    }
+    received += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+bool read_frame(int fd, std::vector<uint8_t>* body) {
+  uint32_t length = 0;
+  if (!read_exact(fd, reinterpret_cast<uint8_t*>(&length), sizeof(length))) {
+    return false;
+  }
+  body->resize(ntohl(length));
+  return read_exact(fd, body->data(), body->size());
+}
+
+// Hundreds of peers on a bounded number of threads. Frames arrive split
+// across writes, and a large publish has to be finished by the I/O thread.
+void many_tcp_clients(rtos::ipc::SocketBackend backend) {
+  constexpr size_t kClients = 200;
+  rtos::ipc::TcpTransportConfig config{true, "127.0.0.1", kTestPort, kClients};
+  config.io_threads = 2;
+  config.backend = backend;
+  rtos::ipc::TcpTransport server(config);
+
+  std::atomic<size_t> received{0};
+  size_t threads_before = thread_count();
+  server.start([&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == std::vector<uint8_t>({0x10, 0x20, 0x30}));
+    received.fetch_add(1);
+  });
+  assert(server.backend() == backend);
+
+  std::vector<int> clients;
+  std::vector<uint8_t> frame = encode({0x10, 0x20, 0x30});
+  for (size_t i = 0; i < kClients; ++i) {
+    int fd = connect_tcp();
+    ssize_t sent = ::send(fd, frame.data(), 2, 0);
+    assert(sent == 2);
+    clients.push_back(fd);
+  }
+  for (int fd : clients) {
+    ssize_t sent = ::send(fd, frame.data() + 2, frame.size() - 2, 0);
+    assert(sent == static_cast<ssize_t>(frame.size() - 2));
+  }
+  bool delivered = wait_until([&]() { return received.load() == kClients; });
+  assert(delivered);
+  assert(server.connection_count() == kClients);
+  assert(thread_count() - threads_before == config.io_threads);
+
+  std::vector<uint8_t> large(1 << 18);
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<uint8_t>(i * 7);
+  }
+  bool published = server.publish(large);
+  assert(published);
+  std::vector<uint8_t> body;
+  for (int fd : clients) {
+    bool read = read_frame(fd, &body);
+    assert(read);
+    assert(body == large);
+  }
+
+  for (int fd : clients) {
+    ::close(fd);
+  }
+  bool closed = wait_until([&]() { return server.connection_count() == 0; });
+  assert(closed);
+  server.stop();
+}
+
+// One peer never reads. Publishing keeps flowing to the peer that does, and
+// the overflow policy decides what happens to the stalled one.
+void slow_tcp_client(rtos::ipc::SendOverflowPolicy policy,
+                     rtos::ipc::SocketBackend backend) {
+  constexpr size_t kFrames = 1000;
+  rtos::ipc::TcpTransportConfig config{true, "127.0.0.1", kTestPort, 2};
+  config.max_queued_bytes = 64 * 1024;
+  config.overflow_policy = policy;
+  config.block_timeout = std::chrono::milliseconds(1);
+  config.backend = backend;
+  rtos::ipc::TcpTransport server(config);
+  server.start([](const std::vector<uint8_t>&) {});
+
+  int fast = connect_tcp();
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+  int slow = connect_tcp(4096);
+  accepted = wait_until([&]() { return server.connection_count() == 2; });
+  assert(accepted);
+
+  std::vector<uint8_t> payload(4096, 0x5A);
+  std::thread reader([&]() {
+    std::vector<uint8_t> body;
+    for (size_t i = 0; i < kFrames; ++i) {
+      bool read = read_frame(fast, &body);
+      assert(read);
+      assert(body == payload);
+    }
+  });
+
+  // The fast peer keeps up: wait for its queue to empty before the next frame.
+  size_t failed = 0;
+  for (size_t i = 0; i < kFrames; ++i) {
+    failed += server.publish(payload) ? 0 : 1;
+    while (server.connection_stats().front().queued_bytes > 0) {
+      std::this_thread::yield();
+    }
+  }
+  reader.join();
+  assert(failed > 0);
+
+  auto stats = server.connection_stats();
+  assert(stats[0].dropped_frames == 0);
+  assert(stats[0].sent_frames == kFrames);
+  if (policy == rtos::ipc::SendOverflowPolicy::kDisconnect) {
+    bool dropped =
+        wait_until([&]() { return server.connection_count() == 1; });
+    assert(dropped);
+  } else {
+    assert(stats.size() == 2);
+    assert(stats[1].dropped_frames == failed);
+    assert(stats[1].queued_bytes > 0);
+    assert(stats[1].peak_queued_bytes <= config.max_queued_bytes);
+    assert(stats[1].lag.count() > 0);
+  }
+
+  ::close(fast);
+  ::close(slow);
+  server.stop();
+}
+
+// Telemetry-like text: repetitive field names around changing numbers.
+std::vector<uint8_t> telemetry(size_t index, size_t size) {
+  std::string text;
+  while (text.size() < size) {
+    text += "{\"joint\":" + std::to_string(text.size() % 7) +
+            ",\"position\":" + std::to_string(index * 13 + text.size()) +
+            ",\"status\":\"ok\"}\n";
+  }
+  text.resize(size);
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+std::vector<uint8_t> noise(std::mt19937* random, size_t size) {
+  std::vector<uint8_t> bytes(size);
+  for (auto& byte : bytes) {
+    byte = static_cast<uint8_t>((*random)());
+  }
+  return bytes;
+}
+
+bool round_trips(const std::vector<uint8_t>& input) {
+  std::vector<uint8_t> compressed;
+  rtos::ipc::lz_compress(input.data(), input.size(), &compressed);
+  std::vector<uint8_t> output;
+  return rtos::ipc::lz_decompress(compressed.data(), compressed.size(),
+                                  input.size(), &output) &&
+         output == input;
+}
+
+// The codec round-trips runs, overlapping references, long literal runs and
+// incompressible data, and rejects a truncated block.
+void lz_codec() {
+  std::mt19937 random(7);
+  assert(round_trips({}));
+  assert(round_trips({1, 2, 3}));
+  assert(round_trips(std::vector<uint8_t>(100000, 0)));
+  assert(round_trips(telemetry(1, 70000)));
+  assert(round_trips(noise(&random, 5000)));
+  std::vector<uint8_t> mixed = noise(&random, 300);
+  auto text = telemetry(2, 300);
+  mixed.insert(mixed.end(), text.begin(), text.end());
+  mixed.insert(mixed.end(), mixed.begin(), mixed.begin() + 200);
+  assert(round_trips(mixed));
+
+  auto input = telemetry(3, 4096);
+  std::vector<uint8_t> compressed;
+  rtos::ipc::lz_compress(input.data(), input.size(), &compressed);
+  assert(compressed.size() < input.size() / 3);
+  std::vector<uint8_t> output;
+  assert(!rtos::ipc::lz_decompress(compressed.data(), compressed.size() - 3,
+                                   input.size(), &output));
+  assert(!rtos::ipc::lz_decompress(compressed.data(), compressed.size(),
+                                   input.size() + 1, &output));
+}
+
+// Both ends compress large payloads and deliver them unchanged. Payloads
+// that do not shrink turn compression off for the next few frames.
+void compressed_frames() {
+  rtos::ipc::TcpTransportConfig server_config{true, "127.0.0.1", kTestPort,
+                                              1};
+  server_config.compress = true;
+  server_config.overflow_policy = rtos::ipc::SendOverflowPolicy::kBlock;
+  auto client_config = server_config;
+  client_config.is_server = false;
+
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t>> received;
+  rtos::ipc::TcpTransport server(server_config);
+  server.start([&](const std::vector<uint8_t>& bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    received.push_back(bytes);
+  });
+  rtos::ipc::TcpTransport client(client_config);
+  client.start([](const std::vector<uint8_t>&) {});
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+
+  std::mt19937 random(11);
+  std::vector<std::vector<uint8_t>> sent;
+  for (size_t i = 0; i < 50; ++i) {
+    sent.push_back(telemetry(i, 8192));
+  }
+  sent.push_back({0x42});
+  for (size_t i = 0; i < 10; ++i) {
+    sent.push_back(noise(&random, 8192));
+  }
+  for (const auto& payload : sent) {
+    bool published = client.publish(payload);
+    assert(published);
+  }
+  bool delivered = wait_until([&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return received.size() == sent.size();
+  });
+  assert(delivered);
+  assert(received == sent);
+
+  auto stats = client.compression_stats();
+  assert(stats.compressed_frames == 50);
+  assert(stats.output_bytes < stats.input_bytes / 3);
+  // The first random payload failed to shrink; the rest were not tried.
+  assert(stats.bypassed_frames == 9);
+
+  client.stop();
+  server.stop();
+}
+
+// Frames that queue up behind a full socket leave in shared sendmsg() calls,
+// and large frames go out with MSG_ZEROCOPY; completions release them.
+void coalesced_and_zerocopy_sends() {
+  rtos::ipc::TcpTransportConfig config{true, "127.0.0.1", kTestPort, 1};
+  config.zerocopy_threshold = 32 * 1024;
+  config.send_buffer_bytes = 4096;
+  rtos::ipc::TcpTransport server(config);
+  server.start([](const std::vector<uint8_t>&) {});
+
+  int client = connect_tcp(4096);
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+
+  constexpr size_t kSmall = 2000;
+  std::vector<uint8_t> small(100, 0x11);
+  for (size_t i = 0; i < kSmall; ++i) {
+    bool published = server.publish(small);
+    assert(published);
+  }
+  std::vector<uint8_t> body;
+  for (size_t i = 0; i < kSmall; ++i) {
+    bool read = read_frame(client, &body);
+    assert(read);
+    assert(body == small);
+  }
+  auto stats = server.connection_stats();
+  assert(stats[0].sent_frames == kSmall);
+  assert(stats[0].send_calls < kSmall);
+
+  constexpr size_t kLarge = 8;
+  std::vector<uint8_t> large(64 * 1024, 0x22);
+  for (size_t i = 0; i < kLarge; ++i) {
+    bool published = server.publish(large);
+    assert(published);
+  }
+  for (size_t i = 0; i < kLarge; ++i) {
+    bool read = read_frame(client, &body);
+    assert(read);
+    assert(body == large);
+  }
+  stats = server.connection_stats();
+  assert(stats[0].sent_frames == kSmall + kLarge);
+  assert(stats[0].zerocopy_sends >= kLarge);
+  // Loopback never transmits in place, so every completion reports a copy.
+  bool completed = wait_until([&]() {
+    return server.connection_stats()[0].zerocopy_copied ==
+           server.connection_stats()[0].zerocopy_sends;
+  });
+  assert(completed);
+
+  ::close(client);
+  server.stop();
+}
+
+void unix_round_trip(rtos::ipc::SocketBackend backend) {
+  rtos::ipc::UnixTransportConfig server_config{true, kTestPath, 1};
+  server_config.backend = backend;
+  rtos::ipc::UnixTransport server(server_config);
+  std::atomic<size_t> server_received{0};
+  server.start([&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == std::vector<uint8_t>({0x01}));
+    server_received.fetch_add(1);
+  });
+
+  rtos::ipc::UnixTransportConfig client_config{false, kTestPath};
+  client_config.backend = backend;
+  rtos::ipc::UnixTransport client(client_config);
+  std::atomic<size_t> client_received{0};
+  client.start([&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == std::vector<uint8_t>({0x02}));
+    client_received.fetch_add(1);
+  });
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+
+  for (int i = 0; i < 100; ++i) {
+    bool published = client.publish({0x01});
+    assert(published);
+    published = server.publish({0x02});
+    assert(published);
+  }
+  bool delivered = wait_until([&]() { return server_received.load() == 100; });
+  assert(delivered);
+  delivered = wait_until([&]() { return client_received.load() == 100; });
+  assert(delivered);
+
+  // max_clients is 1, so a second peer is turned away.
+  int extra = connect_unix();
+  uint8_t byte = 0;
+  ssize_t received = ::recv(extra, &byte, 1, 0);
+  assert(received == 0);
+  ::close(extra);
+
+  client.stop();
+  bool closed = wait_until([&]() { return server.connection_count() == 0; });
+  assert(closed);
+  server.stop();
+}
+
+// Large payloads travel as memfds between small inline frames, in order, in
+// both directions, and every passed descriptor is closed afterwards.
+void unix_passed_payloads() {
+  size_t fds_before = open_fd_count();
+  rtos::ipc::UnixTransportConfig server_config{true, kTestPath, 1};
+  server_config.fd_passing_threshold = 64 * 1024;
+  rtos::ipc::UnixTransport server(server_config);
+
+  std::vector<uint8_t> large(4 << 20);
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<uint8_t>(i * 13);
+  }
+  std::vector<uint8_t> small(100, 0x33);
+
+  std::atomic<size_t> server_received{0};
+  server.start([&](const std::vector<uint8_t>& bytes) {
+    size_t index = server_received.load();
+    assert(bytes == (index % 2 == 0 ? large : small));
+    server_received.fetch_add(1);
+  });
+
+  rtos::ipc::UnixTransportConfig client_config{false, kTestPath};
+  client_config.fd_passing_threshold = 64 * 1024;
+  rtos::ipc::UnixTransport client(client_config);
+  std::atomic<size_t> client_received{0};
+  client.start([&](const std::vector<uint8_t>& bytes) {
+    size_t index = client_received.load();
+    assert(bytes == (index % 2 == 0 ? large : small));
+    client_received.fetch_add(1);
+  });
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+
+  constexpr size_t kRounds = 10;
+  for (size_t i = 0; i < kRounds; ++i) {
+    bool published = client.publish(large) && client.publish(small) &&
+                     server.publish(large) && server.publish(small);
+    assert(published);
+  }
+  bool delivered =
+      wait_until([&]() { return server_received.load() == 2 * kRounds; });
+  assert(delivered);
+  delivered =
+      wait_until([&]() { return client_received.load() == 2 * kRounds; });
+  assert(delivered);
+  assert(server.connection_stats()[0].passed_frames == kRounds);
+  assert(client.connection_stats()[0].passed_frames == kRounds);
+
+  client.stop();
+  bool closed = wait_until([&]() { return server.connection_count() == 0; });
+  assert(closed);
+  server.stop();
+  assert(open_fd_count() == fds_before);
+}
+
+// Packet boundaries carry the framing: varied sizes arrive intact and in
+// order, oversized messages are refused unless they can be passed as memfds.
+void unix_seqpacket() {
+  rtos::ipc::UnixTransportConfig server_config{true, kTestPath, 1};
+  server_config.seqpacket = true;
+  server_config.fd_passing_threshold = 32 * 1024;
+  rtos::ipc::UnixTransport server(server_config);
+
+  auto message = [](size_t index) {
+    std::vector<uint8_t> bytes(1 + (index * 977) % 60000);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+      bytes[i] = static_cast<uint8_t>(index + i);
+    }
+    return bytes;
+  };
+
+  constexpr size_t kMessages = 500;
+  std::atomic<size_t> server_received{0};
+  server.start([&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == message(server_received.load()));
+    server_received.fetch_add(1);
+  });
+
+  rtos::ipc::UnixTransportConfig client_config{false, kTestPath};
+  client_config.seqpacket = true;
+  rtos::ipc::UnixTransport client(client_config);
+  std::vector<uint8_t> large(1 << 20, 0x44);
+  std::atomic<size_t> client_received{0};
+  client.start([&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == large);
+    client_received.fetch_add(1);
+  });
+  bool accepted = wait_until([&]() { return server.connection_count() == 1; });
+  assert(accepted);
+
+  for (size_t i = 0; i < kMessages; ++i) {
+    std::vector<uint8_t> bytes = message(i);
+    while (!client.publish(bytes)) {
+      std::this_thread::yield();
+    }
+  }
+  bool published = client.publish(large);
+  assert(!published);
+  published = server.publish(large);
+  assert(published);
+  bool delivered =
+      wait_until([&]() { return server_received.load() == kMessages; });
+  assert(delivered);
+  delivered = wait_until([&]() { return client_received.load() == 1; });
+  assert(delivered);
+
+  auto stats = server.connection_stats();
+  assert(stats[0].received_frames == kMessages);
+  assert(stats[0].passed_frames == 1);
+  assert(client.connection_stats()[0].sent_frames == kMessages);
+
+  client.stop();
+  bool closed = wait_until([&]() { return server.connection_count() == 0; });
+  assert(closed);
+  server.stop();
+}
+
+}  // namespace
+
+// TCP and Unix pairs all served by one runtime reactor: starting them adds
+// only the reactor's descriptor watcher, however many transports there are.
+void shared_runtime() {
+  rtos::ipc::IpcRuntime runtime;
+  runtime.start();
+  size_t threads_before = thread_count();
+
+  rtos::ipc::TcpTransportConfig tcp_server{true, "127.0.0.1", kTestPort, 1};
+  rtos::ipc::TcpTransportConfig tcp_client{false, "127.0.0.1", kTestPort, 1};
+  rtos::ipc::UnixTransportConfig unix_server{true, kTestPath, 1};
+  rtos::ipc::UnixTransportConfig unix_client{false, kTestPath, 1};
+  tcp_server.reactor = runtime.io_reactor();
+  tcp_client.reactor = runtime.io_reactor();
+  unix_server.reactor = runtime.io_reactor();
+  unix_client.reactor = runtime.io_reactor();
+  tcp_server.backend = rtos::ipc::SocketBackend::kIoUring;
+
+  std::atomic<size_t> received{0};
+  auto count = [&](const std::vector<uint8_t>& bytes) {
+    assert(bytes == std::vector<uint8_t>({0x42, 0x43}));
+    received.fetch_add(1);
+  };
+  rtos::ipc::TcpTransport tcp_a(tcp_server);
+  tcp_a.start(count);
+  rtos::ipc::TcpTransport tcp_b(tcp_client);
+  tcp_b.start(count);
+  rtos::ipc::UnixTransport unix_a(unix_server);
+  unix_a.start(count);
+  rtos::ipc::UnixTransport unix_b(unix_client);
+  unix_b.start(count);
+  assert(tcp_a.backend() == rtos::ipc::SocketBackend::kEpoll);
+  bool accepted = wait_until([&]() {
+    return tcp_a.connection_count() == 1 && unix_a.connection_count() == 1;
+  });
+  assert(accepted);
+
+  constexpr size_t kRounds = 100;
+  std::vector<uint8_t> payload = {0x42, 0x43};
+  for (size_t i = 0; i < kRounds; ++i) {
+    bool published = tcp_a.publish(payload) && tcp_b.publish(payload) &&
+                     unix_a.publish(payload) && unix_b.publish(payload);
+    assert(published);
+  }
+  bool delivered = wait_until([&]() { return received.load() == 4 * kRounds; });
+  assert(delivered);
+  assert(thread_count() - threads_before == 1);
+
+  unix_b.stop();
+  unix_a.stop();
+  tcp_b.stop();
+  tcp_a.stop();
+  runtime.stop();
+}
+
+int main() {
+  using rtos::ipc::SendOverflowPolicy;
+  using rtos::ipc::SocketBackend;
+  for (SocketBackend backend : {SocketBackend::kEpoll, SocketBackend::kIoUring}) {
+    many_tcp_clients(backend);
+    slow_tcp_client(SendOverflowPolicy::kDrop, backend);
+    slow_tcp_client(SendOverflowPolicy::kDisconnect, backend);
+    slow_tcp_client(SendOverflowPolicy::kBlock, backend);
+    unix_round_trip(backend);
+  }
+  coalesced_and_zerocopy_sends();
+  unix_passed_payloads();
+  unix_seqpacket();
+  shared_runtime();
+  lz_codec();
+  compressed_frames();
+  return 0;
+}
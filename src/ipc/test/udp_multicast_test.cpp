@@ -0,0 +1,199 @@
+#include "../include/ipc/udp_multicast_transport.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t kTestPort = 55811;
+
+bool wait_until(const std::function<bool()>& done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!done() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  return done();
+}
+
+rtos::ipc::UdpMulticastConfig loopback_config(const char* group) {
+  rtos::ipc::UdpMulticastConfig config;
+  config.group = group;
+  config.port = kTestPort;
+  config.interface_address = "127.0.0.1";
+  return config;
+}
+
+std::vector<uint8_t> numbered(uint32_t index, size_t size) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = static_cast<uint8_t>(index * 31 + i);
+  }
+  std::memcpy(bytes.data(), &index, sizeof(index));
+  return bytes;
+}
+
+uint32_t index_of(const std::vector<uint8_t>& bytes) {
+  uint32_t index = 0;
+  std::memcpy(&index, bytes.data(), sizeof(index));
+  return index;
+}
+
+// Records messages in arrival order and checks each against its index.
+struct Receiver {
+  explicit Receiver(rtos::ipc::UdpMulticastConfig config, size_t size,
+                    std::chrono::milliseconds first_stall = {})
+      : transport(std::move(config)), size(size), stall(first_stall) {
+    transport.start([this](const std::vector<uint8_t>& bytes) {
+      uint32_t index = index_of(bytes);
+      assert(bytes == numbered(index, this->size));
+      if (order.empty() && stall.count() > 0) {
+        std::this_thread::sleep_for(stall);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(index);
+      count.fetch_add(1);
+    });
+  }
+
+  rtos::ipc::UdpMulticastTransport transport;
+  size_t size;
+  std::chrono::milliseconds stall;
+  std::mutex mutex;
+  std::vector<uint32_t> order;
+  std::atomic<size_t> count{0};
+};
+
+// One publish reaches every receiver in the group, and a message larger
+// than a datagram leaves as fragments in a few sendmmsg() calls.
+void fan_out() {
+  constexpr size_t kMessages = 50;
+  constexpr size_t kSize = 100 * 1024;
+  auto config = loopback_config("239.255.77.1");
+  std::vector<std::unique_ptr<Receiver>> receivers;
+  for (int i = 0; i < 3; ++i) {
+    receivers.push_back(std::make_unique<Receiver>(config, kSize));
+  }
+  rtos::ipc::UdpMulticastTransport sender(config);
+  sender.start([](const std::vector<uint8_t>&) { assert(false); });
+
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    bool published = sender.publish(numbered(i, kSize));
+    assert(published);
+    for (auto& receiver : receivers) {
+      bool delivered =
+          wait_until([&]() { return receiver->count.load() == i + 1; });
+      assert(delivered);
+    }
+  }
+  for (auto& receiver : receivers) {
+    for (uint32_t i = 0; i < kMessages; ++i) {
+      assert(receiver->order[i] == i);
+    }
+    assert(receiver->transport.stats().received_messages == kMessages);
+  }
+
+  auto stats = sender.stats();
+  size_t fragments = (kSize + 1431) / 1432;
+  assert(stats.sent_messages == kMessages);
+  assert(stats.sent_datagrams == kMessages * fragments);
+  assert(stats.send_calls < stats.sent_datagrams / 10);
+
+  for (auto& receiver : receivers) {
+    receiver->transport.stop();
+  }
+  sender.stop();
+}
+
+// One receiver stalls on its first message with a tiny socket buffer, so a
+// burst overflows it. NACKs recover every message in order, and the receiver
+// that kept up never asks for anything.
+void nack_repair() {
+  constexpr size_t kMessages = 200;
+  constexpr size_t kSize = 4000;
+  auto config = loopback_config("239.255.77.2");
+  config.reliable_topics = {"state"};
+
+  auto slow_config = config;
+  slow_config.receive_buffer_bytes = 4096;
+  Receiver slow(slow_config, kSize, std::chrono::milliseconds(50));
+  Receiver fast(config, kSize);
+  rtos::ipc::UdpMulticastTransport sender(config);
+  sender.start(nullptr);
+
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    bool published = sender.publish_topic("state", numbered(i, kSize));
+    assert(published);
+    if (i > 0) {
+      bool delivered =
+          wait_until([&]() { return fast.count.load() == i + 1; });
+      assert(delivered);
+    }
+  }
+  bool repaired = wait_until([&]() { return slow.count.load() == kMessages; });
+  assert(repaired);
+  assert(fast.count.load() == kMessages);
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    assert(slow.order[i] == i);
+    assert(fast.order[i] == i);
+  }
+
+  assert(slow.transport.stats().nacks_sent > 0);
+  assert(slow.transport.stats().lost_messages == 0);
+  assert(fast.transport.stats().nacks_sent == 0);
+  assert(sender.stats().retransmitted_messages > 0);
+
+  slow.transport.stop();
+  fast.transport.stop();
+  sender.stop();
+}
+
+// Repairs only reach back history_messages. Older gaps are reported lost,
+// and delivery resumes in order past them.
+void lost_beyond_history() {
+  constexpr size_t kMessages = 100;
+  constexpr size_t kSize = 4000;
+  auto config = loopback_config("239.255.77.3");
+  config.reliable = true;
+  config.history_messages = 8;
+
+  auto slow_config = config;
+  slow_config.receive_buffer_bytes = 4096;
+  Receiver slow(slow_config, kSize, std::chrono::milliseconds(50));
+  rtos::ipc::UdpMulticastTransport sender(config);
+  sender.start(nullptr);
+
+  for (uint32_t i = 0; i < kMessages; ++i) {
+    bool published = sender.publish(numbered(i, kSize));
+    assert(published);
+  }
+  bool settled = wait_until([&]() {
+    return slow.count.load() + slow.transport.stats().lost_messages ==
+           kMessages;
+  });
+  assert(settled);
+  assert(slow.transport.stats().lost_messages > 0);
+  std::lock_guard<std::mutex> lock(slow.mutex);
+  for (size_t i = 1; i < slow.order.size(); ++i) {
+    assert(slow.order[i] > slow.order[i - 1]);
+  }
+  assert(slow.order.back() == kMessages - 1);
+
+  slow.transport.stop();
+  sender.stop();
+}
+
+}  // namespace
+
+int main() {
+  fan_out();
+  nack_repair();
+  lost_beyond_history();
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include "sensor_fusion.h"
 
 #include <array>
+#include <cstddef>
 
 namespace rtos {
 namespace robotics {
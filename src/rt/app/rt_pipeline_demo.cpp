@@ -17,8 +17,11 @@ int main() {
   rtos::hal::DummyI2cBus i2c;
   i2c.open("/dev/i2c-0");
 
-  rtos::rt::RtStage<RawSample, FilteredSample> filter_stage(
-      "filter", 32, [](const RawSample& sample) {
+  rtos::rt::RtPipeline pipeline;
+  auto* raw = pipeline.add_input<RawSample>();
+  auto* filter_stage = pipeline.add_stage<RawSample, FilteredSample>(
+      "filter",
+      [](const RawSample& sample) {
         FilteredSample out;
         if (!sample.bytes.empty()) {
           double sum = 0.0;
@@ -28,23 +31,31 @@ int main() {
           out.average = sum / sample.bytes.size();
         }
         return out;
-      });
-
-  filter_stage.start(20);
+      },
+      rtos::rt::StageOptions{20, 0});
+  auto* filtered = pipeline.add_output<FilteredSample>();
+  pipeline.connect(raw->output(), filter_stage->input(),
+                   rtos::rt::EdgeOptions{32});
+  pipeline.connect(filter_stage->output(), filtered->input());
+  pipeline.start();
 
   for (int i = 0; i < 20; ++i) {
     std::vector<uint8_t> data;
     i2c.read(0x40, 4, &data);
-    filter_stage.push(RawSample{data});
+    raw->push(RawSample{data});
 
     FilteredSample out;
-    if (filter_stage.pop(&out)) {
+    while (filtered->try_pop(&out)) {
       std::cout << "avg=" << out.average << "\n";
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
 
-  filter_stage.stop();
+  FilteredSample out;
+  while (filtered->pop_for(&out, std::chrono::milliseconds(50))) {
+    std::cout << "avg=" << out.average << "\n";
+  }
+  pipeline.stop();
   i2c.close();
   return 0;
 }
@@ -0,0 +1,127 @@
+#include "../include/rt/rt_mpmc_queue.h"
+#include "../include/rt/rt_queue.h"
+#include "../include/rt/rt_spsc_queue.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kItems = 2000000;
+constexpr size_t kCapacity = 1024;
+
+// One thread pushes then pops a single item, so the cost is the queue
+// operations themselves with no contention or waiting.
+template <typename Queue>
+void uncontended(const char* name, Queue* queue) {
+  auto begin = Clock::now();
+  uint64_t sum = 0;
+  for (uint64_t i = 0; i < kItems; ++i) {
+    queue->try_push(i);
+    uint64_t value = 0;
+    queue->try_pop(&value);
+    sum += value;
+  }
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin)
+                  .count();
+  std::printf("%-10s uncontended push+pop=%6.1f ns (sum %llu)\n", name,
+              ns / kItems, static_cast<unsigned long long>(sum));
+}
+
+// A producer thread streams kItems to a consumer thread; both yield when
+// the queue is full or empty.
+template <typename Queue>
+void streaming(const char* name, Queue* queue) {
+  auto begin = Clock::now();
+  std::thread producer([queue]() {
+    for (uint64_t i = 0; i < kItems; ++i) {
+      while (!queue->try_push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint64_t expected = 0;
+  while (expected < kItems) {
+    uint64_t value = 0;
+    if (!queue->try_pop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (value != expected) {
+      std::printf("%s: out of order\n", name);
+      break;
+    }
+    ++expected;
+  }
+  producer.join();
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  std::printf("%-10s streaming throughput=%6.1f M items/s\n", name,
+              kItems / seconds / 1e6);
+}
+
+// kFanInProducers threads feed one consumer through the blocking calls,
+// as device threads feed a polling loop.
+constexpr size_t kFanInProducers = 3;
+constexpr uint64_t kFanInItems = 300000;
+
+template <typename Queue>
+void fan_in(const char* name, Queue* queue) {
+  auto begin = Clock::now();
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < kFanInProducers; ++p) {
+    producers.emplace_back([queue]() {
+      for (uint64_t i = 0; i < kFanInItems; ++i) {
+        while (!queue->push_for(i, std::chrono::milliseconds(100))) {
+        }
+      }
+    });
+  }
+  uint64_t received = 0;
+  while (received < kFanInProducers * kFanInItems) {
+    uint64_t value = 0;
+    if (queue->pop_for(&value, std::chrono::milliseconds(100))) {
+      ++received;
+    }
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  std::printf("%-10s fan-in %zu:1 throughput=%6.1f M items/s\n", name,
+              kFanInProducers, received / seconds / 1e6);
+}
+
+}  // namespace
+
+int main() {
+  rtos::rt::RtQueue<uint64_t> mutex_queue(kCapacity);
+  auto spsc = std::make_unique<rtos::rt::RtSpscQueue<uint64_t, kCapacity>>();
+  uncontended("RtQueue", &mutex_queue);
+  uncontended("RtSpsc", spsc.get());
+  streaming("RtQueue", &mutex_queue);
+  streaming("RtSpsc", spsc.get());
+
+  using rtos::rt::RtMpmcQueue;
+  auto mpmc = std::make_unique<RtMpmcQueue<uint64_t, kCapacity>>();
+  uncontended("RtMpmc", mpmc.get());
+  streaming("RtMpmc", mpmc.get());
+
+  // Busy-spinning needs a core per thread and is left out of the fan-in
+  // runs, which oversubscribe small machines.
+  auto spin_yield = std::make_unique<
+      RtMpmcQueue<uint64_t, kCapacity, rtos::rt::SpinYieldWait>>();
+  auto futex = std::make_unique<
+      RtMpmcQueue<uint64_t, kCapacity, rtos::rt::FutexWait>>();
+  fan_in("RtQueue", &mutex_queue);
+  fan_in("spin-yield", spin_yield.get());
+  fan_in("futex", futex.get());
+  return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace rtos {
+namespace rt {
+
+// A chain of handlers called one after another on the same thread. Each
+// takes the previous one's result by const reference, so there are no
+// queues between them, and the chain's type names every handler, so the
+// compiler can inline the whole chain. The same handlers work unfused as
+// RtPipeline stages.
+template <typename... Fns>
+class RtFused {
+  static_assert(sizeof...(Fns) > 0, "fuse() needs at least one handler");
+
+ public:
+  explicit RtFused(Fns... fns) : fns_(std::move(fns)...) {}
+
+  template <typename In>
+  auto operator()(const In& input) const {
+    return call<0>(input);
+  }
+
+ private:
+  template <size_t I, typename T>
+  auto call(const T& value) const {
+    if constexpr (I + 1 == sizeof...(Fns)) {
+      return std::get<I>(fns_)(value);
+    } else {
+      return call<I + 1>(std::get<I>(fns_)(value));
+    }
+  }
+
+  std::tuple<Fns...> fns_;
+};
+
+template <typename... Fns>
+RtFused<std::decay_t<Fns>...> fuse(Fns&&... fns) {
+  return RtFused<std::decay_t<Fns>...>(std::forward<Fns>(fns)...);
+}
+
+// What a handler (fused or not) produces from an In.
+template <typename In, typename Fn>
+using rt_result_t = std::decay_t<
+    decltype(std::declval<const Fn&>()(std::declval<const In&>()))>;
+
+}  // namespace rt
+}  // namespace rtos
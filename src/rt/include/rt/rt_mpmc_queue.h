@@ -0,0 +1,191 @@
+#pragma once
+
+#include "rt_spsc_queue.h"
+#include "rt_wait_policy.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace rtos {
+namespace rt {
+
+// Bounded multi-producer/multi-consumer ring that never takes a mutex. Each
+// slot carries a sequence number that says whether it is free for the push
+// at that position or holds the item for the pop at that position, so
+// producers and consumers only contend on their own index. Storage for N
+// items is part of the object; with N = kDynamicCapacity it is allocated
+// once at construction, |capacity| rounded up to a power of two. push_for()
+// and pop_for() wait as WaitPolicy says (see rt_wait_policy.h) and keep
+// RtQueue's timeouts.
+template <typename T, size_t N, typename WaitPolicy = SpinYieldWait>
+class RtMpmcQueue {
+  static_assert(N == kDynamicCapacity || (N >= 2 && (N & (N - 1)) == 0),
+                "RtMpmcQueue capacity must be a power of two");
+
+ public:
+  explicit RtMpmcQueue(size_t capacity = N) : cells_(capacity) {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~RtMpmcQueue() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t pos = head_.load(std::memory_order_relaxed); pos != tail;
+         ++pos) {
+      cells_[pos].item()->~T();
+    }
+  }
+
+  RtMpmcQueue(const RtMpmcQueue&) = delete;
+  RtMpmcQueue& operator=(const RtMpmcQueue&) = delete;
+
+  template <typename... Args>
+  bool try_emplace(Args&&... args) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                  static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // The slot still holds the item from N pushes ago.
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->item()) T(std::forward<Args>(args)...);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    not_empty_.notify();
+    return true;
+  }
+
+  bool try_push(const T& item) { return try_emplace(item); }
+  bool try_push(T&& item) { return try_emplace(std::move(item)); }
+
+  bool try_pop(T* out) {
+    if (!out) {
+      return false;
+    }
+    return pop_with([out](T&& item) { *out = std::move(item); });
+  }
+
+  // When full, pops and drops the oldest item to make room. Returns false
+  // when it dropped one, as RtQueue::push_overwrite does.
+  bool push_overwrite(T item) {
+    bool dropped = false;
+    while (!try_push(std::move(item))) {
+      dropped = pop_with([](T&&) {}) || dropped;
+    }
+    return !dropped;
+  }
+
+  bool push_for(T item, std::chrono::milliseconds timeout) {
+    return not_full_.wait_until(WaitClock::now() + timeout, [&]() {
+      return try_push(std::move(item));
+    });
+  }
+
+  bool pop_for(T* out, std::chrono::milliseconds timeout) {
+    if (!out) {
+      return false;
+    }
+    return not_empty_.wait_until(WaitClock::now() + timeout,
+                                 [&]() { return try_pop(out); });
+  }
+
+  // Other producers and consumers may interleave with a batch.
+  size_t try_push_batch(std::vector<T>* items) {
+    size_t count = 0;
+    while (count < items->size() && try_push(std::move((*items)[count]))) {
+      ++count;
+    }
+    items->erase(items->begin(), items->begin() + count);
+    return count;
+  }
+
+  template <typename Rep, typename Period>
+  size_t pop_batch_for(std::vector<T>* out, size_t max_items,
+                       std::chrono::duration<Rep, Period> timeout) {
+    if (!out || max_items == 0) {
+      return 0;
+    }
+    auto append = [out](T&& item) { out->push_back(std::move(item)); };
+    if (!not_empty_.wait_until(WaitClock::now() + timeout,
+                               [&]() { return pop_with(append); })) {
+      return 0;
+    }
+    size_t count = 1;
+    while (count < max_items && pop_with(append)) {
+      ++count;
+    }
+    return count;
+  }
+
+  // A snapshot; concurrent pushes and pops may change it at once.
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return cells_.size(); }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char bytes[sizeof(T)];
+
+    T* item() { return std::launder(reinterpret_cast<T*>(bytes)); }
+  };
+
+  // Claims the oldest item and hands it to |take| as an rvalue, then
+  // destroys it in its slot, so no T is ever default-constructed.
+  template <typename Take>
+  bool pop_with(Take&& take) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                  static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // Nothing pushed at this position yet.
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    T* item = cell->item();
+    take(std::move(*item));
+    item->~T();
+    cell->sequence.store(pos + cells_.size(), std::memory_order_release);
+    not_full_.notify();
+    return true;
+  }
+
+  alignas(kCacheLineBytes) std::atomic<size_t> head_{0};
+  alignas(kCacheLineBytes) std::atomic<size_t> tail_{0};
+  alignas(kCacheLineBytes) typename WaitPolicy::Event not_empty_;
+  alignas(kCacheLineBytes) typename WaitPolicy::Event not_full_;
+  RtRingSlots<Cell, N> cells_;
+};
+
+}  // namespace rt
+}  // namespace rtos
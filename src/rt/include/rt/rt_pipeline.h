@@ -1,21 +1,38 @@
 #pragma once
 
+#include "rt_fuse.h"
+#include "rt_mpmc_queue.h"
 #include "rt_queue.h"
 #include "rt_scheduler.h"
+#include "rt_spsc_queue.h"
+#include "rt_wait_policy.h"
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace rtos {
 namespace rt {
 
-template <typename In, typename Out>
+// The queues default to RtQueue; any queue with the same try_push, try_pop
+// and pop_for surface, such as RtSpscQueue, can take their place. The
+// handler defaults to a std::function; a concrete callable type, such as a
+// fuse() chain, is called directly.
+template <typename In, typename Out, typename InputQueue = RtQueue<In>,
+          typename OutputQueue = RtQueue<Out>,
+          typename Fn = std::function<Out(const In&)>>
 class RtStage {
  public:
-  using Handler = std::function<Out(const In&)>;
+  using Handler = Fn;
 
   RtStage(const std::string& name, size_t capacity, Handler handler)
       : name_(name), queue_(capacity), handler_(std::move(handler)) {}
@@ -57,12 +74,562 @@ class RtStage {
   }
 
   std::string name_;
-  RtQueue<In> queue_;
-  RtQueue<Out> output_{64};
+  InputQueue queue_;
+  OutputQueue output_{64};
   Handler handler_;
   std::atomic<bool> running_{false};
   std::thread thread_;
 };
 
+// One stage running a fused chain of handlers on its thread, with the
+// push/pop interface of a single stage:
+//
+//   auto stage = make_fused_stage<Raw>("front", 32, decode, filter, scale);
+//   stage->start(20);
+template <typename In, typename... Fns>
+auto make_fused_stage(const std::string& name, size_t capacity, Fns&&... fns) {
+  auto chain = fuse(std::forward<Fns>(fns)...);
+  using Chain = decltype(chain);
+  using Out = rt_result_t<In, Chain>;
+  return std::make_unique<
+      RtStage<In, Out, RtQueue<In>, RtQueue<Out>, Chain>>(name, capacity,
+                                                          std::move(chain));
+}
+
+// A view of contiguous items, standing in for C++20's std::span.
+template <typename T>
+class RtSpan {
+ public:
+  RtSpan(T* data, size_t size) : data_(data), size_(size) {}
+
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T& operator[](size_t index) const { return data_[index]; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+
+ private:
+  T* data_;
+  size_t size_;
+};
+
+struct BatchOptions {
+  size_t max_batch = 64;
+  // How long to keep gathering after the first item of a batch arrives; 0
+  // takes only what is already queued.
+  std::chrono::microseconds latency_budget{0};
+  size_t output_capacity = 64;
+};
+
+// An RtStage that hands its handler every queued item at once, up to
+// max_batch, instead of one call per item. Items are drained under one
+// lock (or one index store) and passed as a contiguous span. The handler
+// appends its results to an output batch that is cleared and reused, and
+// the whole batch is pushed at once. Outputs that do not fit are dropped.
+template <typename In, typename Out, typename InputQueue = RtQueue<In>,
+          typename OutputQueue = RtQueue<Out>,
+          typename Fn = std::function<void(RtSpan<const In>,
+                                           std::vector<Out>*)>>
+class RtBatchStage {
+ public:
+  using Handler = Fn;
+
+  RtBatchStage(const std::string& name, size_t capacity, Handler handler,
+               BatchOptions options = BatchOptions{})
+      : name_(name),
+        options_(options),
+        queue_(capacity),
+        output_(options.output_capacity),
+        handler_(std::move(handler)) {}
+
+  void start(int priority) {
+    running_.store(true);
+    thread_ = std::thread([this, priority]() {
+      RtScheduler::set_thread_name(name_);
+      RtScheduler::set_thread_realtime(priority);
+      run();
+    });
+  }
+
+  void stop() {
+    running_.store(false);
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  bool push(const In& item) {
+    return queue_.try_push(item);
+  }
+
+  bool pop(Out* out) {
+    return output_.try_pop(out);
+  }
+
+  uint64_t dropped() const { return dropped_.load(); }
+
+ private:
+  void run() {
+    std::vector<In> inputs;
+    std::vector<Out> outputs;
+    inputs.reserve(options_.max_batch);
+    outputs.reserve(options_.max_batch);
+    while (running_.load()) {
+      inputs.clear();
+      if (queue_.pop_batch_for(&inputs, options_.max_batch,
+                               std::chrono::milliseconds(10)) == 0) {
+        continue;
+      }
+      if (options_.latency_budget.count() > 0) {
+        auto deadline =
+            std::chrono::steady_clock::now() + options_.latency_budget;
+        while (inputs.size() < options_.max_batch) {
+          auto now = std::chrono::steady_clock::now();
+          if (now >= deadline) {
+            break;
+          }
+          queue_.pop_batch_for(&inputs, options_.max_batch - inputs.size(),
+                               deadline - now);
+        }
+      }
+      outputs.clear();
+      handler_(RtSpan<const In>(inputs.data(), inputs.size()), &outputs);
+      size_t produced = outputs.size();
+      size_t pushed = output_.try_push_batch(&outputs);
+      dropped_.fetch_add(produced - pushed);
+    }
+  }
+
+  std::string name_;
+  BatchOptions options_;
+  InputQueue queue_;
+  OutputQueue output_;
+  Handler handler_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint64_t> dropped_{0};
+  std::thread thread_;
+};
+
+// What an edge does with an item when its queue is full: drop the new item,
+// drop the oldest queued one, or wait up to block_timeout for room and then
+// drop the new item.
+enum class EdgeOverflow : uint8_t {
+  kDropNewest = 0,
+  kDropOldest = 1,
+  kBlock = 2,
+};
+
+struct EdgeOptions {
+  size_t capacity = 64;
+  EdgeOverflow overflow = EdgeOverflow::kDropNewest;
+  std::chrono::milliseconds block_timeout{10};
+};
+
+struct StageOptions {
+  int priority = 0;       // SCHED_FIFO priority; 0 keeps the default policy.
+  uint32_t cpu_mask = 0;  // 0 keeps the inherited affinity.
+};
+
+// A bounded queue from one output port to one input port. Pushing rings the
+// consumer's wait event, which only costs a system call while it sleeps.
+// With one port on each end the queue is a lock-free SPSC ring, and a kBlock
+// producer parks on its not-full futex until the consumer pops. Dropping the
+// oldest item makes the producer a second consumer, so those edges use an
+// MPMC ring, whose capacity is rounded up to a power of two.
+template <typename T>
+class RtEdge {
+ public:
+  RtEdge(EdgeOptions options, FutexWait::Event* consumer)
+      : options_(options),
+        drop_oldest_(options.overflow == EdgeOverflow::kDropOldest),
+        queue_(drop_oldest_ ? 0 : options.capacity),
+        overwrite_queue_(drop_oldest_ ? options.capacity : 0),
+        consumer_(consumer) {}
+
+  bool push(T item) {
+    bool kept;
+    switch (options_.overflow) {
+      case EdgeOverflow::kDropOldest:
+        kept = overwrite_queue_.push_overwrite(std::move(item));
+        break;
+      case EdgeOverflow::kBlock:
+        kept = queue_.push_for(std::move(item), options_.block_timeout);
+        break;
+      default:
+        kept = queue_.try_push(std::move(item));
+        break;
+    }
+    if (!kept) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    consumer_->notify();
+    return kept;
+  }
+
+  bool try_pop(T* out) {
+    return drop_oldest_ ? overwrite_queue_.try_pop(out) : queue_.try_pop(out);
+  }
+
+  size_t size() const {
+    return drop_oldest_ ? overwrite_queue_.size() : queue_.size();
+  }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  EdgeOptions options_;
+  bool drop_oldest_;
+  RtSpscQueue<T, kDynamicCapacity, FutexWait> queue_;
+  RtMpmcQueue<T, kDynamicCapacity> overwrite_queue_;
+  FutexWait::Event* consumer_;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// Fans every item out to all connected edges.
+template <typename T>
+class RtOutputPort {
+ public:
+  void emit(T item) {
+    if (edges_.empty()) {
+      return;
+    }
+    for (size_t i = 0; i + 1 < edges_.size(); ++i) {
+      edges_[i]->push(item);
+    }
+    edges_.back()->push(std::move(item));
+  }
+
+ private:
+  friend class RtPipeline;
+  std::vector<RtEdge<T>*> edges_;
+};
+
+// Fans in from all connected edges, taking from each in turn.
+template <typename T>
+class RtInputPort {
+ public:
+  explicit RtInputPort(FutexWait::Event* event) : event_(event) {}
+
+  bool try_pop(T* out) {
+    for (size_t i = 0; i < edges_.size(); ++i) {
+      RtEdge<T>* edge = edges_[next_++ % edges_.size()];
+      if (edge->try_pop(out)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  friend class RtPipeline;
+  FutexWait::Event* event_;
+  std::vector<RtEdge<T>*> edges_;
+  size_t next_ = 0;
+};
+
+// A graph of stages, each on its own thread, wired output to input with
+// bounded edges. Items move straight from one stage's thread into the next
+// stage's input; the caller only touches the graph's inputs and outputs.
+//
+//   RtPipeline pipeline;
+//   auto* raw = pipeline.add_input<Raw>();
+//   auto* filter = pipeline.add_stage<Raw, Filtered>("filter", filter_fn,
+//                                                    StageOptions{20, 0x2});
+//   auto* out = pipeline.add_output<Filtered>();
+//   pipeline.connect(raw->output(), filter->input());
+//   pipeline.connect(filter->output(), out->input(), EdgeOptions{16});
+//   pipeline.start();
+//
+// An output port connected to several inputs fans out (every edge gets a
+// copy); an input port connected to several outputs fans in. A join pairs
+// one item from each of its two inputs. The graph is built before start()
+// and fixed while it runs. start() brings up every stage thread and applies
+// its name, priority and affinity before any stage takes an item; stop()
+// stops and joins them all. Items still queued stay in their edges.
+class RtPipeline {
+ public:
+  class Node {
+   public:
+    Node(std::string name, StageOptions options)
+        : name_(std::move(name)), options_(options) {}
+    virtual ~Node() = default;
+
+    const std::string& name() const { return name_; }
+    const StageOptions& options() const { return options_; }
+
+   protected:
+    friend class RtPipeline;
+    // Runs until |running| clears; returns soon after wake().
+    virtual void run(const std::atomic<bool>& running) = 0;
+    void wake() { event_.notify(); }
+
+    // How long a stage sleeps before checking |running| on its own.
+    static constexpr std::chrono::milliseconds kIdleCheck{100};
+
+    FutexWait::Event event_;
+
+   private:
+    std::string name_;
+    StageOptions options_;
+  };
+
+  template <typename In, typename Out,
+            typename Fn = std::function<Out(const In&)>>
+  class Stage final : public Node {
+   public:
+    using Handler = Fn;
+
+    Stage(std::string name, Handler handler, StageOptions options)
+        : Node(std::move(name), options),
+          handler_(std::move(handler)),
+          input_(&event_) {}
+
+    RtInputPort<In>& input() { return input_; }
+    RtOutputPort<Out>& output() { return output_; }
+
+   private:
+    void run(const std::atomic<bool>& running) override {
+      In item;
+      while (true) {
+        bool popped = event_.wait_until(
+            WaitClock::now() + kIdleCheck, [&]() {
+              return !running.load(std::memory_order_acquire) ||
+                     input_.try_pop(&item);
+            });
+        if (!running.load(std::memory_order_acquire)) {
+          return;
+        }
+        if (popped) {
+          output_.emit(handler_(item));
+        }
+      }
+    }
+
+    Handler handler_;
+    RtInputPort<In> input_;
+    RtOutputPort<Out> output_;
+  };
+
+  // Pairs items from two inputs in arrival order.
+  template <typename Left, typename Right, typename Out>
+  class Join final : public Node {
+   public:
+    using Handler = std::function<Out(const Left&, const Right&)>;
+
+    Join(std::string name, Handler handler, StageOptions options)
+        : Node(std::move(name), options),
+          handler_(std::move(handler)),
+          left_(&event_),
+          right_(&event_) {}
+
+    RtInputPort<Left>& left() { return left_; }
+    RtInputPort<Right>& right() { return right_; }
+    RtOutputPort<Out>& output() { return output_; }
+
+   private:
+    void run(const std::atomic<bool>& running) override {
+      Left left;
+      Right right;
+      bool have_left = false;
+      bool have_right = false;
+      while (true) {
+        bool paired = event_.wait_until(
+            WaitClock::now() + kIdleCheck, [&]() {
+              if (!running.load(std::memory_order_acquire)) {
+                return true;
+              }
+              have_left = have_left || left_.try_pop(&left);
+              have_right = have_right || right_.try_pop(&right);
+              return have_left && have_right;
+            });
+        if (!running.load(std::memory_order_acquire)) {
+          return;
+        }
+        if (paired) {
+          output_.emit(handler_(left, right));
+          have_left = false;
+          have_right = false;
+        }
+      }
+    }
+
+    Handler handler_;
+    RtInputPort<Left> left_;
+    RtInputPort<Right> right_;
+    RtOutputPort<Out> output_;
+  };
+
+  // Where the caller feeds the graph. Edges have a single producer, so one
+  // thread at a time pushes.
+  template <typename T>
+  class Input {
+   public:
+    void push(T item) { output_.emit(std::move(item)); }
+    RtOutputPort<T>& output() { return output_; }
+
+   private:
+    RtOutputPort<T> output_;
+  };
+
+  // Where the caller takes results from the graph, one thread at a time.
+  template <typename T>
+  class Output {
+   public:
+    Output() : input_(&event_) {}
+
+    bool try_pop(T* out) { return out && input_.try_pop(out); }
+    bool pop_for(T* out, std::chrono::milliseconds timeout) {
+      if (!out) {
+        return false;
+      }
+      return event_.wait_until(WaitClock::now() + timeout,
+                               [&]() { return input_.try_pop(out); });
+    }
+    RtInputPort<T>& input() { return input_; }
+
+   private:
+    FutexWait::Event event_;
+    RtInputPort<T> input_;
+  };
+
+  RtPipeline() = default;
+  ~RtPipeline() { stop(); }
+
+  RtPipeline(const RtPipeline&) = delete;
+  RtPipeline& operator=(const RtPipeline&) = delete;
+
+  template <typename T>
+  Input<T>* add_input() {
+    auto input = std::make_shared<Input<T>>();
+    Input<T>* raw = input.get();
+    owned_.push_back(std::move(input));
+    return raw;
+  }
+
+  template <typename T>
+  Output<T>* add_output() {
+    auto output = std::make_shared<Output<T>>();
+    Output<T>* raw = output.get();
+    owned_.push_back(std::move(output));
+    return raw;
+  }
+
+  template <typename In, typename Out>
+  Stage<In, Out>* add_stage(const std::string& name,
+                            typename Stage<In, Out>::Handler handler,
+                            StageOptions options = StageOptions{}) {
+    return add_node(std::make_unique<Stage<In, Out>>(
+        name, std::move(handler), options));
+  }
+
+  // A stage that runs a fuse() chain of handlers on one thread, in place of
+  // one stage per handler; the handlers need no changes either way.
+  template <typename In, typename... Fns>
+  auto* add_fused(const std::string& name, StageOptions options,
+                  Fns&&... fns) {
+    auto chain = fuse(std::forward<Fns>(fns)...);
+    using Chain = decltype(chain);
+    return add_node(std::make_unique<Stage<In, rt_result_t<In, Chain>, Chain>>(
+        name, std::move(chain), options));
+  }
+
+  template <typename Left, typename Right, typename Out>
+  Join<Left, Right, Out>* add_join(
+      const std::string& name,
+      typename Join<Left, Right, Out>::Handler handler,
+      StageOptions options = StageOptions{}) {
+    return add_node(std::make_unique<Join<Left, Right, Out>>(
+        name, std::move(handler), options));
+  }
+
+  // Returns the new edge, which reports how many items it dropped; nullptr
+  // once the pipeline is running.
+  template <typename T>
+  RtEdge<T>* connect(RtOutputPort<T>& from, RtInputPort<T>& to,
+                     EdgeOptions options = EdgeOptions{}) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_.load()) {
+      return nullptr;
+    }
+    auto edge = std::make_shared<RtEdge<T>>(options, to.event_);
+    RtEdge<T>* raw = edge.get();
+    owned_.push_back(std::move(edge));
+    from.edges_.push_back(raw);
+    to.edges_.push_back(raw);
+    return raw;
+  }
+
+  bool start() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (running_.load()) {
+      return false;
+    }
+    running_.store(true);
+    released_ = false;
+    ready_ = 0;
+    for (auto& node : nodes_) {
+      Node* raw = node.get();
+      threads_.emplace_back([this, raw]() {
+        RtScheduler::set_thread_name(raw->name());
+        if (raw->options().priority > 0) {
+          RtScheduler::set_thread_realtime(raw->options().priority);
+        }
+        if (raw->options().cpu_mask != 0) {
+          RtScheduler::set_thread_affinity(raw->options().cpu_mask);
+        }
+        {
+          std::unique_lock<std::mutex> gate(mutex_);
+          ++ready_;
+          gate_cv_.notify_all();
+          gate_cv_.wait(gate, [this]() { return released_; });
+        }
+        raw->run(running_);
+      });
+    }
+    gate_cv_.wait(lock, [this]() { return ready_ == nodes_.size(); });
+    released_ = true;
+    gate_cv_.notify_all();
+    return true;
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    if (!running_.exchange(false)) {
+      return;
+    }
+    for (auto& node : nodes_) {
+      node->wake();
+    }
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+  }
+
+  bool running() const { return running_.load(); }
+
+ private:
+  template <typename NodeType>
+  NodeType* add_node(std::unique_ptr<NodeType> node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_.load()) {
+      return nullptr;
+    }
+    NodeType* raw = node.get();
+    nodes_.push_back(std::move(node));
+    return raw;
+  }
+
+  std::mutex mutex_;
+  std::mutex stop_mutex_;
+  std::condition_variable gate_cv_;
+  size_t ready_ = 0;
+  bool released_ = false;
+  std::atomic<bool> running_{false};
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::vector<std::shared_ptr<void>> owned_;
+  std::vector<std::thread> threads_;
+};
+
 }  // namespace rt
 }  // namespace rtos
@@ -4,6 +4,7 @@
 #include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <vector>
 
 namespace rtos {
 namespace rt {
@@ -34,6 +35,21 @@ class RtQueue {
     return true;
   }
 
+  // Makes room by dropping the oldest item when full; false if it had to.
+  bool push_overwrite(T item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+      return false;
+    }
+    bool room = queue_.size() < capacity_;
+    if (!room) {
+      queue_.pop_front();
+    }
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return room;
+  }
+
   bool try_pop(T* out) {
     std::lock_guard<std::mutex> lock(mutex_);
     if (queue_.empty() || !out) {
@@ -60,6 +76,41 @@ class RtQueue {
     return true;
   }
 
+  // Moves as many of |items| as fit under one lock and returns how many;
+  // the rest stay in |items|.
+  size_t try_push_batch(std::vector<T>* items) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t room = capacity_ > queue_.size() ? capacity_ - queue_.size() : 0;
+    size_t count = items->size() < room ? items->size() : room;
+    for (size_t i = 0; i < count; ++i) {
+      queue_.push_back(std::move((*items)[i]));
+    }
+    items->erase(items->begin(), items->begin() + count);
+    if (count > 0) {
+      not_empty_.notify_all();
+    }
+    return count;
+  }
+
+  // Waits up to |timeout| for an item, then appends up to |max_items| to
+  // |out| under the same lock and returns how many.
+  template <typename Rep, typename Period>
+  size_t pop_batch_for(std::vector<T>* out, size_t max_items,
+                       std::chrono::duration<Rep, Period> timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!out || !not_empty_.wait_for(lock, timeout,
+                                     [this]() { return !queue_.empty(); })) {
+      return 0;
+    }
+    size_t count = queue_.size() < max_items ? queue_.size() : max_items;
+    for (size_t i = 0; i < count; ++i) {
+      out->push_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    not_full_.notify_all();
+    return count;
+  }
+
   size_t size() const {
     std::lock_guard<std::mutex> lock(mutex_);
     return queue_.size();
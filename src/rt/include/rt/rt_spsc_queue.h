@@ -0,0 +1,211 @@
+#pragma once
+
+#include "rt_wait_policy.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace rtos {
+namespace rt {
+
+constexpr size_t kCacheLineBytes = 64;
+
+// Ring size for queues sized at construction rather than at compile time.
+// The slots are allocated once, rounded up to a power of two.
+constexpr size_t kDynamicCapacity = 0;
+
+// Slot storage of a lock-free ring: inline for a fixed N, one heap
+// allocation for kDynamicCapacity.
+template <typename Slot, size_t N>
+class RtRingSlots {
+ public:
+  explicit RtRingSlots(size_t) {}
+  Slot& operator[](size_t index) { return slots_[index & (N - 1)]; }
+  static constexpr size_t size() { return N; }
+
+ private:
+  alignas(kCacheLineBytes) Slot slots_[N];
+};
+
+template <typename Slot>
+class RtRingSlots<Slot, kDynamicCapacity> {
+ public:
+  explicit RtRingSlots(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+  }
+  Slot& operator[](size_t index) { return slots_[index & mask_]; }
+  size_t size() const { return mask_ + 1; }
+
+ private:
+  size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+// Bounded single-producer/single-consumer ring with the try_push/try_pop
+// surface of RtQueue. Storage for N items is part of the object, so pushes
+// never allocate or lock. The head (consumer) and tail (producer) indices
+// sit on their own cache lines, each next to that side's cached copy of the
+// other index, so the sides only touch each other's line when the cached
+// copy says the ring is full or empty. Exactly one thread may push and one
+// thread may pop at a time. With N = kDynamicCapacity the slots are
+// allocated once at construction instead, and a |capacity| below 2 is
+// raised to 2. push_for() and pop_for() wait as WaitPolicy says (see
+// rt_wait_policy.h); with the default SpinYieldWait neither side signals
+// the other, while FutexWait parks the waiter until the other side moves.
+template <typename T, size_t N, typename WaitPolicy = SpinYieldWait>
+class RtSpscQueue {
+  static_assert(N == kDynamicCapacity || (N >= 2 && (N & (N - 1)) == 0),
+                "RtSpscQueue capacity must be a power of two");
+
+ public:
+  // |capacity| limits the usable slots below N, as RtQueue's does.
+  explicit RtSpscQueue(size_t capacity = N)
+      : capacity_(N == kDynamicCapacity ? (capacity < 2 ? 2 : capacity)
+                                        : (capacity < N ? capacity : N)),
+        slots_(capacity_) {}
+
+  ~RtSpscQueue() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t head = head_.load(std::memory_order_relaxed); head != tail;
+         ++head) {
+      slot(head)->~T();
+    }
+  }
+
+  RtSpscQueue(const RtSpscQueue&) = delete;
+  RtSpscQueue& operator=(const RtSpscQueue&) = delete;
+
+  template <typename... Args>
+  bool try_emplace(Args&&... args) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ >= capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ >= capacity_) {
+        return false;
+      }
+    }
+    new (slot(tail)) T(std::forward<Args>(args)...);
+    tail_.store(tail + 1, std::memory_order_release);
+    not_empty_.notify();
+    return true;
+  }
+
+  bool try_push(const T& item) { return try_emplace(item); }
+  bool try_push(T&& item) { return try_emplace(std::move(item)); }
+
+  bool try_pop(T* out) {
+    if (!out) {
+      return false;
+    }
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    T* item = slot(head);
+    *out = std::move(*item);
+    item->~T();
+    head_.store(head + 1, std::memory_order_release);
+    not_full_.notify();
+    return true;
+  }
+
+  // Batches publish their items with a single index store.
+  size_t try_push_batch(std::vector<T>* items) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ + items->size() > capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+    }
+    size_t room = capacity_ - (tail - cached_head_);
+    size_t count = items->size() < room ? items->size() : room;
+    for (size_t i = 0; i < count; ++i) {
+      new (slot(tail + i)) T(std::move((*items)[i]));
+    }
+    tail_.store(tail + count, std::memory_order_release);
+    items->erase(items->begin(), items->begin() + count);
+    if (count > 0) {
+      not_empty_.notify();
+    }
+    return count;
+  }
+
+  template <typename Rep, typename Period>
+  size_t pop_batch_for(std::vector<T>* out, size_t max_items,
+                       std::chrono::duration<Rep, Period> timeout) {
+    if (!out || max_items == 0 ||
+        !not_empty_.wait_until(WaitClock::now() + timeout,
+                               [&]() { return !empty(); })) {
+      return 0;
+    }
+    size_t head = head_.load(std::memory_order_relaxed);
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    size_t count = cached_tail_ - head < max_items ? cached_tail_ - head
+                                                   : max_items;
+    for (size_t i = 0; i < count; ++i) {
+      T* item = slot(head + i);
+      out->push_back(std::move(*item));
+      item->~T();
+    }
+    head_.store(head + count, std::memory_order_release);
+    not_full_.notify();
+    return count;
+  }
+
+  bool push_for(T item, std::chrono::milliseconds timeout) {
+    return not_full_.wait_until(WaitClock::now() + timeout, [&]() {
+      return try_push(std::move(item));
+    });
+  }
+
+  bool pop_for(T* out, std::chrono::milliseconds timeout) {
+    if (!out) {
+      return false;
+    }
+    return not_empty_.wait_until(WaitClock::now() + timeout,
+                                 [&]() { return try_pop(out); });
+  }
+
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  struct alignas(T) Slot {
+    unsigned char bytes[sizeof(T)];
+  };
+
+  T* slot(size_t index) {
+    return std::launder(reinterpret_cast<T*>(slots_[index].bytes));
+  }
+
+  // Consumer side.
+  alignas(kCacheLineBytes) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+
+  // Producer side.
+  alignas(kCacheLineBytes) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  const size_t capacity_;
+
+  alignas(kCacheLineBytes) typename WaitPolicy::Event not_empty_;
+  alignas(kCacheLineBytes) typename WaitPolicy::Event not_full_;
+  RtRingSlots<Slot, N> slots_;
+};
+
+}  // namespace rt
+}  // namespace rtos
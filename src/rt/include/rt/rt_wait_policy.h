@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace rtos {
+namespace rt {
+
+// How a lock-free queue waits for room or for an item. Each policy provides
+// an Event that waiters block on until an attempt succeeds or a deadline
+// passes, and that the other side notifies after every push or pop.
+//
+//   BusySpinWait   spins on the CPU; lowest latency, burns a core.
+//   SpinYieldWait  spins briefly, then yields between attempts.
+//   FutexWait      spins briefly, then sleeps in the kernel. Notifying costs
+//                  a system call only while a waiter is asleep.
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+using WaitClock = std::chrono::steady_clock;
+
+struct BusySpinWait {
+  class Event {
+   public:
+    template <typename Attempt>
+    bool wait_until(WaitClock::time_point deadline, Attempt attempt) {
+      while (true) {
+        for (int spins = 0; spins < 256; ++spins) {
+          if (attempt()) {
+            return true;
+          }
+          cpu_relax();
+        }
+        if (WaitClock::now() >= deadline) {
+          return attempt();
+        }
+      }
+    }
+    void notify() {}
+  };
+};
+
+struct SpinYieldWait {
+  class Event {
+   public:
+    template <typename Attempt>
+    bool wait_until(WaitClock::time_point deadline, Attempt attempt) {
+      for (int spins = 0; spins < 64; ++spins) {
+        if (attempt()) {
+          return true;
+        }
+        cpu_relax();
+      }
+      while (WaitClock::now() < deadline) {
+        std::this_thread::yield();
+        if (attempt()) {
+          return true;
+        }
+      }
+      return attempt();
+    }
+    void notify() {}
+  };
+};
+
+// A waiter reads the epoch, raises the sleepers flag and makes one last
+// attempt before sleeping on that epoch. notify() only enters the kernel
+// when the flag is up, and then clears it, advances the epoch and wakes
+// every sleeper; a waiter that had not gone to sleep yet returns at once
+// because the epoch moved. Notifies that follow, before anyone raises the
+// flag again, cost no system call. Outside Linux, sleeping falls back to
+// yielding.
+struct FutexWait {
+  class Event {
+   public:
+    template <typename Attempt>
+    bool wait_until(WaitClock::time_point deadline, Attempt attempt) {
+      for (int spins = 0; spins < 64; ++spins) {
+        if (attempt()) {
+          return true;
+        }
+        cpu_relax();
+      }
+      while (true) {
+        uint32_t epoch = epoch_.load(std::memory_order_acquire);
+        sleepers_.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (attempt()) {
+          return true;
+        }
+        auto now = WaitClock::now();
+        if (now >= deadline) {
+          return false;
+        }
+        sleep(epoch, deadline - now);
+        if (attempt()) {
+          return true;
+        }
+      }
+    }
+
+    // The fence pairs with the waiter's: either the waiter's last attempt
+    // sees what the caller just published, or this sees the flag.
+    void notify() {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleepers_.load(std::memory_order_relaxed) != 0 &&
+          sleepers_.exchange(0, std::memory_order_relaxed) != 0) {
+        epoch_.fetch_add(1, std::memory_order_release);
+        wake();
+      }
+    }
+
+   private:
+    void sleep(uint32_t epoch, WaitClock::duration timeout) {
+#if defined(__linux__)
+      auto ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+      timespec relative{static_cast<time_t>(ns / 1000000000),
+                        static_cast<long>(ns % 1000000000)};
+      ::syscall(SYS_futex, &epoch_, FUTEX_WAIT_PRIVATE, epoch, &relative,
+                nullptr, 0);
+#else
+      (void)epoch;
+      (void)timeout;
+      std::this_thread::yield();
+#endif
+    }
+
+    void wake() {
+#if defined(__linux__)
+      ::syscall(SYS_futex, &epoch_, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+                nullptr, 0);
+#endif
+    }
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                  "futex word must be a plain 32-bit integer");
+    std::atomic<uint32_t> epoch_{0};
+    std::atomic<uint32_t> sleepers_{0};
+  };
+};
+
+}  // namespace rt
+}  // namespace rtos
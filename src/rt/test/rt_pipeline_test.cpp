@@ -0,0 +1,327 @@
+#include "../include/rt/rt_pipeline.h"
+#include "../include/rt/rt_spsc_queue.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using rtos::rt::EdgeOptions;
+using rtos::rt::EdgeOverflow;
+using rtos::rt::RtPipeline;
+
+template <typename T>
+std::vector<T> drain(RtPipeline::Output<T>* output, size_t count) {
+  std::vector<T> items;
+  T item;
+  while (items.size() < count &&
+         output->pop_for(&item, std::chrono::seconds(5))) {
+    items.push_back(item);
+  }
+  return items;
+}
+
+// Stages hand items to each other directly, in order, and an output port
+// with two edges feeds both consumers.
+void chain_and_fan_out() {
+  RtPipeline pipeline;
+  auto* input = pipeline.add_input<int>();
+  auto* twice = pipeline.add_stage<int, int>(
+      "twice", [](const int& value) { return value * 2; });
+  auto* text = pipeline.add_stage<int, std::string>(
+      "text", [](const int& value) { return std::to_string(value); });
+  auto* numbers = pipeline.add_output<int>();
+  auto* strings = pipeline.add_output<std::string>();
+  pipeline.connect(input->output(), twice->input());
+  pipeline.connect(twice->output(), numbers->input());
+  pipeline.connect(twice->output(), text->input());
+  pipeline.connect(text->output(), strings->input());
+  bool started = pipeline.start();
+  assert(started);
+  started = pipeline.start();
+  assert(!started);
+  auto* late_edge = pipeline.connect(twice->output(), numbers->input());
+  assert(!late_edge);
+
+  for (int i = 0; i < 40; ++i) {
+    input->push(i);
+  }
+  auto doubled = drain(numbers, 40);
+  auto texts = drain(strings, 40);
+  assert(doubled.size() == 40 && texts.size() == 40);
+  for (int i = 0; i < 40; ++i) {
+    assert(doubled[i] == i * 2);
+    assert(texts[i] == std::to_string(i * 2));
+  }
+  pipeline.stop();
+  assert(!pipeline.running());
+}
+
+// Two inputs fan in to one stage, and a join pairs the two streams.
+void fan_in_and_join() {
+  RtPipeline pipeline;
+  auto* left = pipeline.add_input<int>();
+  auto* right = pipeline.add_input<int>();
+  auto* merged = pipeline.add_stage<int, int>(
+      "merged", [](const int& value) { return value; });
+  auto* sum = pipeline.add_join<int, int, int>(
+      "sum", [](const int& a, const int& b) { return a + b; });
+  auto* all = pipeline.add_output<int>();
+  auto* sums = pipeline.add_output<int>();
+  pipeline.connect(left->output(), merged->input());
+  pipeline.connect(right->output(), merged->input());
+  pipeline.connect(merged->output(), all->input());
+  pipeline.connect(left->output(), sum->left());
+  pipeline.connect(right->output(), sum->right());
+  pipeline.connect(sum->output(), sums->input());
+  pipeline.start();
+
+  for (int i = 0; i < 20; ++i) {
+    left->push(i);
+    right->push(1000 + i);
+  }
+  auto items = drain(all, 40);
+  std::set<int> unique(items.begin(), items.end());
+  assert(unique.size() == 40);
+  auto paired = drain(sums, 20);
+  assert(paired.size() == 20);
+  for (int i = 0; i < 20; ++i) {
+    assert(paired[i] == 1000 + 2 * i);
+  }
+}
+
+// Each edge applies its own policy when a slow stage falls behind.
+void overflow_policies() {
+  constexpr int kItems = 50;
+  for (EdgeOverflow overflow : {EdgeOverflow::kDropNewest,
+                                EdgeOverflow::kDropOldest,
+                                EdgeOverflow::kBlock}) {
+    RtPipeline pipeline;
+    auto* input = pipeline.add_input<int>();
+    auto* slow = pipeline.add_stage<int, int>("slow", [](const int& value) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return value;
+    });
+    auto* output = pipeline.add_output<int>();
+    EdgeOptions options;
+    options.capacity = 4;
+    options.overflow = overflow;
+    options.block_timeout = std::chrono::seconds(5);
+    auto* edge = pipeline.connect(input->output(), slow->input(), options);
+    pipeline.connect(slow->output(), output->input());
+    pipeline.start();
+
+    for (int i = 0; i < kItems; ++i) {
+      input->push(i);
+    }
+    std::vector<int> items;
+    int item;
+    while (output->pop_for(&item, std::chrono::milliseconds(200))) {
+      items.push_back(item);
+    }
+    for (size_t i = 1; i < items.size(); ++i) {
+      assert(items[i] > items[i - 1]);
+    }
+    if (overflow == EdgeOverflow::kBlock) {
+      assert(items.size() == kItems);
+      assert(edge->dropped() == 0);
+    } else {
+      assert(edge->dropped() > 0);
+      assert(items.size() + edge->dropped() == kItems);
+    }
+    // Dropping the oldest keeps the newest items; dropping new ones does not.
+    bool newest_kept = !items.empty() && items.back() == kItems - 1;
+    assert(newest_kept == (overflow != EdgeOverflow::kDropNewest));
+  }
+}
+
+// Stage threads take their names and affinity before any item moves.
+void stage_options() {
+  RtPipeline pipeline;
+  auto* input = pipeline.add_input<int>();
+  std::atomic<int> cpu{-1};
+  auto* stage = pipeline.add_stage<int, std::string>(
+      "pinned",
+      [&cpu](const int&) {
+        cpu.store(sched_getcpu());
+        char name[16] = {};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        return std::string(name);
+      },
+      rtos::rt::StageOptions{0, 1u});
+  auto* output = pipeline.add_output<std::string>();
+  pipeline.connect(input->output(), stage->input());
+  pipeline.connect(stage->output(), output->input());
+  pipeline.start();
+  input->push(0);
+  std::string name;
+  bool popped = output->pop_for(&name, std::chrono::seconds(5));
+  assert(popped);
+  assert(name == "pinned");
+  assert(cpu.load() == 0);
+}
+
+// The same three handlers run fused in one stage or threaded as three, and
+// produce the same results; the fused stage holds the chain itself rather
+// than a std::function.
+void fused_segments() {
+  auto parse = [](const std::string& text) { return std::stoi(text); };
+  auto scale = [](const int& value) { return value * 10; };
+  auto clamp = [](const int& value) { return value > 500 ? 500 : value; };
+
+  auto chain = rtos::rt::fuse(parse, scale, clamp);
+  assert(chain(std::string("7")) == 70);
+  assert(chain(std::string("90")) == 500);
+
+  auto stage =
+      rtos::rt::make_fused_stage<std::string>("fused", 32, parse, scale, clamp);
+  using Handler = std::remove_reference_t<decltype(*stage)>::Handler;
+  static_assert(std::is_same<Handler, decltype(chain)>::value,
+                "fused stages call the chain directly");
+  stage->start(0);
+  for (int i = 0; i < 10; ++i) {
+    bool pushed = stage->push(std::to_string(i * 20));
+    assert(pushed);
+  }
+  for (int i = 0; i < 10; ++i) {
+    int out = -1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!stage->pop(&out) && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(out == std::min(i * 200, 500));
+  }
+  stage->stop();
+
+  RtPipeline pipeline;
+  auto* input = pipeline.add_input<std::string>();
+  auto* fused = pipeline.add_fused<std::string>(
+      "fused", rtos::rt::StageOptions{}, parse, scale, clamp);
+  auto* first = pipeline.add_stage<std::string, int>("parse", parse);
+  auto* second = pipeline.add_stage<int, int>("scale", scale);
+  auto* third = pipeline.add_stage<int, int>("clamp", clamp);
+  auto* fused_out = pipeline.add_output<int>();
+  auto* threaded_out = pipeline.add_output<int>();
+  pipeline.connect(input->output(), fused->input());
+  pipeline.connect(fused->output(), fused_out->input());
+  pipeline.connect(input->output(), first->input());
+  pipeline.connect(first->output(), second->input());
+  pipeline.connect(second->output(), third->input());
+  pipeline.connect(third->output(), threaded_out->input());
+  pipeline.start();
+  for (int i = 0; i < 30; ++i) {
+    input->push(std::to_string(i * 7));
+  }
+  auto fused_items = drain(fused_out, 30);
+  auto threaded_items = drain(threaded_out, 30);
+  assert(fused_items.size() == 30);
+  assert(fused_items == threaded_items);
+}
+
+template <typename T>
+bool pop_within(T* stage, int* out) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!stage->pop(out)) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return true;
+}
+
+// A backlog is handed over in full batches, in order, and the output batch
+// is reused rather than reallocated.
+template <typename InputQueue, typename OutputQueue>
+void batch_backlog() {
+  constexpr int kItems = 500;
+  std::atomic<size_t> calls{0};
+  std::atomic<size_t> largest{0};
+  std::atomic<const int*> output_buffer{nullptr};
+  std::atomic<bool> reused{true};
+  rtos::rt::BatchOptions options;
+  options.output_capacity = 1024;
+  rtos::rt::RtBatchStage<int, int, InputQueue, OutputQueue> stage(
+      "batch", 1024,
+      [&](rtos::rt::RtSpan<const int> items, std::vector<int>* out) {
+        assert(out->empty());
+        if (calls.fetch_add(1) > 0 && out->data() != output_buffer.load()) {
+          reused.store(false);
+        }
+        output_buffer.store(out->data());
+        largest.store(std::max(largest.load(), items.size()));
+        for (int item : items) {
+          out->push_back(item * 2);
+        }
+      },
+      options);
+  for (int i = 0; i < kItems; ++i) {
+    bool pushed = stage.push(i);
+    assert(pushed);
+  }
+  stage.start(0);
+  for (int i = 0; i < kItems; ++i) {
+    int out = -1;
+    bool popped = pop_within(&stage, &out);
+    assert(popped);
+    assert(out == i * 2);
+  }
+  stage.stop();
+  assert(largest.load() == options.max_batch);
+  assert(calls.load() == (kItems + options.max_batch - 1) / options.max_batch);
+  assert(reused.load());
+  assert(stage.dropped() == 0);
+}
+
+// With a latency budget, items that trickle in share a batch.
+void batch_latency_budget() {
+  std::atomic<size_t> largest{0};
+  rtos::rt::BatchOptions options;
+  options.latency_budget = std::chrono::milliseconds(20);
+  rtos::rt::RtBatchStage<int, int> stage(
+      "budget", 64,
+      [&](rtos::rt::RtSpan<const int> items, std::vector<int>* out) {
+        largest.store(std::max(largest.load(), items.size()));
+        out->insert(out->end(), items.begin(), items.end());
+      },
+      options);
+  stage.start(0);
+  for (int i = 0; i < 10; ++i) {
+    bool pushed = stage.push(i);
+    assert(pushed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (int i = 0; i < 10; ++i) {
+    int out = -1;
+    bool popped = pop_within(&stage, &out);
+    assert(popped);
+    assert(out == i);
+  }
+  stage.stop();
+  assert(largest.load() > 1);
+}
+
+}  // namespace
+
+int main() {
+  chain_and_fan_out();
+  fan_in_and_join();
+  overflow_policies();
+  stage_options();
+  fused_segments();
+  batch_backlog<rtos::rt::RtQueue<int>, rtos::rt::RtQueue<int>>();
+  batch_backlog<rtos::rt::RtSpscQueue<int, 1024>,
+                rtos::rt::RtSpscQueue<int, 1024>>();
+  batch_latency_budget();
+  return 0;
+}
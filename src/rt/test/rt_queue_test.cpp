@@ -0,0 +1,329 @@
+#include "../include/rt/rt_mpmc_queue.h"
+#include "../include/rt/rt_pipeline.h"
+#include "../include/rt/rt_queue.h"
+#include "../include/rt/rt_spsc_queue.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Counts live instances, so leaked or doubly destroyed items show up.
+struct Tracked {
+  static int live;
+  explicit Tracked(int value = 0) : value(value) { ++live; }
+  Tracked(const Tracked& other) : value(other.value) { ++live; }
+  Tracked& operator=(const Tracked&) = default;
+  ~Tracked() { --live; }
+  int value;
+};
+int Tracked::live = 0;
+
+// Has no default constructor, so queues have to move items out in place.
+struct NoDefault {
+  explicit NoDefault(int value) : value(value) {}
+  int value;
+};
+
+void spsc_basics() {
+  rtos::rt::RtSpscQueue<std::unique_ptr<int>, 8> queue;
+  assert(queue.capacity() == 8);
+  for (int i = 0; i < 8; ++i) {
+    bool pushed = queue.try_push(std::make_unique<int>(i));
+    assert(pushed);
+  }
+  bool pushed = queue.try_push(std::make_unique<int>(8));
+  assert(!pushed);
+  assert(queue.size() == 8);
+
+  // Wraps around the ring several times and stays in order.
+  std::unique_ptr<int> out;
+  for (int i = 0; i < 100; ++i) {
+    bool popped = queue.try_pop(&out);
+    assert(popped);
+    assert(*out == i);
+    pushed = queue.try_emplace(new int(i + 8));
+    assert(pushed);
+  }
+  bool popped = queue.pop_for(nullptr, std::chrono::milliseconds(1));
+  assert(!popped);
+
+  rtos::rt::RtSpscQueue<int, 16> limited(3);
+  pushed = limited.try_push(1) && limited.try_push(2) && limited.try_push(3);
+  assert(pushed);
+  pushed = limited.try_push(4);
+  assert(!pushed);
+  pushed = limited.push_for(4, std::chrono::milliseconds(2));
+  assert(!pushed);
+  int value = 0;
+  popped = limited.try_pop(&value);
+  assert(popped && value == 1);
+
+  {
+    rtos::rt::RtSpscQueue<Tracked, 4> tracked;
+    tracked.try_emplace(1);
+    tracked.try_emplace(2);
+    Tracked item;
+    popped = tracked.try_pop(&item);
+    assert(popped && item.value == 1);
+    assert(Tracked::live == 2);
+  }
+  assert(Tracked::live == 0);
+}
+
+// One producer and one consumer thread move every item across in order.
+void spsc_threads() {
+  constexpr uint64_t kItems = 200000;
+  rtos::rt::RtSpscQueue<uint64_t, 64> queue;
+  std::thread producer([&]() {
+    for (uint64_t i = 0; i < kItems; ++i) {
+      while (!queue.try_push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  for (uint64_t i = 0; i < kItems; ++i) {
+    uint64_t value = 0;
+    bool popped = queue.pop_for(&value, std::chrono::seconds(5));
+    assert(popped);
+    assert(value == i);
+  }
+  producer.join();
+  assert(queue.empty());
+}
+
+// A stage runs unchanged on SPSC queues.
+void spsc_stage() {
+  rtos::rt::RtStage<int, int, rtos::rt::RtSpscQueue<int, 32>,
+                    rtos::rt::RtSpscQueue<int, 64>>
+      stage("spsc-stage", 32, [](const int& value) { return value * 2; });
+  stage.start(0);
+  for (int i = 0; i < 20; ++i) {
+    bool pushed = stage.push(i);
+    assert(pushed);
+  }
+  for (int i = 0; i < 20; ++i) {
+    int out = -1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!stage.pop(&out) && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(out == i * 2);
+  }
+  stage.stop();
+}
+
+void mpmc_basics() {
+  rtos::rt::RtMpmcQueue<std::unique_ptr<int>, 4> queue;
+  for (int i = 0; i < 4; ++i) {
+    bool pushed = queue.try_push(std::make_unique<int>(i));
+    assert(pushed);
+  }
+  bool pushed = queue.try_push(std::make_unique<int>(4));
+  assert(!pushed);
+  pushed = queue.push_for(std::make_unique<int>(4),
+                          std::chrono::milliseconds(2));
+  assert(!pushed);
+  std::unique_ptr<int> out;
+  for (int i = 0; i < 50; ++i) {
+    bool popped = queue.try_pop(&out);
+    assert(popped);
+    assert(*out == i);
+    pushed = queue.try_emplace(new int(i + 4));
+    assert(pushed);
+  }
+
+  {
+    rtos::rt::RtMpmcQueue<Tracked, 8, rtos::rt::FutexWait> tracked;
+    tracked.try_emplace(1);
+    tracked.try_emplace(2);
+    assert(Tracked::live == 2);
+  }
+  assert(Tracked::live == 0);
+
+  rtos::rt::RtMpmcQueue<int, 8, rtos::rt::FutexWait> empty;
+  int value = 0;
+  auto begin = std::chrono::steady_clock::now();
+  bool popped = empty.pop_for(&value, std::chrono::milliseconds(20));
+  assert(!popped);
+  assert(std::chrono::steady_clock::now() - begin >=
+         std::chrono::milliseconds(20));
+}
+
+// Producers and consumers hand every item over exactly once, through a ring
+// much smaller than the stream so both sides keep waiting on each other.
+template <typename WaitPolicy>
+void mpmc_threads(uint32_t per_producer = 30000) {
+  constexpr uint32_t kProducers = 3;
+  constexpr uint32_t kConsumers = 3;
+  rtos::rt::RtMpmcQueue<uint32_t, 16, WaitPolicy> queue;
+  std::vector<std::atomic<uint32_t>> seen(kProducers * per_producer);
+  std::atomic<uint32_t> received{0};
+
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < kProducers; ++p) {
+    threads.emplace_back([&, p]() {
+      for (uint32_t i = 0; i < per_producer; ++i) {
+        bool pushed =
+            queue.push_for(p * per_producer + i, std::chrono::seconds(5));
+        assert(pushed);
+      }
+    });
+  }
+  for (uint32_t c = 0; c < kConsumers; ++c) {
+    threads.emplace_back([&]() {
+      // Each producer's items arrive in the order it pushed them.
+      std::vector<int64_t> last(kProducers, -1);
+      uint32_t value = 0;
+      while (received.load() < kProducers * per_producer) {
+        if (!queue.pop_for(&value, std::chrono::milliseconds(5))) {
+          continue;
+        }
+        uint32_t times_seen = seen[value].fetch_add(1);
+        assert(times_seen == 0);
+        int64_t index = value % per_producer;
+        assert(index > last[value / per_producer]);
+        last[value / per_producer] = index;
+        received.fetch_add(1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  assert(received.load() == kProducers * per_producer);
+  assert(queue.empty());
+}
+
+// A consumer asleep on the futex wakes for a push made well after it slept.
+void futex_wakeup() {
+  rtos::rt::RtMpmcQueue<int, 8, rtos::rt::FutexWait> queue;
+  std::thread producer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    bool pushed = queue.try_push(7);
+    assert(pushed);
+  });
+  int value = 0;
+  auto begin = std::chrono::steady_clock::now();
+  bool popped = queue.pop_for(&value, std::chrono::seconds(5));
+  assert(popped);
+  assert(value == 7);
+  assert(std::chrono::steady_clock::now() - begin < std::chrono::seconds(1));
+  producer.join();
+}
+
+// A producer parked on a full SPSC ring wakes when the consumer pops.
+void spsc_futex_room() {
+  rtos::rt::RtSpscQueue<int, 2, rtos::rt::FutexWait> queue;
+  bool filled = queue.try_push(1) && queue.try_push(2);
+  assert(filled);
+  auto begin = std::chrono::steady_clock::now();
+  std::thread producer([&]() {
+    bool pushed = queue.push_for(3, std::chrono::seconds(5));
+    assert(pushed);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  int value = 0;
+  bool popped = queue.try_pop(&value);
+  assert(popped && value == 1);
+  producer.join();
+  assert(std::chrono::steady_clock::now() - begin < std::chrono::seconds(1));
+  popped = queue.try_pop(&value) && queue.try_pop(&value);
+  assert(popped && value == 3);
+}
+
+// Rings sized at run time round up to a power of two; the SPSC ring still
+// holds only what was asked for, but at least two items. Overwriting drops
+// the oldest items.
+void dynamic_capacity() {
+  rtos::rt::RtSpscQueue<int, rtos::rt::kDynamicCapacity> tiny(0);
+  assert(tiny.capacity() == 2);
+  bool tiny_pushed = tiny.try_push(1);
+  assert(tiny_pushed);
+
+  rtos::rt::RtSpscQueue<int, rtos::rt::kDynamicCapacity> spsc(5);
+  assert(spsc.capacity() == 5);
+  for (int i = 0; i < 5; ++i) {
+    bool pushed = spsc.try_push(i);
+    assert(pushed);
+  }
+  bool pushed = spsc.try_push(5);
+  assert(!pushed);
+
+  rtos::rt::RtMpmcQueue<Tracked, rtos::rt::kDynamicCapacity> mpmc(3);
+  assert(mpmc.capacity() == 4);
+  for (int i = 0; i < 6; ++i) {
+    bool kept = mpmc.push_overwrite(Tracked(i));
+    assert(kept == (i < 4));
+  }
+  Tracked item;
+  for (int i = 2; i < 6; ++i) {
+    bool popped = mpmc.try_pop(&item);
+    assert(popped && item.value == i);
+  }
+  bool popped = mpmc.try_pop(&item);
+  assert(!popped);
+
+  rtos::rt::RtMpmcQueue<NoDefault, 4> no_default;
+  for (int i = 0; i < 6; ++i) {
+    no_default.push_overwrite(NoDefault(i));
+  }
+  std::vector<NoDefault> batch;
+  size_t taken =
+      no_default.pop_batch_for(&batch, 8, std::chrono::milliseconds(1));
+  assert(taken == 4 && batch.front().value == 2 && batch.back().value == 5);
+}
+
+// Batches move what fits and leave the rest with the caller, and a batch
+// pop takes what is queued up to its limit.
+template <typename Queue>
+void batches(Queue* queue, size_t capacity) {
+  std::vector<int> items;
+  for (size_t i = 0; i < capacity + 3; ++i) {
+    items.push_back(static_cast<int>(i));
+  }
+  size_t pushed = queue->try_push_batch(&items);
+  assert(pushed == capacity);
+  assert(items.size() == 3 && items[0] == static_cast<int>(capacity));
+
+  std::vector<int> out;
+  size_t popped = queue->pop_batch_for(&out, 2, std::chrono::milliseconds(1));
+  assert(popped == 2);
+  popped = queue->pop_batch_for(&out, 100, std::chrono::milliseconds(1));
+  assert(popped == capacity - 2);
+  for (size_t i = 0; i < capacity; ++i) {
+    assert(out[i] == static_cast<int>(i));
+  }
+  popped = queue->pop_batch_for(&out, 100, std::chrono::microseconds(500));
+  assert(popped == 0);
+}
+
+}  // namespace
+
+int main() {
+  spsc_basics();
+  spsc_threads();
+  spsc_stage();
+  mpmc_basics();
+  // Spinners only give up the CPU when preempted, so without a core each
+  // the spinning run is kept short.
+  mpmc_threads<rtos::rt::BusySpinWait>(
+      std::thread::hardware_concurrency() >= 6 ? 30000 : 300);
+  mpmc_threads<rtos::rt::SpinYieldWait>();
+  mpmc_threads<rtos::rt::FutexWait>();
+  futex_wakeup();
+  spsc_futex_room();
+  dynamic_capacity();
+  assert(Tracked::live == 0);
+  rtos::rt::RtQueue<int> locked(8);
+  batches(&locked, 8);
+  rtos::rt::RtSpscQueue<int, 8> spsc;
+  batches(&spsc, 8);
+  rtos::rt::RtMpmcQueue<int, 8> mpmc;
+  batches(&mpmc, 8);
+  return 0;
+}